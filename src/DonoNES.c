@@ -1,59 +1,62 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "cpu.h"
-#include "memory.h"
-
-void loadFile(const char *fileName, void **contents, int *fileSize);
+#include "file.h"
+#include "nes.h"
+#include "trace.h"
 
 int main(int argc, char *argv[]) {
-   if (argc < 2) {
-      fprintf(stderr, "Usage: %s rom.nes\n", argv[0]);
+   const char *args[3] = {NULL, NULL, NULL};
+   int count = 0, pc = -1;
+
+   for (int i = 1; i < argc; i++) {
+      if (!strcmp(argv[i], "-pc") && i + 1 < argc) {
+         pc = (int)strtol(argv[++i], NULL, 16);
+      } else if (count < 3) {
+         args[count++] = argv[i];
+      } else {
+         count = 0;
+         break;
+      }
+   }
+
+   if (count < 2) {
+      fprintf(stderr, "Usage: %s rom.nes frames [trace.bin] [-pc hex]\n", argv[0]);
+      fprintf(stderr, "  trace.bin gets every instruction, see tracefmt to read it\n");
+      fprintf(stderr, "  -pc starts somewhere other than the reset vector, C000 for nestest's\n");
+      fprintf(stderr, "  automation mode that nestest.log records\n");
       return 1;
    }
 
    void *rom = NULL;
    int fileSize = 0;
 
-   loadFile(argv[1], &rom, &fileSize);
+   loadFile(args[0], &rom, &fileSize);
 
-   initMemory(rom, fileSize);
-   initCPU();
+   nes_t *nes = createNES(rom, fileSize);
 
    free(rom);
-
-   while (1) {
-      step();
-      getchar();
+   if (pc >= 0) {
+      setPC(nes, (uint16_t)pc);
    }
 
-   cleanMemory();
-   cleanCPU();
+   int frames = atoi(args[1]);
+   int frame;
 
-   return 0;
-}
+   if (count > 2 && !traceOpen(nes, args[2], TRACE_INSTRUCTIONS)) {
+      return 1;
+   }
 
-void loadFile(const char *fileName, void **contents, int *fileSize) {
-   FILE *fp = NULL;
+   for (frame = 0; frame < frames && !cpuHalted(nes); frame++) {
+      runFrame(nes);
+   }
 
-   if ((fp = fopen(fileName, "rb"))) {
-      fseek(fp, 0, SEEK_END);
-      *fileSize = ftell(fp);
-      fseek(fp, 0, SEEK_SET);
+   traceClose(nes);
+   fprintf(stderr, "%d frames, %" PRIu64 " cycles\n", frame, cpuCycles(nes));
 
-      if ((*contents = malloc(*fileSize))) {
-         if (fread(*contents, 1, *fileSize, fp) != *fileSize) {
-            fprintf(stderr, "File read error\n");
-            exit(1);
-         }
-         fclose(fp);
-      } else {
-         fprintf(stderr, "Could not allocate memory\n");
-         exit(1);
-      }
-   } else {
-      fprintf(stderr, "Could not load file %s\n", fileName);
-      exit(1);
-   }
-}
+   destroyNES(nes);
 
+   return 0;
+}
@@ -0,0 +1,717 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apu.h"
+#include "cpu.h"
+#include "nes.h"
+#include "scheduler.h"
+
+// What the mixer's output is scaled by, every channel at full volume comes
+// to just under it
+#define APU_AMPLITUDE 32767
+
+// What a frame sequence step clocks
+#define QUARTER_FRAME 1
+#define HALF_FRAME    2
+
+enum {
+   CHANNEL_PULSE1,
+   CHANNEL_PULSE2,
+   CHANNEL_TRIANGLE,
+   CHANNEL_NOISE,
+   CHANNEL_DMC,
+   NUM_CHANNELS
+};
+
+// Frame sequence steps in cycles from the start of the sequence, for
+// $4017's 4-step and 5-step modes
+typedef struct {
+   uint16_t cycle;
+   uint8_t  clocks;
+} step_t;
+
+static const step_t Steps[2][5] = {
+   {{7457, QUARTER_FRAME}, {14913, QUARTER_FRAME | HALF_FRAME}, {22371, QUARTER_FRAME}, {29829, QUARTER_FRAME | HALF_FRAME}},
+   {{7457, QUARTER_FRAME}, {14913, QUARTER_FRAME | HALF_FRAME}, {22371, QUARTER_FRAME}, {29829, 0}, {37281, QUARTER_FRAME | HALF_FRAME}}
+};
+static const int StepCount[2] = {4, 5};
+static const uint32_t SequenceLength[2] = {APU_FRAME_CYCLES, 37282};
+
+// Length counter loads, indexed by bits 3-7 of $4003/$4007/$400B/$400F
+static const uint8_t Lengths[32] = {
+   10, 254, 20,  2, 40,  4, 80,  6, 160,  8, 60, 10, 14, 12, 26, 14,
+   12,  16, 24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30
+};
+
+static const uint8_t Duties[4][8] = {
+   {0, 1, 0, 0, 0, 0, 0, 0},
+   {0, 1, 1, 0, 0, 0, 0, 0},
+   {0, 1, 1, 1, 1, 0, 0, 0},
+   {1, 0, 0, 1, 1, 1, 1, 1}
+};
+
+// CPU cycles per noise shift for each $400E period, NTSC
+static const uint16_t NoisePeriods[16] = {
+   4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068
+};
+
+// CPU cycles per DMC output bit for each $4010 rate, NTSC
+static const uint16_t DMCRates[16] = {
+   428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106, 84, 72, 54
+};
+
+// The console's nonlinear mix, looked up by the two pulses' sum and by
+// 3 * triangle + 2 * noise + DMC
+typedef struct {
+   int16_t pulse[31];
+   int16_t tnd[203];
+} mixer_t;
+
+static mixer_t buildMixer(void) {
+   mixer_t mixer;
+
+   mixer.pulse[0] = mixer.tnd[0] = 0;
+   for (int i = 1; i < 31; i++) {
+      mixer.pulse[i] = (int16_t)lround(APU_AMPLITUDE * 95.52 / (8128.0 / i + 100));
+   }
+   for (int i = 1; i < 203; i++) {
+      mixer.tnd[i] = (int16_t)lround(APU_AMPLITUDE * 163.67 / (24329.0 / i + 100));
+   }
+   return mixer;
+}
+
+static const mixer_t &mixer(void) {
+   static const mixer_t Mixer = buildMixer();
+
+   return Mixer;
+}
+
+// 4-step mode with the IRQ allowed, bit 7 picks 5-step and bit 6 inhibits
+static int frameIRQEnabled(const apu_t *apu) {
+   return !(apu->frameCounter & 0xC0);
+}
+
+// Ends of the frame sequence reached by cycle
+static uint64_t sequencesBy(const apu_t *apu, uint64_t cycle) {
+   return (cycle - apu->sequenceStart) / APU_FRAME_CYCLES;
+}
+
+static void scheduleFrameIRQ(nes_t *nes) {
+   apu_t *apu = &nes->apu;
+
+   if (frameIRQEnabled(apu)) {
+      schedule(nes, EVENT_APU_FRAME, apu->sequenceStart + (sequencesBy(apu, apu->cycle) + 1) * APU_FRAME_CYCLES);
+   } else {
+      cancelEvent(nes, EVENT_APU_FRAME);
+   }
+}
+
+static int envelopeVolume(uint8_t control, const envelope_t *envelope) {
+   return (control & 0x10) ? control & 0x0F : envelope->decay;
+}
+
+static uint32_t pulsePeriod(const pulse_t *pulse) {
+   return (pulse->timerPeriod + 1) * 2;
+}
+
+// Pulse 1 negates with one's complement, pulse 2 with two's
+static int sweepTarget(const pulse_t *pulse, int channel) {
+   int change = pulse->timerPeriod >> (pulse->sweep & 0x07);
+
+   if (pulse->sweep & 0x08) {
+      return pulse->timerPeriod - change - (channel == CHANNEL_PULSE1);
+   }
+   return pulse->timerPeriod + change;
+}
+
+// Heard while the duty cycle is high, 0 when it's silent at every step
+static int pulseVolume(const pulse_t *pulse, int channel) {
+   if (!pulse->length || pulse->timerPeriod < 8 || sweepTarget(pulse, channel) > 0x7FF) {
+      return 0;
+   }
+   return envelopeVolume(pulse->control, &pulse->envelope);
+}
+
+// Stops stepping, holding its output, when a counter runs out. Periods
+// under 2 step it far above hearing and only add a pop, so those stop too.
+static int triangleHalted(const triangle_t *triangle) {
+   return !triangle->length || !triangle->linear || triangle->timerPeriod < 2;
+}
+
+static int triangleOutput(const triangle_t *triangle) {
+   return triangle->step < 16 ? 15 - triangle->step : triangle->step - 16;
+}
+
+static int noiseVolume(const noise_t *noise) {
+   return noise->length ? envelopeVolume(noise->control, &noise->envelope) : 0;
+}
+
+static int mixOutput(const apu_t *apu) {
+   const mixer_t &mix = mixer();
+   int pulses = 0;
+
+   for (int channel = CHANNEL_PULSE1; channel <= CHANNEL_PULSE2; channel++) {
+      const pulse_t *pulse = &apu->pulse[channel];
+
+      if (Duties[pulse->control >> 6][pulse->step]) {
+         pulses += pulseVolume(pulse, channel);
+      }
+   }
+   int noise = (apu->noise.shift & 1) ? 0 : noiseVolume(&apu->noise);
+
+   return mix.pulse[pulses] + mix.tnd[3 * triangleOutput(&apu->triangle) + 2 * noise + apu->dmc.level];
+}
+
+// Puts the mixer's output moving at cycle into blip, nothing when the
+// change didn't reach it or nobody is listening
+static void emit(nes_t *nes, uint64_t cycle) {
+   apu_t *apu = &nes->apu;
+
+   if (!(nes->outputs & OUTPUT_AUDIO)) {
+      return;
+   }
+
+   int mix = mixOutput(apu);
+
+   if (mix != apu->mix) {
+      blipAddDelta(&apu->blip, (uint32_t)(cycle - apu->frameStart), mix - apu->mix);
+      apu->mix = mix;
+   }
+}
+
+static uint64_t dmcRate(const dmc_t *dmc) {
+   return DMCRates[dmc->control & 0x0F];
+}
+
+// Cycle the byte being played ends and the buffered one is taken
+static uint64_t dmcByteEnd(const dmc_t *dmc) {
+   return dmc->nextBit + (dmc->bitsRemaining - 1) * dmcRate(dmc);
+}
+
+// A silent byte changes nothing until it ends, so it's played in one go
+static uint64_t channelClock(const apu_t *apu, int channel) {
+   switch (channel) {
+      case CHANNEL_PULSE1:
+      case CHANNEL_PULSE2:
+         return apu->pulse[channel].nextClock;
+      case CHANNEL_TRIANGLE:
+         return apu->triangle.nextClock;
+      case CHANNEL_NOISE:
+         return apu->noise.nextClock;
+      default:
+         return apu->dmc.silence ? dmcByteEnd(&apu->dmc) : apu->dmc.nextBit;
+   }
+}
+
+static void clockDMC(dmc_t *dmc) {
+   if (dmc->silence) {
+      dmc->nextBit       = dmcByteEnd(dmc);
+      dmc->bitsRemaining = 1;
+   } else if (dmc->shift & 1) {
+      if (dmc->level <= 125) {
+         dmc->level += 2;
+      }
+   } else if (dmc->level >= 2) {
+      dmc->level -= 2;
+   }
+   dmc->shift >>= 1;
+   dmc->nextBit += dmcRate(dmc);
+
+   if (--dmc->bitsRemaining == 0) {
+      dmc->bitsRemaining = 8;
+      dmc->silence       = !dmc->bufferFull;
+      dmc->shift         = dmc->buffer;
+      dmc->bufferFull    = 0;
+   }
+}
+
+static void clockChannel(apu_t *apu, int channel) {
+   switch (channel) {
+      case CHANNEL_PULSE1:
+      case CHANNEL_PULSE2: {
+         pulse_t *pulse = &apu->pulse[channel];
+
+         pulse->step = (pulse->step + 1) & 7;
+         pulse->nextClock += pulsePeriod(pulse);
+         break;
+      }
+      case CHANNEL_TRIANGLE:
+         apu->triangle.step = (apu->triangle.step + 1) & 31;
+         apu->triangle.nextClock += apu->triangle.timerPeriod + 1;
+         break;
+      case CHANNEL_NOISE: {
+         noise_t *noise = &apu->noise;
+         int feedback = (noise->shift ^ (noise->shift >> ((noise->period & 0x80) ? 6 : 1))) & 1;
+
+         noise->shift = noise->shift >> 1 | feedback << 14;
+         noise->nextClock += NoisePeriods[noise->period & 0x0F];
+         break;
+      }
+      default:
+         clockDMC(&apu->dmc);
+         break;
+   }
+}
+
+// Whole periods from next to the first clock at or after cycle
+static uint64_t periodsTo(uint64_t next, uint64_t cycle, uint64_t period) {
+   return next < cycle ? (cycle - next + period - 1) / period : 0;
+}
+
+// Channels nobody can hear skip to cycle in one step. Only the frame
+// sequence or a register write can make them heard again, and neither
+// happens inside runChannels(). The noise register isn't shifted while
+// it's silent, being random it doesn't matter where it picks up. Without
+// OUTPUT_AUDIO all of them are, only the DMC's reads affect the game.
+static void skipSilent(apu_t *apu, uint64_t cycle, int muted) {
+   for (int channel = CHANNEL_PULSE1; channel <= CHANNEL_PULSE2; channel++) {
+      pulse_t *pulse = &apu->pulse[channel];
+
+      if (muted || !pulseVolume(pulse, channel)) {
+         uint64_t periods = periodsTo(pulse->nextClock, cycle, pulsePeriod(pulse));
+
+         pulse->step = (pulse->step + periods) & 7;
+         pulse->nextClock += periods * pulsePeriod(pulse);
+      }
+   }
+   if (muted || triangleHalted(&apu->triangle)) {
+      apu->triangle.nextClock += periodsTo(apu->triangle.nextClock, cycle, apu->triangle.timerPeriod + 1) * (apu->triangle.timerPeriod + 1);
+   }
+   if (muted || !noiseVolume(&apu->noise)) {
+      uint16_t period = NoisePeriods[apu->noise.period & 0x0F];
+
+      apu->noise.nextClock += periodsTo(apu->noise.nextClock, cycle, period) * period;
+   }
+}
+
+// Clocks every channel due before cycle, soonest first, so the mixer sees
+// them all as they were at each change
+static void runChannels(nes_t *nes, uint64_t cycle) {
+   apu_t *apu = &nes->apu;
+
+   skipSilent(apu, cycle, !(nes->outputs & OUTPUT_AUDIO));
+
+   for (;;) {
+      uint64_t next = cycle;
+      int due = NUM_CHANNELS;
+
+      for (int channel = 0; channel < NUM_CHANNELS; channel++) {
+         uint64_t clock = channelClock(apu, channel);
+
+         if (clock < next) {
+            next = clock;
+            due  = channel;
+         }
+      }
+      if (due == NUM_CHANNELS) {
+         return;
+      }
+      clockChannel(apu, due);
+      emit(nes, next);
+   }
+}
+
+static void clockEnvelope(envelope_t *envelope, uint8_t control) {
+   if (envelope->start) {
+      envelope->start   = 0;
+      envelope->decay   = 15;
+      envelope->divider = control & 0x0F;
+   } else if (envelope->divider) {
+      envelope->divider--;
+   } else {
+      envelope->divider = control & 0x0F;
+      if (envelope->decay) {
+         envelope->decay--;
+      } else if (control & 0x20) {
+         envelope->decay = 15;
+      }
+   }
+}
+
+static void clockSweep(pulse_t *pulse, int channel) {
+   int target = sweepTarget(pulse, channel);
+
+   if (!pulse->sweepDivider && (pulse->sweep & 0x80) && (pulse->sweep & 0x07) &&
+       pulse->timerPeriod >= 8 && target <= 0x7FF) {
+      pulse->timerPeriod = target;
+   }
+   if (!pulse->sweepDivider || pulse->sweepReload) {
+      pulse->sweepDivider = (pulse->sweep >> 4) & 0x07;
+      pulse->sweepReload  = 0;
+   } else {
+      pulse->sweepDivider--;
+   }
+}
+
+// Envelopes and the linear counter every quarter frame, length counters
+// and sweeps every half
+static void clockFrame(apu_t *apu, int clocks) {
+   triangle_t *triangle = &apu->triangle;
+
+   if (clocks & QUARTER_FRAME) {
+      clockEnvelope(&apu->pulse[0].envelope, apu->pulse[0].control);
+      clockEnvelope(&apu->pulse[1].envelope, apu->pulse[1].control);
+      clockEnvelope(&apu->noise.envelope, apu->noise.control);
+
+      if (triangle->linearReload) {
+         triangle->linear = triangle->control & 0x7F;
+      } else if (triangle->linear) {
+         triangle->linear--;
+      }
+      if (!(triangle->control & 0x80)) {
+         triangle->linearReload = 0;
+      }
+   }
+   if (clocks & HALF_FRAME) {
+      for (int channel = CHANNEL_PULSE1; channel <= CHANNEL_PULSE2; channel++) {
+         pulse_t *pulse = &apu->pulse[channel];
+
+         if (pulse->length && !(pulse->control & 0x20)) {
+            pulse->length--;
+         }
+         clockSweep(pulse, channel);
+      }
+      if (triangle->length && !(triangle->control & 0x80)) {
+         triangle->length--;
+      }
+      if (apu->noise.length && !(apu->noise.control & 0x20)) {
+         apu->noise.length--;
+      }
+   }
+}
+
+static void nextStep(apu_t *apu) {
+   int mode = apu->frameCounter >> 7;
+   uint64_t start = apu->stepCycle - Steps[mode][apu->sequenceStep].cycle;
+
+   if (++apu->sequenceStep == StepCount[mode]) {
+      apu->sequenceStep = 0;
+      start += SequenceLength[mode];
+   }
+   apu->stepCycle = start + Steps[mode][apu->sequenceStep].cycle;
+}
+
+static void restartSample(dmc_t *dmc) {
+   dmc->address        = dmc->sampleAddress;
+   dmc->bytesRemaining = dmc->sampleLength;
+}
+
+// The reader fills the empty buffer straight away, stalling the CPU
+static void dmcFetch(nes_t *nes) {
+   dmc_t *dmc = &nes->apu.dmc;
+
+   dmc->buffer     = fetch(nes, dmc->address);
+   dmc->bufferFull = 1;
+   dmc->address    = dmc->address == 0xFFFF ? 0x8000 : dmc->address + 1;
+   stallCPU(nes, DMC_DMA_CYCLES);
+
+   if (--dmc->bytesRemaining == 0) {
+      if (dmc->control & 0x40) {
+         restartSample(dmc);
+      } else if (dmc->control & 0x80) {
+         setIRQ(nes, IRQ_DMC, 1);
+      }
+   }
+}
+
+// Due just after the byte being played ends, while there's more to read.
+// The output unit takes the buffer without help, catching up does that.
+static void scheduleDMC(nes_t *nes) {
+   dmc_t *dmc = &nes->apu.dmc;
+
+   if (dmc->bytesRemaining) {
+      schedule(nes, EVENT_DMC, dmcByteEnd(dmc) + 1);
+   } else {
+      cancelEvent(nes, EVENT_DMC);
+   }
+}
+
+static void setHighPass(filter_t *filter, double cutoff, double rate) {
+   double rc = 1 / (2 * M_PI * cutoff);
+
+   filter->coefficient = (float)(rc / (rc + 1 / rate));
+}
+
+static void setLowPass(filter_t *filter, double cutoff, double rate) {
+   double rc = 1 / (2 * M_PI * cutoff);
+
+   filter->coefficient = (float)((1 / rate) / (rc + 1 / rate));
+}
+
+// Each section runs over the whole block before the next one starts
+static void highPass(filter_t *filter, float *block, int count) {
+   for (int i = 0; i < count; i++) {
+      float out = filter->coefficient * (filter->lastOut + block[i] - filter->lastIn);
+
+      filter->lastIn  = block[i];
+      filter->lastOut = out;
+      block[i] = out;
+   }
+}
+
+static void lowPass(filter_t *filter, float *block, int count) {
+   for (int i = 0; i < count; i++) {
+      filter->lastOut += filter->coefficient * (block[i] - filter->lastOut);
+      block[i] = filter->lastOut;
+   }
+}
+
+void initAPU(nes_t *nes) {
+   apu_t *apu = &nes->apu;
+   double rate = apu->sampleRate ? apu->sampleRate : APU_SAMPLE_RATE;
+
+   memset(apu, 0, sizeof(apu_t));
+   apu->stepCycle = Steps[0][0].cycle;
+   scheduleFrameIRQ(nes);
+
+   apu->pulse[0].nextClock  = pulsePeriod(&apu->pulse[0]);
+   apu->pulse[1].nextClock  = pulsePeriod(&apu->pulse[1]);
+   apu->triangle.nextClock  = 1;
+   apu->noise.shift         = 1;
+   apu->noise.nextClock     = NoisePeriods[0];
+   apu->dmc.sampleAddress   = 0xC000;
+   apu->dmc.sampleLength    = 1;
+   apu->dmc.bitsRemaining   = 8;
+   apu->dmc.silence         = 1;
+   apu->dmc.nextBit         = dmcRate(&apu->dmc);
+
+   // The triangle doesn't power on at 0, blip starts from wherever the
+   // mixer does
+   apu->mix = mixOutput(apu);
+   initBlip(&apu->blip, APU_CLOCK_RATE, rate);
+   setSampleRate(nes, rate);
+}
+
+void setSampleRate(nes_t *nes, double rate) {
+   apu_t *apu = &nes->apu;
+
+   apu->sampleRate = rate;
+   setBlipRates(&apu->blip, APU_CLOCK_RATE, rate);
+   setHighPass(&apu->highPass[0], 90, rate);
+   setHighPass(&apu->highPass[1], 440, rate);
+   setLowPass(&apu->lowPass, 14000, rate);
+}
+
+// The frame IRQ repeats with nothing else to do, so it's one division.
+// The channels only stop at frame sequence steps, which change what they
+// sound like, and at their own amplitude changes.
+void apuCatchUp(nes_t *nes, uint64_t cycle) {
+   apu_t *apu = &nes->apu;
+
+   if (cycle <= apu->cycle) {
+      return;
+   }
+   if (frameIRQEnabled(apu) && sequencesBy(apu, cycle) > sequencesBy(apu, apu->cycle)) {
+      setIRQ(nes, IRQ_APU_FRAME, 1);
+   }
+   while (apu->stepCycle < cycle) {
+      runChannels(nes, apu->stepCycle);
+      clockFrame(apu, Steps[apu->frameCounter >> 7][apu->sequenceStep].clocks);
+      emit(nes, apu->stepCycle);
+      nextStep(apu);
+   }
+   runChannels(nes, cycle);
+   apu->cycle = cycle;
+}
+
+void apuEndFrame(nes_t *nes) {
+   apu_t *apu = &nes->apu;
+   int32_t levels[APU_MAX_SAMPLES];
+   float block[APU_MAX_SAMPLES];
+
+   apuCatchUp(nes, nes->masterCycles);
+   if (!(nes->outputs & OUTPUT_AUDIO)) {
+      apu->frameStart  = apu->cycle;
+      apu->sampleCount = 0;
+      return;
+   }
+   blipEndFrame(&apu->blip, (uint32_t)(apu->cycle - apu->frameStart));
+   apu->frameStart = apu->cycle;
+
+   int count = blipRead(&apu->blip, levels, APU_MAX_SAMPLES);
+
+   for (int i = 0; i < count; i++) {
+      block[i] = (float)levels[i];
+   }
+   highPass(&apu->highPass[0], block, count);
+   highPass(&apu->highPass[1], block, count);
+   lowPass(&apu->lowPass, block, count);
+
+   for (int i = 0; i < count; i++) {
+      float sample = block[i] < -32768 ? -32768 : block[i] > 32767 ? 32767 : block[i];
+
+      apu->samples[i] = (int16_t)lrintf(sample);
+   }
+   apu->sampleCount = count;
+}
+
+uint8_t apuRead(nes_t *nes, uint16_t addr) {
+   apu_t *apu = &nes->apu;
+
+   apuCatchUp(nes, busCycle(nes));
+
+   // Reading $4015 acknowledges the frame IRQ
+   if (addr == 0x4015) {
+      uint8_t status = ((nes->irqLines & IRQ_DMC) ? 0x80 : 0) |
+                       ((nes->irqLines & IRQ_APU_FRAME) ? 0x40 : 0) |
+                       (apu->dmc.bytesRemaining ? 0x10 : 0) |
+                       (apu->noise.length ? 0x08 : 0) |
+                       (apu->triangle.length ? 0x04 : 0) |
+                       (apu->pulse[1].length ? 0x02 : 0) |
+                       (apu->pulse[0].length ? 0x01 : 0);
+
+      setIRQ(nes, IRQ_APU_FRAME, 0);
+      return status;
+   }
+   // registers
+   return addr - 0x4000;
+}
+
+static void pulseWrite(apu_t *apu, int channel, int reg, uint8_t value) {
+   pulse_t *pulse = &apu->pulse[channel];
+
+   switch (reg) {
+      case 0:
+         pulse->control = value;
+         break;
+      case 1:
+         pulse->sweep       = value;
+         pulse->sweepReload = 1;
+         break;
+      case 2:
+         pulse->timerPeriod = (pulse->timerPeriod & 0x700) | value;
+         break;
+      case 3:
+         pulse->timerPeriod = (pulse->timerPeriod & 0xFF) | (value & 0x07) << 8;
+         if (apu->enabled & (1 << channel)) {
+            pulse->length = Lengths[value >> 3];
+         }
+         pulse->step           = 0;
+         pulse->envelope.start = 1;
+         break;
+   }
+}
+
+void apuWrite(nes_t *nes, uint16_t addr, uint8_t value) {
+   apu_t *apu = &nes->apu;
+   triangle_t *triangle = &apu->triangle;
+   noise_t *noise = &apu->noise;
+   dmc_t *dmc = &apu->dmc;
+
+   apuCatchUp(nes, busCycle(nes));
+
+   switch (addr) {
+      case 0x4000:
+      case 0x4001:
+      case 0x4002:
+      case 0x4003:
+      case 0x4004:
+      case 0x4005:
+      case 0x4006:
+      case 0x4007:
+         pulseWrite(apu, (addr >> 2) & 1, addr & 3, value);
+         break;
+      case 0x4008:
+         triangle->control = value;
+         break;
+      case 0x400A:
+         triangle->timerPeriod = (triangle->timerPeriod & 0x700) | value;
+         break;
+      case 0x400B:
+         triangle->timerPeriod = (triangle->timerPeriod & 0xFF) | (value & 0x07) << 8;
+         if (apu->enabled & 0x04) {
+            triangle->length = Lengths[value >> 3];
+         }
+         triangle->linearReload = 1;
+         break;
+      case 0x400C:
+         noise->control = value;
+         break;
+      case 0x400E:
+         noise->period = value;
+         break;
+      case 0x400F:
+         if (apu->enabled & 0x08) {
+            noise->length = Lengths[value >> 3];
+         }
+         noise->envelope.start = 1;
+         break;
+      case 0x4010:
+         dmc->control = value;
+         if (!(value & 0x80)) {
+            setIRQ(nes, IRQ_DMC, 0);
+         }
+         scheduleDMC(nes);
+         break;
+      case 0x4011:
+         dmc->level = value & 0x7F;
+         break;
+      case 0x4012:
+         dmc->sampleAddress = 0xC000 + value * 64;
+         break;
+      case 0x4013:
+         dmc->sampleLength = value * 16 + 1;
+         break;
+      // Clearing a channel's bit silences it, for the DMC bit 4 stops the
+      // sample or starts it over if it had finished
+      case 0x4015:
+         apu->enabled = value & 0x0F;
+         for (int channel = CHANNEL_PULSE1; channel <= CHANNEL_PULSE2; channel++) {
+            if (!(value & (1 << channel))) {
+               apu->pulse[channel].length = 0;
+            }
+         }
+         if (!(value & 0x04)) {
+            triangle->length = 0;
+         }
+         if (!(value & 0x08)) {
+            noise->length = 0;
+         }
+
+         setIRQ(nes, IRQ_DMC, 0);
+         if (!(value & 0x10)) {
+            dmc->bytesRemaining = 0;
+         } else if (!dmc->bytesRemaining) {
+            restartSample(dmc);
+            if (!dmc->bufferFull) {
+               dmcFetch(nes);
+            }
+         }
+         scheduleDMC(nes);
+         break;
+   }
+
+   // A write restarts the sequence, with bit 7 set it clocks everything
+   // the sequence does straight away
+   if (addr == 0x4017) {
+      apu->frameCounter  = value;
+      apu->sequenceStart = apu->cycle;
+      apu->sequenceStep  = 0;
+      apu->stepCycle     = apu->cycle + Steps[value >> 7][0].cycle;
+      if (value & 0x80) {
+         clockFrame(apu, QUARTER_FRAME | HALF_FRAME);
+      }
+      if (value & 0x40) {
+         setIRQ(nes, IRQ_APU_FRAME, 0);
+      }
+      scheduleFrameIRQ(nes);
+   }
+   emit(nes, apu->cycle);
+}
+
+void apuFrameEvent(nes_t *nes) {
+   apuCatchUp(nes, nes->masterCycles);
+   scheduleFrameIRQ(nes);
+}
+
+void dmcEvent(nes_t *nes) {
+   dmc_t *dmc = &nes->apu.dmc;
+
+   apuCatchUp(nes, nes->masterCycles);
+   if (!dmc->bufferFull && dmc->bytesRemaining) {
+      dmcFetch(nes);
+   }
+   scheduleDMC(nes);
+}
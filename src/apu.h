@@ -0,0 +1,144 @@
+#ifndef APU_H
+#define APU_H
+
+#include <inttypes.h>
+
+#include "blip.h"
+
+// Console state, see nes.h
+typedef struct nes_s nes_t;
+
+// 4-step frame sequence, the IRQ comes at its end, in CPU cycles
+#define APU_FRAME_CYCLES 29830
+
+// NTSC CPU clock, what the APU's cycles are resampled from
+#define APU_CLOCK_RATE (39375000.0 / 22)
+
+// Output rate until setSampleRate(), and the most samples a frame can make
+// at the highest rate it takes, 96 kHz
+#define APU_SAMPLE_RATE 48000
+#define APU_MAX_SAMPLES 1664
+
+// CPU cycles the DMC's sample reader steals for each byte
+#define DMC_DMA_CYCLES 4
+
+// Volume for the pulse and noise channels, $4000 bits 0-5 say whether it's
+// the envelope's or a constant one
+typedef struct {
+   uint8_t start;   // restart at the next quarter frame
+   uint8_t divider;
+   uint8_t decay;   // 15 down to 0
+} envelope_t;
+
+typedef struct {
+   uint8_t    control;     // $4000/$4004: duty, halt, constant volume, volume
+   uint8_t    sweep;       // $4001/$4005
+   uint16_t   timerPeriod; // 11 bits from $4002/$4003
+   uint8_t    length;
+   uint8_t    step;        // position in the 8 step duty cycle
+   uint8_t    sweepDivider;
+   uint8_t    sweepReload;
+   envelope_t envelope;
+   uint64_t   nextClock;   // cycle the duty cycle next steps
+} pulse_t;
+
+typedef struct {
+   uint8_t  control;     // $4008: halt and linear counter reload
+   uint16_t timerPeriod;
+   uint8_t  length;
+   uint8_t  linear;
+   uint8_t  linearReload;
+   uint8_t  step;        // position in the 32 step triangle
+   uint64_t nextClock;
+} triangle_t;
+
+typedef struct {
+   uint8_t    control;   // $400C: halt, constant volume, volume
+   uint8_t    period;    // $400E: mode and period
+   uint8_t    length;
+   uint16_t   shift;     // 15-bit feedback shift register, 1 at power on
+   envelope_t envelope;
+   uint64_t   nextClock;
+} noise_t;
+
+// The delta modulation channel. Its output unit plays a byte a bit at a
+// time and takes the buffered byte as each 8 start, the sample reader then
+// fetches the next one from the CPU bus.
+typedef struct {
+   uint8_t  control;        // $4010: IRQ enable, loop, rate
+   uint8_t  level;          // 7-bit output, $4011
+   uint16_t sampleAddress;  // from $4012
+   uint16_t sampleLength;   // from $4013
+   uint16_t address;        // next byte the reader fetches
+   uint16_t bytesRemaining;
+   uint8_t  buffer;
+   uint8_t  bufferFull;
+   uint8_t  shift;          // the byte the output unit is playing
+   uint8_t  bitsRemaining;  // of the byte being played, 1-8
+   uint8_t  silence;        // the buffer was empty when this byte started
+   uint64_t nextBit;        // cycle the output unit plays its next bit
+} dmc_t;
+
+// First-order filter sections run over a block of samples
+typedef struct {
+   float coefficient;
+   float lastIn;
+   float lastOut;
+} filter_t;
+
+// Caught up to the CPU like the PPU: on a read or write of $4000-$4017,
+// and on its own scheduled events. The channels run from one amplitude
+// change to the next and put each into blip as the mixer's output moving,
+// stamped with the cycle, and each frame's end turns that into a block of
+// samples at the output rate.
+typedef struct {
+   uint64_t cycle;         // CPU cycles run
+   uint64_t sequenceStart; // cycle of the last $4017 write
+   uint8_t  frameCounter;  // last $4017 write
+   uint8_t  sequenceStep;  // frame sequence step due next
+   uint64_t stepCycle;     // when it's due
+
+   uint8_t    enabled;     // $4015 bits 0-3
+   pulse_t    pulse[2];
+   triangle_t triangle;
+   noise_t    noise;
+   dmc_t      dmc;
+
+   int        mix;         // mixer output as blip last saw it
+   uint64_t   frameStart;  // cycle blip's frame started on
+   double     sampleRate;
+   blip_t     blip;
+   filter_t   highPass[2]; // 90 Hz and 440 Hz, like the console's output
+   filter_t   lowPass;     // 14 kHz
+
+   // The last frame's audio, signed 16-bit mono at sampleRate
+   int16_t    samples[APU_MAX_SAMPLES];
+   int        sampleCount;
+} apu_t;
+
+// Power on state, as if $4017 had been written 0 at cycle 0
+void initAPU(nes_t *nes);
+
+// Output rate from the next frame on, 8-96 kHz
+void setSampleRate(nes_t *nes, double rate);
+
+// Runs the APU up to cycle, nothing when it's already there
+void apuCatchUp(nes_t *nes, uint64_t cycle);
+
+// Catches up to the CPU and turns the frame's amplitude changes into
+// samples, filtered, in apu.samples
+void apuEndFrame(nes_t *nes);
+
+// $4000-$4017 without the controller ports
+uint8_t apuRead(nes_t *nes, uint16_t addr);
+
+void apuWrite(nes_t *nes, uint16_t addr, uint8_t value);
+
+// EVENT_APU_FRAME: catches up so the frame IRQ is raised on time
+void apuFrameEvent(nes_t *nes);
+
+// EVENT_DMC: the output unit took the buffered sample byte, the reader
+// fetches the next
+void dmcEvent(nes_t *nes);
+
+#endif
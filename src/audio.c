@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <new>
+
+#include "audio.h"
+#include "nes.h"
+
+// Each side's counter on its own cache line, so a push doesn't make the
+// callback's next pull miss and the other way round
+struct audioRing_s {
+   int16_t *samples;
+   int      capacity;
+
+   alignas(CACHE_LINE) std::atomic<uint64_t> head; // samples pushed
+   std::atomic<uint64_t> overruns;
+
+   alignas(CACHE_LINE) std::atomic<uint64_t> tail; // samples pulled
+   std::atomic<uint64_t> underruns;
+   int16_t  last;
+};
+
+audioRing_t *createAudioRing(int rate, int ms) {
+   audioRing_t *ring = new (alignedAlloc(sizeof(audioRing_t))) audioRing_t();
+
+   ring->capacity = (int)((int64_t)rate * ms / 1000);
+   if (ring->capacity < AUDIO_RING_MIN) {
+      ring->capacity = AUDIO_RING_MIN;
+   }
+   if (!(ring->samples = (int16_t *)calloc(ring->capacity, sizeof(int16_t)))) {
+      fprintf(stderr, "Could not allocate memory\n");
+      exit(1);
+   }
+
+   ring->head.store(0);
+   ring->tail.store(0);
+   ring->overruns.store(0);
+   ring->underruns.store(0);
+   ring->last = 0;
+   return ring;
+}
+
+void destroyAudioRing(audioRing_t *ring) {
+   if (!ring) {
+      return;
+   }
+   free(ring->samples);
+   ring->~audioRing_t();
+   free(ring);
+}
+
+// Copies count samples between a flat buffer and the ring from position
+// pos, in two pieces when it wraps
+static void copyIn(audioRing_t *ring, uint64_t pos, const int16_t *from, int count) {
+   int start = (int)(pos % ring->capacity);
+   int first = count < ring->capacity - start ? count : ring->capacity - start;
+
+   memcpy(ring->samples + start, from, first * sizeof(int16_t));
+   memcpy(ring->samples, from + first, (count - first) * sizeof(int16_t));
+}
+
+static void copyOut(audioRing_t *ring, uint64_t pos, int16_t *to, int count) {
+   int start = (int)(pos % ring->capacity);
+   int first = count < ring->capacity - start ? count : ring->capacity - start;
+
+   memcpy(to, ring->samples + start, first * sizeof(int16_t));
+   memcpy(to + first, ring->samples, (count - first) * sizeof(int16_t));
+}
+
+int pushAudio(audioRing_t *ring, const int16_t *samples, int count) {
+   uint64_t head = ring->head.load(std::memory_order_relaxed);
+   int space = ring->capacity - (int)(head - ring->tail.load(std::memory_order_acquire));
+
+   if (count > space) {
+      count = space;
+      ring->overruns.store(ring->overruns.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+   }
+   copyIn(ring, head, samples, count);
+   ring->head.store(head + count, std::memory_order_release);
+   return count;
+}
+
+void pullAudio(audioRing_t *ring, int16_t *out, int count) {
+   uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+   int queued = (int)(ring->head.load(std::memory_order_acquire) - tail);
+   int pulled = count < queued ? count : queued;
+
+   copyOut(ring, tail, out, pulled);
+   ring->tail.store(tail + pulled, std::memory_order_release);
+
+   if (pulled) {
+      ring->last = out[pulled - 1];
+   }
+   if (pulled < count) {
+      ring->underruns.store(ring->underruns.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+      for (int i = pulled; i < count; i++) {
+         out[i] = ring->last;
+      }
+   }
+}
+
+int audioQueued(audioRing_t *ring) {
+   uint64_t tail = ring->tail.load(std::memory_order_acquire);
+
+   return (int)(ring->head.load(std::memory_order_acquire) - tail);
+}
+
+int audioCapacity(audioRing_t *ring) {
+   return ring->capacity;
+}
+
+uint64_t audioUnderruns(audioRing_t *ring) {
+   return ring->underruns.load(std::memory_order_relaxed);
+}
+
+uint64_t audioOverruns(audioRing_t *ring) {
+   return ring->overruns.load(std::memory_order_relaxed);
+}
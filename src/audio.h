@@ -0,0 +1,39 @@
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#include <inttypes.h>
+
+// Samples on their way from the emulation thread to the audio device,
+// private to audio.c. One thread pushes and one pulls, neither locks or
+// waits for the other.
+typedef struct audioRing_s audioRing_t;
+
+// Shortest ring createAudioRing() makes, in samples
+#define AUDIO_RING_MIN 64
+
+// A ring holding ms milliseconds of audio at rate samples a second. Exits
+// if it can't be allocated.
+audioRing_t *createAudioRing(int rate, int ms);
+
+void destroyAudioRing(audioRing_t *ring);
+
+// Producer side: queues count samples and returns how many fit, the rest
+// are dropped and counted as an overrun
+int pushAudio(audioRing_t *ring, const int16_t *samples, int count);
+
+// Consumer side: fills out with count samples. Safe in an audio callback,
+// it doesn't allocate, lock or wait. Coming up short is an underrun, the
+// rest is the last sample held so the gap doesn't click.
+void pullAudio(audioRing_t *ring, int16_t *out, int count);
+
+// Samples queued, from either side
+int audioQueued(audioRing_t *ring);
+
+int audioCapacity(audioRing_t *ring);
+
+// Times pullAudio() came up short and pushAudio() dropped samples, from
+// any thread
+uint64_t audioUnderruns(audioRing_t *ring);
+uint64_t audioOverruns(audioRing_t *ring);
+
+#endif
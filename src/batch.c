@@ -0,0 +1,309 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cpu.h"
+#include "file.h"
+#include "hash.h"
+#include "memory.h"
+#include "movie.h"
+#include "nes.h"
+
+// Headless batch runner. Every job in the manifest gets its own console,
+// jobs are spread over a work-stealing pool of threads, and each one ends
+// with a results record. The whole manifest runs once per thread count from
+// 1 up to the pool size, for the scaling report.
+//
+// A manifest line is 'rom.nes frames [movie.fm2]', # starts a comment.
+
+#define MAX_LINE 1024
+
+typedef struct {
+   std::string fileName;
+   void *data;
+   int size;
+} rom_t;
+
+typedef struct {
+   int rom;
+   int frames;
+   movie_t movie;
+} job_t;
+
+typedef struct {
+   uint64_t cycles;
+   uint64_t instructions;
+   uint64_t ramHash;   // RAM and SRAM after the last frame
+   uint64_t frameHash; // every frame's hash, chained
+   std::vector<uint64_t> frameHashes;
+   int halted;
+} result_t;
+
+// A worker takes from the back of its own queue, and from the front of the
+// others' when it runs dry
+typedef struct {
+   std::mutex lock;
+   std::deque<int> jobs;
+} queue_t;
+
+static std::vector<rom_t> Roms;
+static std::vector<job_t> Jobs;
+
+static void runJob(const job_t *job, result_t *result) {
+   const rom_t *rom = &Roms[job->rom];
+   nes_t *nes = createNES(rom->data, rom->size);
+
+   result->frameHash = FNV_OFFSET;
+   result->frameHashes.clear();
+
+   for (int frame = 0; frame < job->frames && !cpuHalted(nes); frame++) {
+      setButtons(nes, 0, movieButtons(&job->movie, 0, frame));
+      setButtons(nes, 1, movieButtons(&job->movie, 1, frame));
+      runFrame(nes);
+
+      uint64_t hash = hashFrame(nes);
+
+      result->frameHashes.push_back(hash);
+      result->frameHash = hashBytes(result->frameHash, &hash, sizeof(hash));
+   }
+
+   result->cycles       = cpuCycles(nes);
+   result->instructions = cpuInstructions(nes);
+   result->ramHash      = hashMemory(nes);
+   result->halted       = cpuHalted(nes);
+   destroyNES(nes);
+}
+
+static int takeJob(std::vector<queue_t> &queues, int self, uint64_t *steals) {
+   int job = -1;
+   int numQueues = queues.size();
+
+   {
+      std::lock_guard<std::mutex> guard(queues[self].lock);
+
+      if (!queues[self].jobs.empty()) {
+         job = queues[self].jobs.back();
+         queues[self].jobs.pop_back();
+         return job;
+      }
+   }
+
+   // Nothing is ever added once the pool starts, so one pass over the other
+   // queues finding nothing means the work is done
+   for (int i = 1; i < numQueues; i++) {
+      queue_t *victim = &queues[(self + i) % numQueues];
+      std::lock_guard<std::mutex> guard(victim->lock);
+
+      if (!victim->jobs.empty()) {
+         job = victim->jobs.front();
+         victim->jobs.pop_front();
+         (*steals)++;
+         return job;
+      }
+   }
+   return -1;
+}
+
+static void worker(std::vector<queue_t> *queues, int self, std::vector<result_t> *results, uint64_t *steals) {
+   int job;
+
+   while ((job = takeJob(*queues, self, steals)) >= 0) {
+      runJob(&Jobs[job], &(*results)[job]);
+   }
+}
+
+// Runs every job on numThreads threads, returns the wall clock seconds
+static double runPool(int numThreads, std::vector<result_t> *results, uint64_t *steals) {
+   std::vector<queue_t> queues(numThreads);
+   std::vector<uint64_t> threadSteals(numThreads, 0);
+   std::vector<std::thread> threads;
+   int numJobs = Jobs.size();
+
+   // Contiguous runs of the manifest, so neighbouring jobs start on the
+   // same thread
+   for (int i = 0; i < numJobs; i++) {
+      queues[(int)((int64_t)i * numThreads / numJobs)].jobs.push_front(i);
+   }
+
+   auto start = std::chrono::steady_clock::now();
+
+   for (int i = 0; i < numThreads; i++) {
+      threads.push_back(std::thread(worker, &queues, i, results, &threadSteals[i]));
+   }
+   for (int i = 0; i < numThreads; i++) {
+      threads[i].join();
+   }
+
+   std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+   *steals = 0;
+   for (int i = 0; i < numThreads; i++) {
+      *steals += threadSteals[i];
+   }
+   return elapsed.count();
+}
+
+static int loadManifest(const char *fileName) {
+   FILE *fp = NULL;
+   char line[MAX_LINE];
+   int lineNumber = 0;
+
+   if (!(fp = fopen(fileName, "r"))) {
+      fprintf(stderr, "Could not load file %s\n", fileName);
+      return 0;
+   }
+
+   while (fgets(line, sizeof(line), fp)) {
+      char romName[MAX_LINE], movieName[MAX_LINE];
+      job_t job;
+      int fields;
+
+      lineNumber++;
+      if ((fields = sscanf(line, "%s %d %s", romName, &job.frames, movieName)) < 1 || romName[0] == '#') {
+         continue;
+      }
+      if (fields < 2 || job.frames < 0) {
+         fprintf(stderr, "%s:%d: expected 'rom.nes frames [movie.fm2]'\n", fileName, lineNumber);
+         fclose(fp);
+         return 0;
+      }
+
+      // Jobs share one copy of each ROM, createNES() copies what it needs
+      for (job.rom = 0; job.rom < (int)Roms.size() && Roms[job.rom].fileName != romName; job.rom++);
+      if (job.rom == (int)Roms.size()) {
+         rom_t rom = {romName, NULL, 0};
+
+         loadFile(romName, &rom.data, &rom.size);
+         Roms.push_back(rom);
+      }
+
+      job.movie.buttons = NULL;
+      job.movie.frames  = 0;
+      if (fields > 2 && movieName[0] != '#' && !loadMovie(movieName, &job.movie)) {
+         fclose(fp);
+         return 0;
+      }
+
+      Jobs.push_back(job);
+   }
+
+   fclose(fp);
+   return 1;
+}
+
+static void printResults(const std::vector<result_t> &results, int showFrames) {
+   for (size_t i = 0; i < results.size(); i++) {
+      const result_t *r = &results[i];
+
+      printf("job %zu %s frames %zu cycles %" PRIu64 " instructions %" PRIu64 " ram %016" PRIx64 " frames %016" PRIx64 "%s\n",
+         i, Roms[Jobs[i].rom].fileName.c_str(), r->frameHashes.size(), r->cycles, r->instructions,
+         r->ramHash, r->frameHash, r->halted ? " halted" : "");
+
+      if (showFrames) {
+         for (size_t frame = 0; frame < r->frameHashes.size(); frame++) {
+            printf("   frame %zu %016" PRIx64 "\n", frame, r->frameHashes[frame]);
+         }
+      }
+   }
+}
+
+static int sameResults(const result_t *a, const result_t *b) {
+   return a->cycles == b->cycles && a->instructions == b->instructions &&
+      a->ramHash == b->ramHash && a->frameHash == b->frameHash && a->halted == b->halted;
+}
+
+int main(int argc, char *argv[]) {
+   int maxThreads = std::thread::hardware_concurrency();
+   int showFrames = 0;
+   const char *manifest = NULL;
+
+   for (int i = 1; i < argc; i++) {
+      if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+         maxThreads = atoi(argv[++i]);
+      } else if (!strcmp(argv[i], "-f")) {
+         showFrames = 1;
+      } else if (!manifest && argv[i][0] != '-') {
+         manifest = argv[i];
+      } else {
+         manifest = NULL;
+         break;
+      }
+   }
+
+   if (!manifest) {
+      fprintf(stderr, "Usage: %s [-t threads] [-f] manifest\n", argv[0]);
+      fprintf(stderr, "  manifest lines are 'rom.nes frames [movie.fm2]'\n");
+      fprintf(stderr, "  -f prints every frame's hash in the results\n");
+      return 1;
+   }
+   if (maxThreads < 1) {
+      maxThreads = 1;
+   }
+
+   if (!loadManifest(manifest)) {
+      return 1;
+   }
+   if (Jobs.empty()) {
+      fprintf(stderr, "No jobs in %s\n", manifest);
+      return 1;
+   }
+
+   std::vector<result_t> reference(Jobs.size());
+   int mismatched = 0;
+
+   printf("%-8s %-10s %-12s %-16s %-8s %s\n", "threads", "seconds", "frames/s", "instructions/s", "speedup", "steals");
+
+   double serial = 0;
+
+   for (int threads = 1; ; threads = threads * 2 < maxThreads ? threads * 2 : maxThreads) {
+      std::vector<result_t> results(Jobs.size());
+      uint64_t steals = 0;
+      uint64_t frames = 0, instructions = 0;
+      double seconds = runPool(threads, &results, &steals);
+
+      for (size_t i = 0; i < results.size(); i++) {
+         frames       += results[i].frameHashes.size();
+         instructions += results[i].instructions;
+      }
+
+      if (threads == 1) {
+         serial = seconds;
+         reference = results;
+      } else {
+         // Every console is independent, the thread count must not change
+         // a single result
+         for (size_t i = 0; i < results.size(); i++) {
+            if (!sameResults(&reference[i], &results[i])) {
+               fprintf(stderr, "Job %zu differs on %d threads\n", i, threads);
+               mismatched++;
+            }
+         }
+      }
+
+      printf("%-8d %-10.3f %-12.0f %-16.0f %-8.2f %" PRIu64 "\n",
+         threads, seconds, frames / seconds, instructions / seconds, serial / seconds, steals);
+
+      if (threads == maxThreads) {
+         break;
+      }
+   }
+
+   printf("\n");
+   printResults(reference, showFrames);
+
+   for (size_t i = 0; i < Jobs.size(); i++) {
+      freeMovie(&Jobs[i].movie);
+   }
+   for (size_t i = 0; i < Roms.size(); i++) {
+      free(Roms[i].data);
+   }
+
+   return mismatched ? 1 : 0;
+}
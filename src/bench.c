@@ -0,0 +1,501 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "cpu.h"
+#include "file.h"
+#include "memory.h"
+#include "nes.h"
+#include "video.h"
+
+// nestest runs ~9200 instructions from $C000 before hitting a KIL, so every
+// pass restarts the ROM and stays well short of that
+#define BENCH_INSTRUCTIONS 8000
+#define BENCH_PASSES 500
+
+// The loop ROMs never end, so they get fewer, longer passes
+#define LOOP_INSTRUCTIONS 400000
+#define LOOP_PASSES 10
+
+// Per opcode: copies of the instruction in a row, instructions timed, and
+// how many times, keeping the fastest
+#define OPCODE_COPIES 64
+#define OPCODE_INSTRUCTIONS 50000
+#define OPCODE_PASSES 3
+
+// Run before timing, so JIT blocks are compiled and the decode cache filled
+#define WARMUP_INSTRUCTIONS 1000
+
+// Frames each converter turns into host pixels
+#define VIDEO_FRAMES 2000
+
+#define INES_HEADER_SIZE 16
+#define PRG_BANK_SIZE 0x4000
+#define PRG_BASE 0xC000
+#define RESET_VECTOR 0xFFFC
+#define IRQ_VECTOR 0xFFFE
+
+// Operands for the synthetic opcode loops. Everything they can reach with
+// X and Y added is RAM, ROM or a register that ignores the access.
+#define TEST_ZP       0x10
+#define TEST_ABS      0x0200
+#define TEST_POINTER  0x80
+#define JUMP_POINTER  0x0300
+
+// Runs from $C000 forever: a loop over a page of RAM calling a short shift
+// loop each time round, the kind of code that runs far more than once and
+// that nestest has very little of
+static const uint8_t LoopCode[] = {
+   0xA2, 0x00,       // $C000 LDX #$00
+   0xBD, 0x00, 0x03, // $C002 LDA $0300,X
+   0x69, 0x03,       // $C005 ADC #$03
+   0x9D, 0x00, 0x03, // $C007 STA $0300,X
+   0x45, 0x10,       // $C00A EOR $10
+   0x85, 0x10,       // $C00C STA $10
+   0x20, 0x1A, 0xC0, // $C00E JSR $C01A
+   0xE8,             // $C011 INX
+   0xD0, 0xEE,       // $C012 BNE $C002
+   0xE6, 0x11,       // $C014 INC $11
+   0x4C, 0x02, 0xC0, // $C016 JMP $C002
+   0xEA,             // $C019 NOP
+   0xA0, 0x04,       // $C01A LDY #$04
+   0x06, 0x12,       // $C01C ASL $12
+   0x26, 0x13,       // $C01E ROL $13
+   0x88,             // $C020 DEY
+   0xD0, 0xF9,       // $C021 BNE $C01C
+   0x60              // $C023 RTS
+};
+
+// Copies a page with abs,X and another with (zp),Y, over and over
+static const uint8_t MemcpyCode[] = {
+   0xA9, 0x00,       // $C000 LDA #$00
+   0x85, 0x80,       // $C002 STA $80
+   0xA9, 0x04,       // $C004 LDA #$04
+   0x85, 0x81,       // $C006 STA $81
+   0xA9, 0x00,       // $C008 LDA #$00
+   0x85, 0x82,       // $C00A STA $82
+   0xA9, 0x05,       // $C00C LDA #$05
+   0x85, 0x83,       // $C00E STA $83
+   0xA2, 0x00,       // $C010 LDX #$00
+   0xBD, 0x00, 0x02, // $C012 LDA $0200,X
+   0x9D, 0x00, 0x03, // $C015 STA $0300,X
+   0xE8,             // $C018 INX
+   0xD0, 0xF7,       // $C019 BNE $C012
+   0xA0, 0x00,       // $C01B LDY #$00
+   0xB1, 0x80,       // $C01D LDA ($80),Y
+   0x91, 0x82,       // $C01F STA ($82),Y
+   0xC8,             // $C021 INY
+   0xD0, 0xF9,       // $C022 BNE $C01D
+   0x4C, 0x10, 0xC0  // $C024 JMP $C010
+};
+
+// Steps an 8 bit LFSR and branches on its bits, so the host can't predict
+// where the 6502 goes next
+static const uint8_t BranchCode[] = {
+   0xA9, 0x01,       // $C000 LDA #$01
+   0x85, 0x10,       // $C002 STA $10
+   0xA5, 0x10,       // $C004 LDA $10
+   0x0A,             // $C006 ASL A
+   0x90, 0x02,       // $C007 BCC $C00B
+   0x49, 0x1D,       // $C009 EOR #$1D
+   0x85, 0x10,       // $C00B STA $10
+   0x29, 0x04,       // $C00D AND #$04
+   0xF0, 0x02,       // $C00F BEQ $C013
+   0xE6, 0x11,       // $C011 INC $11
+   0xCA,             // $C013 DEX
+   0xD0, 0xEE,       // $C014 BNE $C004
+   0xE6, 0x12,       // $C016 INC $12
+   0x4C, 0x04, 0xC0  // $C018 JMP $C004
+};
+
+// Waits for vblank on $2002 and reads $4015 each frame, so nearly every
+// other instruction makes the PPU catch up
+static const uint8_t VblankCode[] = {
+   0x2C, 0x02, 0x20, // $C000 BIT $2002
+   0x10, 0xFB,       // $C003 BPL $C000
+   0xE6, 0x10,       // $C005 INC $10
+   0xAD, 0x15, 0x40, // $C007 LDA $4015
+   0x4C, 0x00, 0xC0  // $C00A JMP $C000
+};
+
+static const char *ModeNames[] = {
+   "impl", "imm", "zp", "zpx", "abs", "absx", "absy", "indx", "indy", "zpy"
+};
+
+enum { FORMAT_TEXT, FORMAT_CSV, FORMAT_JSON };
+
+// Where -csv/-json results go, and what they're tagged with
+static int Format = FORMAT_TEXT;
+static FILE *Output = NULL;
+static const char *Commit = "unknown";
+
+typedef struct {
+   uint8_t bytes[PRG_BANK_SIZE];
+   int size;
+} code_t;
+
+typedef struct {
+   int opcode;
+   double nsPerInstruction;
+} opcodeResult_t;
+
+double now() {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint16_t here(const code_t *code) {
+   return PRG_BASE + code->size;
+}
+
+static void emit(code_t *code, uint8_t byte) {
+   code->bytes[code->size++] = byte;
+}
+
+static void emit16(code_t *code, uint8_t opcode, uint16_t operand) {
+   emit(code, opcode);
+   emit(code, operand & 0xFF);
+   emit(code, operand >> 8);
+}
+
+// One bank NROM image with code at $C000, reset going there and BRK to irq
+void *makeRom(const uint8_t *code, int size, uint16_t irq, int *fileSize) {
+   *fileSize = INES_HEADER_SIZE + PRG_BANK_SIZE;
+
+   uint8_t *rom = (uint8_t *)calloc(1, *fileSize);
+   if (!rom) {
+      fprintf(stderr, "Could not allocate memory\n");
+      exit(1);
+   }
+
+   memcpy(rom, "NES\x1A", 4);
+   rom[4] = 1;
+   memcpy(rom + INES_HEADER_SIZE, code, size);
+   rom[INES_HEADER_SIZE + (RESET_VECTOR - PRG_BASE)]     = PRG_BASE & 0xFF;
+   rom[INES_HEADER_SIZE + (RESET_VECTOR - PRG_BASE) + 1] = PRG_BASE >> 8;
+   rom[INES_HEADER_SIZE + (IRQ_VECTOR - PRG_BASE)]     = irq & 0xFF;
+   rom[INES_HEADER_SIZE + (IRQ_VECTOR - PRG_BASE) + 1] = irq >> 8;
+   return rom;
+}
+
+// OPCODE_COPIES of opcode and a JMP back to the first. JSR and BRK come
+// back through an RTS and RTI, so those two time a pair of instructions.
+// Returns 0 for opcodes with no loop: KIL, and RTS/RTI on their own.
+static int opcodeCode(uint8_t opcode, code_t *code, uint16_t *irq) {
+   const char *name = opcodeName(opcode);
+   int mode, cycles, extraCycles;
+
+   if (!strcmp(name, "KIL") || !strcmp(name, "RTS") || !strcmp(name, "RTI")) {
+      return 0;
+   }
+   opcodeInfo(opcode, &mode, &cycles, &extraCycles);
+
+   // JUMP_POINTER holds the first copy, for JMP ($0300)
+   code->size = 0;
+   uint16_t body = here(code) + 10;
+
+   emit(code, 0xA9); emit(code, body & 0xFF);  // LDA #<body
+   emit16(code, 0x8D, JUMP_POINTER);           // STA JUMP_POINTER
+   emit(code, 0xA9); emit(code, body >> 8);    // LDA #>body
+   emit16(code, 0x8D, JUMP_POINTER + 1);       // STA JUMP_POINTER+1
+
+   if (opcode == 0x6C) {
+      emit16(code, opcode, JUMP_POINTER);
+      *irq = body;
+      return 1;
+   }
+
+   int length = mode == MODE_IMPL ? (opcode == 0x20 || opcode == 0x4C ? 3 : 1) :
+      mode == MODE_ABS || mode == MODE_ABSX || mode == MODE_ABSY ? 3 : 2;
+   uint16_t sub = body + OPCODE_COPIES * (opcode == 0x00 ? 2 : length) + 3;
+
+   for (int i = 0; i < OPCODE_COPIES; i++) {
+      if (opcode == 0x20) {
+         emit16(code, opcode, sub);
+      } else if (opcode == 0x4C) {
+         emit16(code, opcode, here(code) + 3);
+      } else if (opcode == 0x00) {
+         emit(code, opcode);
+         emit(code, 0xEA); // skipped, RTI comes back after it
+      } else if ((opcode & 0x1F) == 0x10) {
+         emit(code, opcode);
+         emit(code, 0x00); // taken or not, the next copy
+      } else if (length == 1) {
+         emit(code, opcode);
+      } else if (length == 2) {
+         emit(code, opcode);
+         emit(code, mode == MODE_INDX || mode == MODE_INDY ? TEST_POINTER : mode == MODE_IMM ? 0x01 : TEST_ZP);
+      } else {
+         emit16(code, opcode, TEST_ABS);
+      }
+   }
+   emit16(code, 0x4C, body);
+
+   emit(code, 0x60); // RTS for JSR
+   *irq = here(code);
+   emit(code, 0x40); // RTI for BRK
+   return 1;
+}
+
+// Power on, then turn the APU frame IRQ off the way a game's reset code
+// would, so the loops that clear I time the opcode and not an IRQ handler
+static void powerOn(nes_t *nes, void *rom, int fileSize) {
+   powerOnNES(nes, rom, fileSize);
+   store(nes, 0x4017, 0x40);
+}
+
+// Fastest ns per instruction over OPCODE_PASSES
+static double timeOpcode(nes_t *nes, void *rom, int fileSize) {
+   double best = 0;
+
+   for (int pass = 0; pass < OPCODE_PASSES; pass++) {
+      powerOn(nes, rom, fileSize);
+      run(nes, WARMUP_INSTRUCTIONS);
+
+      uint64_t start = cpuInstructions(nes);
+      double started = now();
+
+      run(nes, OPCODE_INSTRUCTIONS);
+
+      double ns = (now() - started) * 1e9 / (cpuInstructions(nes) - start);
+      if (pass == 0 || ns < best) {
+         best = ns;
+      }
+   }
+   return best;
+}
+
+// The table's mode, except for what sits in its Impl and Imm columns
+// without being implied or immediate
+static const char *modeName(uint8_t opcode) {
+   int mode, cycles, extraCycles;
+
+   if ((opcode & 0x1F) == 0x10) {
+      return "rel";
+   }
+   if (opcode == 0x20 || opcode == 0x4C) {
+      return "abs";
+   }
+   if (opcode == 0x6C) {
+      return "ind";
+   }
+   opcodeInfo(opcode, &mode, &cycles, &extraCycles);
+   return ModeNames[mode];
+}
+
+// One -csv/-json record. For the video workload name is the converter and
+// instructions counts pixels.
+static void record(const char *workload, const char *hex, const char *name, const char *mode, uint64_t instructions, double seconds) {
+   if (Format == FORMAT_CSV) {
+      fprintf(Output, "%s,%s,%s,%s,%s,%s,%" PRIu64 ",%.6f,%.3f\n", Commit, dispatchName(), workload,
+         hex, name, mode, instructions, seconds, seconds * 1e9 / instructions);
+   } else if (Format == FORMAT_JSON) {
+      fprintf(Output, "{\"commit\": \"%s\", \"backend\": \"%s\", \"workload\": \"%s\", \"opcode\": \"%s\", "
+         "\"name\": \"%s\", \"mode\": \"%s\", \"instructions\": %" PRIu64 ", \"seconds\": %.6f, \"ns_per_instruction\": %.3f}\n",
+         Commit, dispatchName(), workload, hex, name, mode, instructions, seconds, seconds * 1e9 / instructions);
+   }
+}
+
+static void report(const char *workload, int opcode, uint64_t instructions, double seconds) {
+   const char *name = opcode >= 0 ? opcodeName(opcode) : "";
+   const char *mode = opcode >= 0 ? modeName(opcode) : "";
+   char hex[4] = "";
+
+   if (opcode >= 0) {
+      snprintf(hex, sizeof(hex), "%02X", opcode);
+   }
+
+   if (Format != FORMAT_TEXT) {
+      record(workload, hex, name, mode, instructions, seconds);
+   } else if (opcode < 0) {
+      printf("%-13s %-7s %" PRIu64 " instructions in %.3fs, %.0f instructions/s\n",
+         dispatchName(), workload, instructions, seconds, instructions / seconds);
+   }
+}
+
+static void benchmarkOpcodes() {
+   std::vector<opcodeResult_t> results;
+   nes_t *nes = NULL;
+
+   for (int opcode = 0; opcode < 256; opcode++) {
+      code_t code;
+      uint16_t irq;
+      int fileSize;
+
+      if (!opcodeCode(opcode, &code, &irq)) {
+         continue;
+      }
+
+      void *rom = makeRom(code.bytes, code.size, irq, &fileSize);
+      if (!nes) {
+         nes = createNES(rom, fileSize);
+      }
+
+      opcodeResult_t result = {opcode, timeOpcode(nes, rom, fileSize)};
+      results.push_back(result);
+      report("opcode", opcode, OPCODE_INSTRUCTIONS, result.nsPerInstruction * OPCODE_INSTRUCTIONS / 1e9);
+      free(rom);
+   }
+   destroyNES(nes);
+
+   if (Format != FORMAT_TEXT) {
+      return;
+   }
+
+   std::sort(results.begin(), results.end(), [](const opcodeResult_t &a, const opcodeResult_t &b) {
+      return a.nsPerInstruction < b.nsPerInstruction;
+   });
+
+   const opcodeResult_t *median = &results[results.size() / 2], *slowest = &results.back();
+
+   printf("%-13s %-7s %zu opcodes, median %.1fns, fastest %s %.1fns, slowest %s %s %.1fns\n",
+      dispatchName(), "opcode", results.size(), median->nsPerInstruction,
+      opcodeName(results[0].opcode), results[0].nsPerInstruction,
+      opcodeName(slowest->opcode), modeName(slowest->opcode), slowest->nsPerInstruction);
+}
+
+// Time to turn a frame of palette indices into host pixels with each
+// converter the host supports, on a frame using every colour, emphasis and
+// greyscale. Exits if a converter's pixels differ from the scalar one's.
+static void benchmarkVideo(void *rom, int fileSize) {
+   nes_t *nes = createNES(rom, fileSize);
+   videoPalette_t palette;
+   std::vector<uint32_t> expected(PPU_WIDTH * PPU_HEIGHT), pixels(PPU_WIDTH * PPU_HEIGHT);
+
+   buildPalette(&palette, PIXEL_ARGB8888);
+   srand(1);
+   for (int line = 0; line < PPU_HEIGHT; line++) {
+      for (int x = 0; x < PPU_WIDTH; x++) {
+         nes->ppu.framebuffer[line][x] = rand() & 0x3F;
+      }
+      nes->ppu.lineMask[line] = (line & 0x0F) << 4;
+   }
+   convertFrame(nes, &palette, &expected[0], PPU_WIDTH * 4, CONVERT_SCALAR);
+
+   for (int converter = 0; converter < NUM_CONVERTERS; converter++) {
+      if (!converterSupported(converter)) {
+         continue;
+      }
+
+      double start = now();
+
+      for (int frame = 0; frame < VIDEO_FRAMES; frame++) {
+         convertFrame(nes, &palette, &pixels[0], PPU_WIDTH * 4, converter);
+      }
+
+      double elapsed = now() - start;
+
+      if (pixels != expected) {
+         fprintf(stderr, "%s converter differs from scalar\n", converterName(converter));
+         exit(1);
+      }
+
+      if (Format != FORMAT_TEXT) {
+         record("video", "", converterName(converter), "", (uint64_t)VIDEO_FRAMES * PPU_WIDTH * PPU_HEIGHT, elapsed);
+      } else {
+         printf("%-13s %-7s %-6s %d frames in %.3fs, %.1fus/frame\n",
+            dispatchName(), "video", converterName(converter), VIDEO_FRAMES, elapsed, elapsed * 1e6 / VIDEO_FRAMES);
+      }
+   }
+   destroyNES(nes);
+}
+
+// Each pass starts at entry rather than the reset vector
+void benchmark(const char *name, void *rom, int fileSize, uint16_t entry, int passes, int count) {
+   nes_t *nes = createNES(rom, fileSize);
+   uint64_t instructions = 0;
+   double start = now();
+
+   for (int pass = 0; pass < passes; pass++) {
+      powerOn(nes, rom, fileSize);
+      setPC(nes, entry);
+
+      run(nes, count);
+      instructions += cpuInstructions(nes);
+   }
+
+   double elapsed = now() - start;
+
+   report(name, -1, instructions, elapsed);
+#ifdef DECODE_CACHE
+   if (Format == FORMAT_TEXT) {
+      printf("%-13s %-7s %llu hits, %llu misses\n", "", name,
+         (unsigned long long)nes->decode->hits, (unsigned long long)nes->decode->misses);
+   }
+#endif
+
+   destroyNES(nes);
+}
+
+static void benchmarkLoop(const char *name, const uint8_t *code, int size) {
+   int fileSize = 0;
+   void *rom = makeRom(code, size, PRG_BASE, &fileSize);
+
+   benchmark(name, rom, fileSize, PRG_BASE, LOOP_PASSES, LOOP_INSTRUCTIONS);
+   free(rom);
+}
+
+int main(int argc, char *argv[]) {
+   const char *romName = NULL, *outputName = NULL;
+   int passes = BENCH_PASSES;
+
+   for (int i = 1; i < argc; i++) {
+      if ((!strcmp(argv[i], "-csv") || !strcmp(argv[i], "-json")) && i + 1 < argc) {
+         Format = argv[i][1] == 'c' ? FORMAT_CSV : FORMAT_JSON;
+         outputName = argv[++i];
+      } else if (!strcmp(argv[i], "-commit") && i + 1 < argc) {
+         Commit = argv[++i];
+      } else if (!romName) {
+         romName = argv[i];
+      } else {
+         passes = atoi(argv[i]);
+      }
+   }
+
+   if (!romName) {
+      fprintf(stderr, "Usage: %s rom.nes [passes] [-csv file | -json file] [-commit hash]\n", argv[0]);
+      fprintf(stderr, "  -csv and -json append one record per result, so every backend can\n");
+      fprintf(stderr, "  add its results to the same file\n");
+      return 1;
+   }
+
+   if (outputName) {
+      if (!(Output = fopen(outputName, "a"))) {
+         fprintf(stderr, "Could not open %s\n", outputName);
+         return 1;
+      }
+      if (Format == FORMAT_CSV && ftell(Output) == 0) {
+         fprintf(Output, "commit,backend,workload,opcode,name,mode,instructions,seconds,ns_per_instruction\n");
+      }
+   }
+
+   void *rom = NULL;
+   int fileSize = 0;
+
+   loadFile(romName, &rom, &fileSize);
+   benchmark("nestest", rom, fileSize, NESTEST_AUTOMATION, passes, BENCH_INSTRUCTIONS);
+   benchmarkVideo(rom, fileSize);
+   free(rom);
+
+   benchmarkLoop("loop", LoopCode, sizeof(LoopCode));
+   benchmarkLoop("memcpy", MemcpyCode, sizeof(MemcpyCode));
+   benchmarkLoop("branch", BranchCode, sizeof(BranchCode));
+   benchmarkLoop("vblank", VblankCode, sizeof(VblankCode));
+   benchmarkOpcodes();
+#ifdef JIT
+   if (Format == FORMAT_TEXT) {
+      printf("The JIT is for hot loops (loop, memcpy, branch) and long runs. Cold code\n");
+      printf("(nestest) and I/O polling (vblank) stay in the interpreter at its speed\n");
+   }
+#endif
+
+   if (Output) {
+      fclose(Output);
+   }
+   return 0;
+}
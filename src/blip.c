@@ -0,0 +1,134 @@
+#include <math.h>
+#include <string.h>
+
+#include "blip.h"
+
+// Kernel taps are fixed point with this many fraction bits, each phase's
+// taps add up to exactly 1 so a step settles at the amplitude it was given
+#define KERNEL_BITS 14
+
+// The sinc is cut off this far up the output rate, under the Nyquist limit
+// so the transition band stays out of the audio
+#define CUTOFF 0.45
+
+#define FRACTION_BITS 32
+
+typedef struct {
+   int16_t taps[BLIP_PHASES][BLIP_TAPS];
+} kernel_t;
+
+static double windowedSinc(double x) {
+   double half = BLIP_TAPS / 2, sinc = 2 * CUTOFF;
+
+   if (fabs(x) >= half) {
+      return 0;
+   }
+   if (x != 0) {
+      sinc = sin(2 * M_PI * CUTOFF * x) / (M_PI * x);
+   }
+   // Blackman
+   return sinc * (0.42 + 0.5 * cos(M_PI * x / half) + 0.08 * cos(2 * M_PI * x / half));
+}
+
+// Area under the windowed sinc from a to b, Simpson's rule
+static double integrate(double a, double b) {
+   const int steps = 16;
+   double h = (b - a) / steps, sum = windowedSinc(a) + windowedSinc(b);
+
+   for (int i = 1; i < steps; i++) {
+      sum += windowedSinc(a + i * h) * (i & 1 ? 4 : 2);
+   }
+   return sum * h / 3;
+}
+
+// A step fraction of a sample past sample i moves output sample i + t by
+// the sinc's area over that sample's span, t counting from HALF - 1 before
+static kernel_t buildKernel(void) {
+   kernel_t kernel;
+
+   for (int phase = 0; phase < BLIP_PHASES; phase++) {
+      double fraction = (double)phase / BLIP_PHASES;
+      int sum = 0, largest = 0;
+
+      for (int t = 0; t < BLIP_TAPS; t++) {
+         double end = t - BLIP_TAPS / 2 + 1 - fraction;
+
+         kernel.taps[phase][t] = (int16_t)lround(integrate(end - 1, end) * (1 << KERNEL_BITS));
+         sum += kernel.taps[phase][t];
+         if (kernel.taps[phase][t] > kernel.taps[phase][largest]) {
+            largest = t;
+         }
+      }
+      // Rounding error goes on the biggest tap, where it's least noticed
+      kernel.taps[phase][largest] += (1 << KERNEL_BITS) - sum;
+   }
+   return kernel;
+}
+
+// Built once, the first console to need it builds it for every thread
+static const kernel_t &kernel(void) {
+   static const kernel_t Kernel = buildKernel();
+
+   return Kernel;
+}
+
+void initBlip(blip_t *blip, double clockRate, double sampleRate) {
+   kernel();
+
+   blip->offset     = 0;
+   blip->available  = 0;
+   blip->integrator = 0;
+   memset(blip->samples, 0, sizeof(blip->samples));
+   setBlipRates(blip, clockRate, sampleRate);
+}
+
+void setBlipRates(blip_t *blip, double clockRate, double sampleRate) {
+   blip->factor = (uint64_t)(sampleRate / clockRate * ((uint64_t)1 << FRACTION_BITS) + 0.5);
+}
+
+void blipAddDelta(blip_t *blip, uint32_t clock, int delta) {
+   uint64_t position = clock * blip->factor + blip->offset;
+   uint64_t sample   = blip->available + (position >> FRACTION_BITS);
+   const int16_t *taps = kernel().taps[(position >> (FRACTION_BITS - BLIP_PHASE_BITS)) & (BLIP_PHASES - 1)];
+
+   // Only a frame far longer than the buffer gets here, the change is lost
+   if (sample > BLIP_CAPACITY) {
+      return;
+   }
+   int32_t *out = blip->samples + sample;
+
+   for (int t = 0; t < BLIP_TAPS; t++) {
+      out[t] += delta * taps[t];
+   }
+}
+
+void blipEndFrame(blip_t *blip, uint32_t clocks) {
+   uint64_t position = clocks * blip->factor + blip->offset;
+
+   blip->available += position >> FRACTION_BITS;
+   blip->offset     = position & (((uint64_t)1 << FRACTION_BITS) - 1);
+   if (blip->available > BLIP_CAPACITY) {
+      blip->available = BLIP_CAPACITY;
+   }
+}
+
+int blipRead(blip_t *blip, int32_t *out, int count) {
+   int32_t sum = blip->integrator;
+
+   if (count > blip->available) {
+      count = blip->available;
+   }
+   for (int i = 0; i < count; i++) {
+      sum += blip->samples[i];
+      out[i] = sum >> KERNEL_BITS;
+   }
+   blip->integrator = sum;
+
+   // What's left, and the tails of the steps near the end, move to the front
+   int left = blip->available - count + BLIP_TAPS;
+
+   memmove(blip->samples, blip->samples + count, left * sizeof(int32_t));
+   memset(blip->samples + left, 0, count * sizeof(int32_t));
+   blip->available -= count;
+   return count;
+}
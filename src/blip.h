@@ -0,0 +1,44 @@
+#ifndef BLIP_H
+#define BLIP_H
+
+#include <inttypes.h>
+
+// Output samples one amplitude change is spread over, and how finely its
+// position between two samples is resolved
+#define BLIP_TAPS       16
+#define BLIP_PHASE_BITS 6
+#define BLIP_PHASES     (1 << BLIP_PHASE_BITS)
+
+// Most samples a blip_t holds before they're read
+#define BLIP_CAPACITY 2048
+
+// Band-limited step buffer. A channel's output changing is put in as the
+// difference, stamped with the clock it happened on, and adds a windowed
+// sinc step to the BLIP_TAPS output samples around that moment. Reading
+// sums the samples back up. Making samples costs one kernel per change plus
+// one add per sample, however many clocks go by between changes.
+typedef struct {
+   uint64_t factor;     // output samples per clock, 32.32 fixed point
+   uint64_t offset;     // where clock 0 of this frame falls after the first sample not yet finished, 32.32
+   int      available;  // samples finished by ended frames
+   int32_t  integrator; // running sum of the samples read
+   int32_t  samples[BLIP_CAPACITY + BLIP_TAPS]; // differences, from the oldest not yet read
+} blip_t;
+
+// Empty, converting clockRate clocks a second to sampleRate samples
+void initBlip(blip_t *blip, double clockRate, double sampleRate);
+
+// Changes the ratio from the next change on, keeping what's buffered
+void setBlipRates(blip_t *blip, double clockRate, double sampleRate);
+
+// Output steps by delta at clock, counted from the start of the frame
+void blipAddDelta(blip_t *blip, uint32_t clock, int delta);
+
+// Ends the frame clocks long, what came before it can be read and the
+// next frame's clocks count from there
+void blipEndFrame(blip_t *blip, uint32_t clocks);
+
+// Reads up to count finished samples into out, returns how many
+int blipRead(blip_t *blip, int32_t *out, int count);
+
+#endif
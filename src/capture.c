@@ -0,0 +1,295 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <new>
+#include <string>
+#include <thread>
+
+#include "capture.h"
+#include "drain.h"
+#include "nes.h"
+#include "triple.h"
+#include "video.h"
+
+#define CAPTURE_MASK (CAPTURE_SLOTS - 1)
+
+// NTSC frames a second, the CPU clock over 29780.5 cycles a frame
+#define FRAME_RATE_NUM 39375000
+#define FRAME_RATE_DEN 655171
+
+#define RAW_HEADER_SIZE 32
+#define WAV_HEADER_SIZE 44
+
+static const char *CaptureFormatNames[NUM_CAPTURE_FORMATS] = {"raw", "y4m"};
+
+typedef struct {
+   frame_t frame;
+   int     sampleCount;
+   int16_t samples[APU_MAX_SAMPLES];
+} slot_t;
+
+// Each side's counter on its own cache line, as in audio.c
+struct capture_s {
+   slot_t *slots;
+   int     format;
+   FILE   *video;
+   FILE   *audio;  // CAPTURE_Y4M only, the raw file holds both
+   std::thread writer;
+   std::atomic<bool> running;
+   drain_t drain;
+
+   // The writer's, for CAPTURE_Y4M
+   videoPalette_t palette;
+   int            converter;
+   uint32_t       pixels[PPU_HEIGHT][PPU_WIDTH];
+   uint8_t        planes[PPU_WIDTH * PPU_HEIGHT * 3 / 2];
+   uint64_t       samplesWritten;
+   int            failed;
+
+   alignas(CACHE_LINE) std::atomic<uint64_t> head; // slots filled
+   std::atomic<uint64_t> frames;
+   std::atomic<uint64_t> dropped;
+
+   alignas(CACHE_LINE) std::atomic<uint64_t> tail; // slots written
+};
+
+const char *captureFormatName(int format) {
+   return format >= 0 && format < NUM_CAPTURE_FORMATS ? CaptureFormatNames[format] : "?";
+}
+
+int findCaptureFormat(const char *name) {
+   for (int format = 0; format < NUM_CAPTURE_FORMATS; format++) {
+      if (!strcmp(name, CaptureFormatNames[format])) {
+         return format;
+      }
+   }
+   return -1;
+}
+
+static void putLE(uint8_t *p, uint32_t value, int bytes) {
+   for (int i = 0; i < bytes; i++) {
+      p[i] = (uint8_t)(value >> (8 * i));
+   }
+}
+
+static void writeBytes(capture_t *capture, FILE *fp, const void *bytes, size_t size) {
+   if (size && fwrite(bytes, size, 1, fp) != 1) {
+      capture->failed = 1;
+   }
+}
+
+static void writeRawHeader(capture_t *capture) {
+   uint8_t header[RAW_HEADER_SIZE];
+
+   memset(header, 0, sizeof(header));
+   memcpy(header, "DNESCAP", 7);
+   header[7] = 1;
+   putLE(header + 8,  PPU_WIDTH, 4);
+   putLE(header + 12, PPU_HEIGHT, 4);
+   putLE(header + 16, APU_SAMPLE_RATE, 4);
+   putLE(header + 20, FRAME_RATE_NUM, 4);
+   putLE(header + 24, FRAME_RATE_DEN, 4);
+   writeBytes(capture, capture->video, header, sizeof(header));
+}
+
+// Sizes are filled in when the capture ends, or left 0 if it never does
+static void writeWavHeader(capture_t *capture, uint32_t dataSize) {
+   uint8_t header[WAV_HEADER_SIZE];
+
+   memcpy(header, "RIFF", 4);
+   putLE(header + 4, dataSize + WAV_HEADER_SIZE - 8, 4);
+   memcpy(header + 8, "WAVEfmt ", 8);
+   putLE(header + 16, 16, 4);
+   putLE(header + 20, 1, 2);                   // PCM
+   putLE(header + 22, 1, 2);                   // mono
+   putLE(header + 24, APU_SAMPLE_RATE, 4);
+   putLE(header + 28, APU_SAMPLE_RATE * 2, 4); // bytes a second
+   putLE(header + 32, 2, 2);                   // bytes a sample
+   putLE(header + 34, 16, 2);
+   memcpy(header + 36, "data", 4);
+   putLE(header + 40, dataSize, 4);
+   writeBytes(capture, capture->audio, header, sizeof(header));
+}
+
+static uint8_t clampByte(int value) {
+   return value < 0 ? 0 : value > 255 ? 255 : (uint8_t)value;
+}
+
+// Full range BT.601, what C420jpeg means, in 16.16 fixed point. Chroma is
+// taken from the average of each 2x2 block.
+static void writeY4MFrame(capture_t *capture, const frame_t *frame) {
+   uint8_t *y  = capture->planes;
+   uint8_t *cb = y + PPU_WIDTH * PPU_HEIGHT;
+   uint8_t *cr = cb + PPU_WIDTH * PPU_HEIGHT / 4;
+
+   convertPixels(frame->framebuffer, frame->lineMask, &capture->palette, capture->pixels, PPU_WIDTH * 4, capture->converter);
+
+   for (int row = 0; row < PPU_HEIGHT; row++) {
+      for (int x = 0; x < PPU_WIDTH; x++) {
+         uint32_t c = capture->pixels[row][x];
+         int r = (c >> 16) & 0xFF, g = (c >> 8) & 0xFF, b = c & 0xFF;
+
+         y[row * PPU_WIDTH + x] = clampByte((19595 * r + 38470 * g + 7471 * b + 32768) >> 16);
+      }
+   }
+   for (int row = 0; row < PPU_HEIGHT; row += 2) {
+      for (int x = 0; x < PPU_WIDTH; x += 2) {
+         int r = 0, g = 0, b = 0;
+
+         for (int i = 0; i < 4; i++) {
+            uint32_t c = capture->pixels[row + (i >> 1)][x + (i & 1)];
+
+            r += (c >> 16) & 0xFF;
+            g += (c >> 8) & 0xFF;
+            b += c & 0xFF;
+         }
+         int chroma = (row / 2) * (PPU_WIDTH / 2) + x / 2;
+
+         cb[chroma] = clampByte(128 + ((-11059 * r - 21709 * g + 32768 * b + 131072) >> 18));
+         cr[chroma] = clampByte(128 + ((32768 * r - 27439 * g - 5329 * b + 131072) >> 18));
+      }
+   }
+   writeBytes(capture, capture->video, "FRAME\n", 6);
+   writeBytes(capture, capture->video, capture->planes, sizeof(capture->planes));
+}
+
+// Samples go out as the host stores them, every host this builds for is
+// little-endian like the formats
+static void writeSlot(capture_t *capture, const slot_t *slot) {
+   size_t audioSize = slot->sampleCount * sizeof(int16_t);
+
+   if (capture->format == CAPTURE_RAW) {
+      uint8_t header[12];
+
+      putLE(header, (uint32_t)slot->frame.number, 4);
+      putLE(header + 4, (uint32_t)(slot->frame.number >> 32), 4);
+      putLE(header + 8, slot->sampleCount, 4);
+      writeBytes(capture, capture->video, header, sizeof(header));
+      writeBytes(capture, capture->video, slot->frame.framebuffer, sizeof(slot->frame.framebuffer));
+      writeBytes(capture, capture->video, slot->frame.lineMask, sizeof(slot->frame.lineMask));
+      writeBytes(capture, capture->video, slot->samples, audioSize);
+   } else {
+      writeY4MFrame(capture, &slot->frame);
+      writeBytes(capture, capture->audio, slot->samples, audioSize);
+      capture->samplesWritten += slot->sampleCount;
+   }
+}
+
+// One slot at a time, so each is free for the next frame once it's written
+static uint64_t writeSlots(void *arg, uint64_t start, uint64_t end) {
+   capture_t *capture = (capture_t *)arg;
+
+   (void)end;
+   writeSlot(capture, &capture->slots[start & CAPTURE_MASK]);
+   return start + 1;
+}
+
+static FILE *openCaptureFile(const char *base, const char *extension) {
+   std::string fileName = std::string(base) + extension;
+   FILE *fp = fopen(fileName.c_str(), "wb");
+
+   if (!fp) {
+      fprintf(stderr, "Could not open capture file %s\n", fileName.c_str());
+   }
+   return fp;
+}
+
+capture_t *createCapture(const char *base, int format) {
+   capture_t *capture = new (alignedAlloc(sizeof(capture_t))) capture_t();
+
+   if (!(capture->slots = (slot_t *)malloc(CAPTURE_SLOTS * sizeof(slot_t)))) {
+      fprintf(stderr, "Could not allocate memory\n");
+      exit(1);
+   }
+   capture->format = format;
+   capture->video  = openCaptureFile(base, format == CAPTURE_RAW ? ".cap" : ".y4m");
+   capture->audio  = format == CAPTURE_RAW || !capture->video ? NULL : openCaptureFile(base, ".wav");
+
+   if (!capture->video || (format != CAPTURE_RAW && !capture->audio)) {
+      if (capture->video) {
+         fclose(capture->video);
+      }
+      free(capture->slots);
+      capture->~capture_t();
+      free(capture);
+      return NULL;
+   }
+
+   capture->failed = 0;
+   capture->samplesWritten = 0;
+   if (format == CAPTURE_RAW) {
+      writeRawHeader(capture);
+   } else {
+      buildPalette(&capture->palette, PIXEL_ARGB8888);
+      capture->converter = bestConverter();
+      fprintf(capture->video, "YUV4MPEG2 W%d H%d F%d:%d Ip A8:7 C420jpeg\n", PPU_WIDTH, PPU_HEIGHT, FRAME_RATE_NUM, FRAME_RATE_DEN);
+      writeWavHeader(capture, 0);
+   }
+
+   capture->head.store(0);
+   capture->tail.store(0);
+   capture->frames.store(0);
+   capture->dropped.store(0);
+   capture->running.store(true);
+   capture->drain  = {&capture->head, &capture->tail, &capture->running, writeSlots, capture};
+   capture->writer = std::thread(drainRing, &capture->drain);
+   return capture;
+}
+
+void captureFrame(capture_t *capture, nes_t *nes) {
+   uint64_t pos = capture->head.load(std::memory_order_relaxed);
+   uint64_t number = capture->frames.load(std::memory_order_relaxed) + 1;
+
+   capture->frames.store(number, std::memory_order_relaxed);
+
+   if (pos - capture->tail.load(std::memory_order_acquire) >= CAPTURE_SLOTS) {
+      capture->dropped.store(capture->dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+      return;
+   }
+
+   slot_t *slot = &capture->slots[pos & CAPTURE_MASK];
+
+   memcpy(slot->frame.framebuffer, nes->ppu.framebuffer, sizeof(slot->frame.framebuffer));
+   memcpy(slot->frame.lineMask, nes->ppu.lineMask, sizeof(slot->frame.lineMask));
+   memcpy(slot->samples, nes->apu.samples, nes->apu.sampleCount * sizeof(int16_t));
+   slot->sampleCount    = nes->apu.sampleCount;
+   slot->frame.number   = number;
+   slot->frame.finished = frameClock();
+   capture->head.store(pos + 1, std::memory_order_release);
+}
+
+int destroyCapture(capture_t *capture) {
+   if (!capture) {
+      return 1;
+   }
+   capture->running.store(false, std::memory_order_release);
+   capture->writer.join();
+
+   if (capture->audio) {
+      rewind(capture->audio);
+      writeWavHeader(capture, (uint32_t)(capture->samplesWritten * sizeof(int16_t)));
+      if (fclose(capture->audio)) {
+         capture->failed = 1;
+      }
+   }
+   if (fclose(capture->video)) {
+      capture->failed = 1;
+   }
+
+   int ok = !capture->failed;
+
+   free(capture->slots);
+   capture->~capture_t();
+   free(capture);
+   return ok;
+}
+
+uint64_t capturedFrames(capture_t *capture) {
+   return capture->frames.load(std::memory_order_relaxed);
+}
+
+uint64_t droppedCaptureFrames(capture_t *capture) {
+   return capture->dropped.load(std::memory_order_relaxed);
+}
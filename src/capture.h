@@ -0,0 +1,53 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <inttypes.h>
+
+// Console state, see nes.h
+typedef struct nes_s nes_t;
+
+// Finished frames and their audio on their way to disk, private to
+// capture.c. The emulation thread copies each frame into a preallocated
+// slot and a writer thread streams the slots out, so the emulation thread
+// never waits on the disk. With every slot full the frame is dropped and
+// counted instead.
+typedef struct capture_s capture_t;
+
+// Slots in the ring, must be a power of two. About a second of frames.
+#define CAPTURE_SLOTS 64
+
+enum {
+   // base.cap: a 32-byte header of 'DNESCAP' and a version byte, then
+   // little-endian uint32 width, height, sample rate, frame rate numerator
+   // and denominator and a reserved 0. Then for every frame a uint64 frame
+   // number, counting dropped ones so gaps show, a uint32 sample count, the
+   // 256x240 palette indices, the 240 lines' $2001 and the int16 samples.
+   CAPTURE_RAW,
+   // base.y4m and base.wav, 4:2:0 video and 16-bit mono PCM that players
+   // and diff tools read directly. Dropped frames are left out of both.
+   CAPTURE_Y4M,
+   NUM_CAPTURE_FORMATS
+};
+
+const char *captureFormatName(int format);
+
+// CAPTURE_* named by name, -1 for none
+int findCaptureFormat(const char *name);
+
+// Starts a writer thread on the files named from base, returns NULL if
+// they can't be opened. Exits if the slots can't be allocated.
+capture_t *createCapture(const char *base, int format);
+
+// Copies nes's last frame and its samples into the next free slot. Never
+// waits, a frame with no slot free is dropped.
+void captureFrame(capture_t *capture, nes_t *nes);
+
+// Waits for the writer to finish every slot still queued, completes the
+// files' headers and closes them. Returns 0 if a write failed.
+int destroyCapture(capture_t *capture);
+
+// Frames handed to captureFrame() and the ones dropped, from any thread
+uint64_t capturedFrames(capture_t *capture);
+uint64_t droppedCaptureFrames(capture_t *capture);
+
+#endif
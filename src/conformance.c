@@ -0,0 +1,242 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <vector>
+
+#include "cpu.h"
+#include "file.h"
+#include "memory.h"
+#include "nes.h"
+#include "trace.h"
+
+// Runs nestest.nes from $C000 in process and checks every instruction
+// against nestest.log: PC, opcode, A/X/Y/P/SP and the CYC/SL columns. Each
+// build checks its own CPU core twice, once a step() at a time and once at
+// full speed through the instruction trace, which is how JIT blocks and the
+// decode cache run. Stops at the first divergence and shows the log
+// leading up to it.
+
+// nestest.log starts its CYC/SL columns at dot 0 of scanline 241
+#define DOTS_PER_SCANLINE 341
+#define SCANLINES 262
+#define START_SCANLINE 241
+
+// Where the registers start on a log line
+#define REGISTER_COLUMN 48
+
+// Log lines shown before a divergence
+#define CONTEXT 5
+
+typedef struct {
+   uint16_t PC;
+   uint8_t  opcode;
+   uint8_t  A;
+   uint8_t  X;
+   uint8_t  Y;
+   uint8_t  P;
+   uint8_t  SP;
+   int16_t  dot;
+   int16_t  scanline;
+} state_t;
+
+static state_t makeState(uint64_t cycle, uint16_t pc, uint8_t opcode, uint8_t A, uint8_t X, uint8_t Y, uint8_t P, uint8_t SP) {
+   uint64_t dots = cycle * 3;
+   state_t state = {pc, opcode, A, X, Y, P, SP,
+      (int16_t)(dots % DOTS_PER_SCANLINE),
+      (int16_t)((START_SCANLINE + 1 + dots / DOTS_PER_SCANLINE) % SCANLINES - 1)};
+
+   return state;
+}
+
+// Splits the log into lines in place and parses each one, returns 0 after
+// printing the first line it can't read
+static int parseLog(char *text, std::vector<const char *> *lines, std::vector<state_t> *log) {
+   char *line = text;
+
+   while (*line) {
+      char *end = strchr(line, '\n');
+      unsigned pc, opcode, A, X, Y, P, SP;
+      int dot, scanline;
+
+      if (end) {
+         *end = '\0';
+         if (end > line && end[-1] == '\r') {
+            end[-1] = '\0';
+         }
+      }
+
+      if (strlen(line) < REGISTER_COLUMN || sscanf(line, "%4x %2x", &pc, &opcode) != 2 ||
+          sscanf(line + REGISTER_COLUMN, "A:%2x X:%2x Y:%2x P:%2x SP:%2x CYC:%d SL:%d", &A, &X, &Y, &P, &SP, &dot, &scanline) != 7) {
+         fprintf(stderr, "Bad log line %zu: %s\n", lines->size() + 1, line);
+         return 0;
+      }
+
+      state_t state = {(uint16_t)pc, (uint8_t)opcode, (uint8_t)A, (uint8_t)X, (uint8_t)Y, (uint8_t)P, (uint8_t)SP, (int16_t)dot, (int16_t)scanline};
+
+      lines->push_back(line);
+      log->push_back(state);
+
+      if (!end) {
+         break;
+      }
+      line = end + 1;
+   }
+   return 1;
+}
+
+static void printLine(const char *label, const state_t *s) {
+   printf("%-9s%04X  %02X %-24s A:%02X X:%02X Y:%02X P:%02X SP:%02X CYC:%3d SL:%d\n", label,
+      s->PC, s->opcode, opcodeName(s->opcode), s->A, s->X, s->Y, s->P, s->SP, s->dot, s->scanline);
+}
+
+// Returns the number of instructions that matched, all of log on success
+static size_t compare(const char *how, const std::vector<const char *> &lines, const std::vector<state_t> &log, const std::vector<state_t> &got, double seconds) {
+   size_t i;
+
+   for (i = 0; i < log.size() && i < got.size(); i++) {
+      if (memcmp(&log[i], &got[i], sizeof(state_t))) {
+         break;
+      }
+   }
+
+   if (i == log.size()) {
+      printf("%s %-5s %zu instructions match in %.2fms\n", dispatchName(), how, i, seconds * 1000);
+      return i;
+   }
+
+   printf("%s %-5s first divergence at nestest.log line %zu\n", dispatchName(), how, i + 1);
+   for (size_t line = i > CONTEXT ? i - CONTEXT : 0; line < i; line++) {
+      printf("         %s\n", lines[line]);
+   }
+   printf("expected %s\n", lines[i]);
+
+   if (i == got.size()) {
+      printf("got      nothing, the CPU stopped after %zu instructions\n", i);
+      return i;
+   }
+
+   const state_t *e = &log[i], *g = &got[i];
+
+   printLine("got", g);
+   printf("differs:");
+   if (e->PC != g->PC)             printf(" PC");
+   if (e->opcode != g->opcode)     printf(" opcode");
+   if (e->A != g->A)               printf(" A");
+   if (e->X != g->X)               printf(" X");
+   if (e->Y != g->Y)               printf(" Y");
+   if (e->P != g->P)               printf(" P");
+   if (e->SP != g->SP)             printf(" SP");
+   if (e->dot != g->dot)           printf(" CYC");
+   if (e->scanline != g->scanline) printf(" SL");
+   printf("\n");
+   return i;
+}
+
+static void runSteps(nes_t *nes, size_t count, std::vector<state_t> *got) {
+   while (got->size() < count && !cpuHalted(nes)) {
+      uint16_t pc = nes->registers.PC;
+      uint8_t *opcode = readPointer(nes, pc);
+
+      got->push_back(makeState(cpuCycles(nes), pc, opcode ? *opcode : fetch(nes, pc),
+         nes->registers.A, nes->registers.X, nes->registers.Y, registerFlags(nes), nes->registers.SP));
+      step(nes);
+   }
+}
+
+#ifndef NO_TRACE
+// Full speed with the instruction trace on, then the trace read back.
+// Returns 0 if the trace file couldn't be made.
+static int runTraced(nes_t *nes, size_t count, std::vector<state_t> *got) {
+   char fileName[] = "/tmp/conformanceXXXXXX";
+   int fd = mkstemp(fileName);
+
+   if (fd < 0) {
+      fprintf(stderr, "Could not create a trace file\n");
+      return 0;
+   }
+   close(fd);
+
+   if (!traceOpen(nes, fileName, TRACE_INSTRUCTIONS)) {
+      unlink(fileName);
+      return 0;
+   }
+   while (cpuInstructions(nes) < count && !cpuHalted(nes)) {
+      runFrame(nes);
+   }
+   traceClose(nes);
+
+   FILE *fp = fopen(fileName, "rb");
+   traceRecord_t record;
+
+   unlink(fileName);
+   if (!fp) {
+      fprintf(stderr, "Could not load file %s\n", fileName);
+      return 0;
+   }
+   while (got->size() < count && fread(&record, sizeof(record), 1, fp) == 1) {
+      if (record.type == RECORD_INSTRUCTION) {
+         got->push_back(makeState(record.cycle, record.addr, record.value, record.A, record.X, record.Y, record.P, record.SP));
+      }
+   }
+   fclose(fp);
+   return 1;
+}
+#endif
+
+int main(int argc, char *argv[]) {
+   const char *romName = argc > 1 ? argv[1] : "nestest/nestest.nes";
+   const char *logName = argc > 2 ? argv[2] : "nestest/nestest.log";
+   void *rom = NULL, *text = NULL;
+   int romSize = 0, textSize = 0;
+   std::vector<const char *> lines;
+   std::vector<state_t> log;
+
+   loadFile(romName, &rom, &romSize);
+   loadFile(logName, &text, &textSize);
+
+   // One more byte so the last line always ends in a NUL
+   if (!(text = realloc(text, textSize + 1))) {
+      fprintf(stderr, "Could not allocate memory\n");
+      return 1;
+   }
+   ((char *)text)[textSize] = '\0';
+
+   if (!parseLog((char *)text, &lines, &log)) {
+      return 1;
+   }
+
+   int failed = 0;
+   nes_t *nes = createNES(rom, romSize);
+   std::vector<state_t> got;
+
+   setPC(nes, NESTEST_AUTOMATION);
+
+   auto start = std::chrono::steady_clock::now();
+   runSteps(nes, log.size(), &got);
+   std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+   failed |= compare("step", lines, log, got, elapsed.count()) != log.size();
+
+#ifndef NO_TRACE
+   powerOnNES(nes, rom, romSize);
+   setPC(nes, NESTEST_AUTOMATION);
+   got.clear();
+
+   start = std::chrono::steady_clock::now();
+   if (runTraced(nes, log.size(), &got)) {
+      elapsed = std::chrono::steady_clock::now() - start;
+      failed |= compare("run", lines, log, got, elapsed.count()) != log.size();
+   } else {
+      failed = 1;
+   }
+#endif
+
+   destroyNES(nes);
+   free(rom);
+   free(text);
+
+   return failed;
+}
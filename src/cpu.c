@@ -3,153 +3,155 @@
 #include <stdio.h>
 
 #include "cpu.h"
+#include "decode.h"
+#include "jit.h"
 #include "memory.h"
+#include "nes.h"
+#include "trace.h"
+
+#if defined(JIT) && defined(THREADED_DISPATCH)
+#error "The JIT runs on the table core, not the threaded one"
+#endif
+
+#if defined(DECODE_CACHE) && (defined(THREADED_DISPATCH) || defined(LINEAR_DISPATCH) || defined(SPECIALIZED_DISPATCH) || defined(JIT))
+#error "The decode cache only sits in front of the table core"
+#endif
 
 #define NUM_INDEX_MODES 9
 
+// Specialized opcodes pull their operand decode and handler into one body
+#define SPECIALIZED_INLINE inline __attribute__((always_inline, flatten))
+
 typedef struct {
    const char *name;
    uint8_t opcode[NUM_INDEX_MODES];
    uint8_t cycles[NUM_INDEX_MODES];
    uint8_t extraCycles[NUM_INDEX_MODES];
-   int (*execute)(uint8_t, uint16_t);
+   int (*execute)(nes_t *, uint8_t, uint16_t);
 } instruction_t;
 
+// One decoded entry per opcode, built from InstructionTable in initCPU()
 typedef struct {
-   uint8_t carry            : 1;
-   uint8_t zero             : 1;
-   uint8_t interruptDisable : 1;
-   uint8_t decimalMode      : 1;
-   uint8_t breakCmd         : 1;
-   uint8_t unused           : 1;
-   uint8_t overflow         : 1;
-   uint8_t negative         : 1;
-} status_t;
-
-typedef struct {
-   uint8_t  A;
-   uint8_t  X;
-   uint8_t  Y;
-   status_t P;
-   uint8_t  SP;
-   uint16_t PC;
-} registers_t;
-
-static registers_t registers;
-
-int ADC(uint8_t val, uint16_t addr);
-int SBC(uint8_t val, uint16_t addr);
-
-int ASL(uint8_t val, uint16_t addr);
-int LSR(uint8_t val, uint16_t addr);
-int ROL(uint8_t val, uint16_t addr);
-int ROR(uint8_t val, uint16_t addr);
-
-int AND(uint8_t val, uint16_t addr);
-int EOR(uint8_t val, uint16_t addr);
-int ORA(uint8_t val, uint16_t addr);
-
-int BCC(uint8_t val, uint16_t addr);
-int BCS(uint8_t val, uint16_t addr);
-int BEQ(uint8_t val, uint16_t addr);
-int BMI(uint8_t val, uint16_t addr);
-int BNE(uint8_t val, uint16_t addr);
-int BPL(uint8_t val, uint16_t addr);
-int BVC(uint8_t val, uint16_t addr);
-int BVS(uint8_t val, uint16_t addr);
-
-int CLC(uint8_t val, uint16_t addr);
-int CLD(uint8_t val, uint16_t addr);
-int CLI(uint8_t val, uint16_t addr);
-int CLV(uint8_t val, uint16_t addr);
-
-int SEC(uint8_t val, uint16_t addr);
-int SED(uint8_t val, uint16_t addr);
-int SEI(uint8_t val, uint16_t addr);
-
-int CMP(uint8_t val, uint16_t addr);
-int CPX(uint8_t val, uint16_t addr);
-int CPY(uint8_t val, uint16_t addr);
-
-int DEC(uint8_t val, uint16_t addr);
-int DEX(uint8_t val, uint16_t addr);
-int DEY(uint8_t val, uint16_t addr);
-
-int INC(uint8_t val, uint16_t addr);
-int INX(uint8_t val, uint16_t addr);
-int INY(uint8_t val, uint16_t addr);
-
-int JMP_ABS(uint8_t val, uint16_t addr);
-int JMP_IND(uint8_t val, uint16_t addr);
-
-int BRK(uint8_t val, uint16_t addr);
-int JSR(uint8_t val, uint16_t addr);
-
-int RTI(uint8_t val, uint16_t addr);
-int RTS(uint8_t val, uint16_t addr);
-
-int LDA(uint8_t val, uint16_t addr);
-int LDX(uint8_t val, uint16_t addr);
-int LDX_ZPY(uint8_t val, uint16_t addr);
-int LDY(uint8_t val, uint16_t addr);
-
-int STA(uint8_t val, uint16_t addr);
-int STX(uint8_t val, uint16_t addr);
-int STX_ZPY(uint8_t val, uint16_t addr);
-int STY(uint8_t val, uint16_t addr);
-
-int PHA(uint8_t val, uint16_t addr);
-int PHP(uint8_t val, uint16_t addr);
-int PLA(uint8_t val, uint16_t addr);
-int PLP(uint8_t val, uint16_t addr);
-
-int TAX(uint8_t val, uint16_t addr);
-int TAY(uint8_t val, uint16_t addr);
-int TSX(uint8_t val, uint16_t addr);
-
-int TXA(uint8_t val, uint16_t addr);
-int TYA(uint8_t val, uint16_t addr);
-int TXS(uint8_t val, uint16_t addr);
-
-int BIT(uint8_t val, uint16_t addr);
-
-int NOP(uint8_t val, uint16_t addr);
+   int (*execute)(nes_t *, uint8_t, uint16_t);
+   uint8_t mode;
+   uint8_t cycles;
+   uint8_t extraCycles;
+   uint8_t writeOnly; // see writesOnly()
+} opcode_t;
+
+int ADC(nes_t *nes, uint8_t val, uint16_t addr);
+int SBC(nes_t *nes, uint8_t val, uint16_t addr);
+
+int ASL(nes_t *nes, uint8_t val, uint16_t addr);
+int LSR(nes_t *nes, uint8_t val, uint16_t addr);
+int ROL(nes_t *nes, uint8_t val, uint16_t addr);
+int ROR(nes_t *nes, uint8_t val, uint16_t addr);
+
+int AND(nes_t *nes, uint8_t val, uint16_t addr);
+int EOR(nes_t *nes, uint8_t val, uint16_t addr);
+int ORA(nes_t *nes, uint8_t val, uint16_t addr);
+
+int BCC(nes_t *nes, uint8_t val, uint16_t addr);
+int BCS(nes_t *nes, uint8_t val, uint16_t addr);
+int BEQ(nes_t *nes, uint8_t val, uint16_t addr);
+int BMI(nes_t *nes, uint8_t val, uint16_t addr);
+int BNE(nes_t *nes, uint8_t val, uint16_t addr);
+int BPL(nes_t *nes, uint8_t val, uint16_t addr);
+int BVC(nes_t *nes, uint8_t val, uint16_t addr);
+int BVS(nes_t *nes, uint8_t val, uint16_t addr);
+
+int CLC(nes_t *nes, uint8_t val, uint16_t addr);
+int CLD(nes_t *nes, uint8_t val, uint16_t addr);
+int CLI(nes_t *nes, uint8_t val, uint16_t addr);
+int CLV(nes_t *nes, uint8_t val, uint16_t addr);
+
+int SEC(nes_t *nes, uint8_t val, uint16_t addr);
+int SED(nes_t *nes, uint8_t val, uint16_t addr);
+int SEI(nes_t *nes, uint8_t val, uint16_t addr);
+
+int CMP(nes_t *nes, uint8_t val, uint16_t addr);
+int CPX(nes_t *nes, uint8_t val, uint16_t addr);
+int CPY(nes_t *nes, uint8_t val, uint16_t addr);
+
+int DEC(nes_t *nes, uint8_t val, uint16_t addr);
+int DEX(nes_t *nes, uint8_t val, uint16_t addr);
+int DEY(nes_t *nes, uint8_t val, uint16_t addr);
+
+int INC(nes_t *nes, uint8_t val, uint16_t addr);
+int INX(nes_t *nes, uint8_t val, uint16_t addr);
+int INY(nes_t *nes, uint8_t val, uint16_t addr);
+
+int JMP_ABS(nes_t *nes, uint8_t val, uint16_t addr);
+int JMP_IND(nes_t *nes, uint8_t val, uint16_t addr);
+
+int BRK(nes_t *nes, uint8_t val, uint16_t addr);
+int JSR(nes_t *nes, uint8_t val, uint16_t addr);
+
+int RTI(nes_t *nes, uint8_t val, uint16_t addr);
+int RTS(nes_t *nes, uint8_t val, uint16_t addr);
+
+int LDA(nes_t *nes, uint8_t val, uint16_t addr);
+int LDX(nes_t *nes, uint8_t val, uint16_t addr);
+int LDX_ZPY(nes_t *nes, uint8_t val, uint16_t addr);
+int LDY(nes_t *nes, uint8_t val, uint16_t addr);
+
+int STA(nes_t *nes, uint8_t val, uint16_t addr);
+int STX(nes_t *nes, uint8_t val, uint16_t addr);
+int STX_ZPY(nes_t *nes, uint8_t val, uint16_t addr);
+int STY(nes_t *nes, uint8_t val, uint16_t addr);
+
+int PHA(nes_t *nes, uint8_t val, uint16_t addr);
+int PHP(nes_t *nes, uint8_t val, uint16_t addr);
+int PLA(nes_t *nes, uint8_t val, uint16_t addr);
+int PLP(nes_t *nes, uint8_t val, uint16_t addr);
+
+int TAX(nes_t *nes, uint8_t val, uint16_t addr);
+int TAY(nes_t *nes, uint8_t val, uint16_t addr);
+int TSX(nes_t *nes, uint8_t val, uint16_t addr);
+
+int TXA(nes_t *nes, uint8_t val, uint16_t addr);
+int TYA(nes_t *nes, uint8_t val, uint16_t addr);
+int TXS(nes_t *nes, uint8_t val, uint16_t addr);
+
+int BIT(nes_t *nes, uint8_t val, uint16_t addr);
+
+int NOP(nes_t *nes, uint8_t val, uint16_t addr);
 
 // undocumented
 
-int AAC(uint8_t val, uint16_t addr);
+int AAC(nes_t *nes, uint8_t val, uint16_t addr);
 
-int XAA(uint8_t val, uint16_t addr);
+int XAA(nes_t *nes, uint8_t val, uint16_t addr);
 
-int AAX(uint8_t val, uint16_t addr);
-int AAX_ZPY(uint8_t val, uint16_t addr);
-int LAX(uint8_t val, uint16_t addr);
-int LAX_ZPY(uint8_t val, uint16_t addr);
+int AAX(nes_t *nes, uint8_t val, uint16_t addr);
+int AAX_ZPY(nes_t *nes, uint8_t val, uint16_t addr);
+int LAX(nes_t *nes, uint8_t val, uint16_t addr);
+int LAX_ZPY(nes_t *nes, uint8_t val, uint16_t addr);
 
-int ARR(uint8_t val, uint16_t addr);
-int ASR(uint8_t val, uint16_t addr);
-int ATX(uint8_t val, uint16_t addr);
-int AXS(uint8_t val, uint16_t addr);
+int ARR(nes_t *nes, uint8_t val, uint16_t addr);
+int ASR(nes_t *nes, uint8_t val, uint16_t addr);
+int ATX(nes_t *nes, uint8_t val, uint16_t addr);
+int AXS(nes_t *nes, uint8_t val, uint16_t addr);
 
-int AXA(uint8_t val, uint16_t addr);
-int SXA(uint8_t val, uint16_t addr);
-int SYA(uint8_t val, uint16_t addr);
+int AXA(nes_t *nes, uint8_t val, uint16_t addr);
+int SXA(nes_t *nes, uint8_t val, uint16_t addr);
+int SYA(nes_t *nes, uint8_t val, uint16_t addr);
 
-int DCP(uint8_t val, uint16_t addr);
-int ISC(uint8_t val, uint16_t addr);
-int RLA(uint8_t val, uint16_t addr);
-int RRA(uint8_t val, uint16_t addr);
-int SLO(uint8_t val, uint16_t addr);
-int SRE(uint8_t val, uint16_t addr);
+int DCP(nes_t *nes, uint8_t val, uint16_t addr);
+int ISC(nes_t *nes, uint8_t val, uint16_t addr);
+int RLA(nes_t *nes, uint8_t val, uint16_t addr);
+int RRA(nes_t *nes, uint8_t val, uint16_t addr);
+int SLO(nes_t *nes, uint8_t val, uint16_t addr);
+int SRE(nes_t *nes, uint8_t val, uint16_t addr);
 
-int LAR(uint8_t val, uint16_t addr);
-int XAS(uint8_t val, uint16_t addr);
+int LAR(nes_t *nes, uint8_t val, uint16_t addr);
+int XAS(nes_t *nes, uint8_t val, uint16_t addr);
 
-int DOP(uint8_t val, uint16_t addr);
-int TOP(uint8_t val, uint16_t addr);
-int KIL(uint8_t val, uint16_t addr);
+int DOP(nes_t *nes, uint8_t val, uint16_t addr);
+int TOP(nes_t *nes, uint8_t val, uint16_t addr);
+int KIL(nes_t *nes, uint8_t val, uint16_t addr);
 
-static instruction_t InstructionTable[] = {
+static constexpr instruction_t InstructionTable[] = {
    //       Other
    //       Impl, Rel
    //        Acc, Imm,  ZP,   ZPX,  Abs,  AbsX, AbsY, IndX, IndY
@@ -161,9 +163,9 @@ static instruction_t InstructionTable[] = {
    {"ROL", {0x2A, 0xFF, 0x26, 0x36, 0x2E, 0x3E, 0xFF, 0xFF, 0xFF}, {2, 0, 5, 6, 6, 7, 0, 0, 0}, {0, 0, 0, 0, 0, 0, 0, 0, 0}, ROL},
    {"ROR", {0x6A, 0xFF, 0x66, 0x76, 0x6E, 0x7E, 0xFF, 0xFF, 0xFF}, {2, 0, 5, 6, 6, 7, 0, 0, 0}, {0, 0, 0, 0, 0, 0, 0, 0, 0}, ROR},
 
-   {"AND", {0xFF, 0x29, 0x25, 0x35, 0x2D, 0x3D, 0x39, 0x21, 0x31}, {0, 2, 2, 3, 4, 4, 4, 6, 5}, {0, 0, 0, 0, 0, 1, 1, 0, 1}, AND},
+   {"AND", {0xFF, 0x29, 0x25, 0x35, 0x2D, 0x3D, 0x39, 0x21, 0x31}, {0, 2, 3, 4, 4, 4, 4, 6, 5}, {0, 0, 0, 0, 0, 1, 1, 0, 1}, AND},
    {"EOR", {0xFF, 0x49, 0x45, 0x55, 0x4D, 0x5D, 0x59, 0x41, 0x51}, {0, 2, 3, 4, 4, 4, 4, 6, 5}, {0, 0, 0, 0, 0, 1, 1, 0, 1}, EOR},
-   {"ORA", {0xFF, 0x09, 0x05, 0x15, 0x0D, 0x1D, 0x19, 0x01, 0x11}, {0, 2, 2, 3, 4, 4, 4, 6, 5}, {0, 0, 0, 0, 0, 1, 1, 0, 1}, ORA},
+   {"ORA", {0xFF, 0x09, 0x05, 0x15, 0x0D, 0x1D, 0x19, 0x01, 0x11}, {0, 2, 3, 4, 4, 4, 4, 6, 5}, {0, 0, 0, 0, 0, 1, 1, 0, 1}, ORA},
 
    {"BCC", {0xFF, 0x90, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF}, {0, 2, 0, 0, 0, 0, 0, 0, 0}, {0, 0, 0, 0, 0, 0, 0, 0, 0}, BCC},
    {"BCS", {0xFF, 0xB0, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF}, {0, 2, 0, 0, 0, 0, 0, 0, 0}, {0, 0, 0, 0, 0, 0, 0, 0, 0}, BCS},
@@ -304,49 +306,506 @@ static instruction_t InstructionTable[] = {
    {"???", {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF}, {0, 0, 0, 0, 0, 0, 0, 0, 0}, {0, 0, 0, 0, 0, 0, 0, 0, 0}, NULL}
 };
 
-uint8_t fetchPC();
-uint16_t fetchPC16();
+uint8_t fetchPC(nes_t *nes);
+uint16_t fetchPC16(nes_t *nes);
+
+void push(nes_t *nes, uint8_t val);
+
+// Indexing carried into the high byte, reads take an extra cycle to fix it up
+inline uint8_t crossesPage(uint16_t base, uint16_t addr) {
+   return (base ^ addr) > 0xFF;
+}
+
+void setFlags(nes_t *nes, uint8_t f);
+
+uint8_t Imm (nes_t *nes, uint8_t *pageBoundary, uint16_t *address);
+uint8_t ZP  (nes_t *nes, uint8_t *pageBoundary, uint16_t *address);
+uint8_t ZPX (nes_t *nes, uint8_t *pageBoundary, uint16_t *address);
+uint8_t ZPY (nes_t *nes, uint8_t *pageBoundary, uint16_t *address);
+uint8_t Abs (nes_t *nes, uint8_t *pageBoundary, uint16_t *address);
+uint8_t AbsX(nes_t *nes, uint8_t *pageBoundary, uint16_t *address);
+uint8_t AbsY(nes_t *nes, uint8_t *pageBoundary, uint16_t *address);
+uint8_t IndX(nes_t *nes, uint8_t *pageBoundary, uint16_t *address);
+uint8_t IndY(nes_t *nes, uint8_t *pageBoundary, uint16_t *address);
+
+static opcode_t OpcodeTable[256];
+
+// Stores that don't index into a page put only their address on the bus, so
+// an I/O register never sees a read from them. The indexed ones still read
+// their target first, standing in for the 6502's dummy read.
+constexpr bool writesOnly(int (*execute)(nes_t *, uint8_t, uint16_t), int mode) {
+   return (execute == STA || execute == STX || execute == STY || execute == AAX) &&
+          (mode == MODE_ZP || mode == MODE_ZPX || mode == MODE_ABS || mode == MODE_INDX);
+}
+
+int runInstruction(nes_t *nes, const opcode_t *op);
+
+uint64_t runLoop(nes_t *nes, uint64_t cycle, long count, stopCondition_t stop, void *arg);
+
+
+void setOpcode(uint8_t opcode, const instruction_t *inst, int ndx);
+int buildOpcodeTable();
+
+void initCPU(nes_t *nes) {
+   // Shared by every console. As a static local it's built once, even with
+   // consoles starting on several threads.
+   static int built = buildOpcodeTable();
+   (void)built;
+
+   nes->registers.A  = 0;
+   nes->registers.X  = 0;
+   nes->registers.Y  = 0;
+   setFlags(nes, 0x24);
+   nes->registers.SP = 0xFD;
+   // Memory is mapped by now, see powerOnNES()
+   nes->registers.PC = fetch16(nes, 0xFFFC);
+
+   nes->masterCycles = 0;
+   nes->instructions = 0;
+   nes->halted = 0;
+   nes->nmiPending = 0;
+   nes->irqLines = 0;
+   nes->opCycles = 0;
+   nes->stallCycles = 0;
+}
+
+void cleanCPU(nes_t *nes) {
+#ifdef JIT
+   cleanJIT(nes);
+#endif
+}
+
+const char *dispatchName() {
+#if defined(LOCKSTEP)
+   return "lockstep";
+#elif defined(JIT)
+   return "jit";
+#elif defined(DECODE_CACHE)
+   return "decode";
+#elif defined(THREADED_DISPATCH) && defined(LAZY_FLAGS)
+   return "threaded+lazy";
+#elif defined(THREADED_DISPATCH)
+   return "threaded";
+#elif defined(LINEAR_DISPATCH)
+   return "linear";
+#elif defined(SPECIALIZED_DISPATCH)
+   return "specialized";
+#else
+   return "table";
+#endif
+}
+
+void setOpcode(uint8_t opcode, const instruction_t *inst, int ndx) {
+   OpcodeTable[opcode].execute     = inst->execute;
+   OpcodeTable[opcode].mode        = ndx;
+   OpcodeTable[opcode].cycles      = inst->cycles[ndx];
+   OpcodeTable[opcode].extraCycles = inst->extraCycles[ndx];
+   OpcodeTable[opcode].writeOnly   = writesOnly(inst->execute, ndx);
+}
+
+int buildOpcodeTable() {
+   int instNdx = 0;
+
+   for (int opcode = 0; opcode < 256; opcode++) {
+      OpcodeTable[opcode].execute = NULL;
+   }
+
+   while (InstructionTable[instNdx].execute) {
+      const instruction_t *inst = InstructionTable + instNdx;
+
+      for (int ndx = 0; ndx < NUM_INDEX_MODES; ndx++) {
+         if (inst->opcode[ndx] != 0xFF && !OpcodeTable[inst->opcode[ndx]].execute) {
+            setOpcode(inst->opcode[ndx], inst, ndx);
+         }
+      }
+
+      // 0xFF doubles as "no opcode" in the table, so ISC AbsX is set by hand
+      if (inst->execute == ISC) {
+         setOpcode(0xFF, inst, 5);
+      }
+
+      ++instNdx;
+   }
+   return 1;
+}
+
+// Compile time specialization: executeOpcode<N>() looks opcode N up in
+// InstructionTable while compiling and decodes its operand inline, so each
+// opcode becomes one straight-line function with no mode switch
+
+typedef int (*handler_t)(nes_t *, uint8_t, uint16_t);
+
+typedef struct {
+   uint8_t  val;
+   uint16_t addr;
+   uint8_t  pageBoundary;
+} operand_t;
+
+constexpr int findSlot(uint8_t opcode, int row, int ndx = 0) {
+   return ndx == NUM_INDEX_MODES ? -1 :
+          InstructionTable[row].opcode[ndx] == opcode ? ndx : findSlot(opcode, row, ndx + 1);
+}
+
+constexpr int findHandler(handler_t execute, int row = 0) {
+   return InstructionTable[row].execute == execute ? row : findHandler(execute, row + 1);
+}
+
+// 0xFF doubles as "no opcode" in the table, so it maps straight to ISC AbsX
+constexpr int findRow(uint8_t opcode, int row = 0) {
+   return opcode == 0xFF ? findHandler(ISC) :
+          InstructionTable[row].execute == NULL || findSlot(opcode, row) >= 0 ? row : findRow(opcode, row + 1);
+}
+
+constexpr int opcodeSlot(uint8_t opcode) {
+   return opcode == 0xFF ? MODE_ABSX : findSlot(opcode, findRow(opcode));
+}
+
+// The *_ZPY handlers sit in the Impl column and decode their own operand
+constexpr bool isZPY(handler_t execute) {
+   return execute == LDX_ZPY || execute == STX_ZPY || execute == AAX_ZPY || execute == LAX_ZPY;
+}
+
+constexpr handler_t opcodeHandler(uint8_t opcode) {
+   return InstructionTable[findRow(opcode)].execute == LDX_ZPY ? LDX :
+          InstructionTable[findRow(opcode)].execute == STX_ZPY ? STX :
+          InstructionTable[findRow(opcode)].execute == AAX_ZPY ? AAX :
+          InstructionTable[findRow(opcode)].execute == LAX_ZPY ? LAX :
+          InstructionTable[findRow(opcode)].execute;
+}
+
+constexpr int opcodeMode(uint8_t opcode) {
+   return isZPY(InstructionTable[findRow(opcode)].execute) ? MODE_ZPY : opcodeSlot(opcode);
+}
+
+// read is false for writesOnly() stores, which leave val 0
+template<int Mode> operand_t decode(nes_t *nes, bool read);
+
+template<> SPECIALIZED_INLINE operand_t decode<MODE_IMPL>(nes_t *nes, bool read) {
+   operand_t o = {nes->registers.A, 0, 0};
+   return o;
+}
+
+template<> SPECIALIZED_INLINE operand_t decode<MODE_IMM>(nes_t *nes, bool read) {
+   operand_t o = {fetchPC(nes), 0, 0};
+   return o;
+}
+
+template<> SPECIALIZED_INLINE operand_t decode<MODE_ZP>(nes_t *nes, bool read) {
+   uint16_t addr = fetchPC(nes);
+   operand_t o = {read ? fetch(nes, addr) : (uint8_t)0, addr, 0};
+   return o;
+}
+
+template<> SPECIALIZED_INLINE operand_t decode<MODE_ZPX>(nes_t *nes, bool read) {
+   uint16_t addr = (fetchPC(nes) + nes->registers.X) & 0xFF;
+   operand_t o = {read ? fetch(nes, addr) : (uint8_t)0, addr, 0};
+   return o;
+}
+
+template<> SPECIALIZED_INLINE operand_t decode<MODE_ZPY>(nes_t *nes, bool read) {
+   uint16_t addr = (fetchPC(nes) + nes->registers.Y) & 0xFF;
+   operand_t o = {fetch(nes, addr), addr, 0};
+   return o;
+}
+
+template<> SPECIALIZED_INLINE operand_t decode<MODE_ABS>(nes_t *nes, bool read) {
+   uint16_t addr = fetchPC16(nes);
+   operand_t o = {read ? fetch(nes, addr) : (uint8_t)0, addr, 0};
+   return o;
+}
+
+template<> SPECIALIZED_INLINE operand_t decode<MODE_ABSX>(nes_t *nes, bool read) {
+   uint16_t base = fetchPC16(nes);
+   uint16_t addr = base + nes->registers.X;
+   operand_t o = {fetch(nes, addr), addr, crossesPage(base, addr)};
+   return o;
+}
+
+template<> SPECIALIZED_INLINE operand_t decode<MODE_ABSY>(nes_t *nes, bool read) {
+   uint16_t base = fetchPC16(nes);
+   uint16_t addr = base + nes->registers.Y;
+   operand_t o = {fetch(nes, addr), addr, crossesPage(base, addr)};
+   return o;
+}
+
+template<> SPECIALIZED_INLINE operand_t decode<MODE_INDX>(nes_t *nes, bool read) {
+   uint16_t addr = fetchZP16(nes, (fetchPC(nes) + nes->registers.X) & 0xFF);
+   operand_t o = {read ? fetch(nes, addr) : (uint8_t)0, addr, 0};
+   return o;
+}
+
+template<> SPECIALIZED_INLINE operand_t decode<MODE_INDY>(nes_t *nes, bool read) {
+   uint16_t base = fetchZP16(nes, fetchPC(nes));
+   uint16_t addr = base + nes->registers.Y;
+   operand_t o = {fetch(nes, addr), addr, crossesPage(base, addr)};
+   return o;
+}
+
+template<uint8_t Opcode> SPECIALIZED_INLINE int executeOpcode(nes_t *nes) {
+   constexpr handler_t execute = opcodeHandler(Opcode);
+   constexpr int cycles        = InstructionTable[findRow(Opcode)].cycles[opcodeSlot(Opcode)];
+   constexpr int extraCycles   = InstructionTable[findRow(Opcode)].extraCycles[opcodeSlot(Opcode)];
+   constexpr int mode          = opcodeMode(Opcode);
+   constexpr bool reads        = !writesOnly(execute, mode);
+
+   nes->opCycles = cycles;
+   operand_t operand = decode<mode>(nes, reads);
+   return execute(nes, operand.val, operand.addr) + cycles + (operand.pageBoundary ? extraCycles : 0);
+}
 
-uint8_t registerFlags();
+#define OPCODE_ROW(h, X) \
+   X(h##0) X(h##1) X(h##2) X(h##3) X(h##4) X(h##5) X(h##6) X(h##7) \
+   X(h##8) X(h##9) X(h##A) X(h##B) X(h##C) X(h##D) X(h##E) X(h##F)
 
-uint8_t Imm (uint8_t *pageBoundary, uint16_t *address);
-uint8_t ZP  (uint8_t *pageBoundary, uint16_t *address);
-uint8_t ZPX (uint8_t *pageBoundary, uint16_t *address);
-uint8_t ZPY (uint8_t *pageBoundary, uint16_t *address);
-uint8_t Abs (uint8_t *pageBoundary, uint16_t *address);
-uint8_t AbsX(uint8_t *pageBoundary, uint16_t *address);
-uint8_t AbsY(uint8_t *pageBoundary, uint16_t *address);
-uint8_t IndX(uint8_t *pageBoundary, uint16_t *address);
-uint8_t IndY(uint8_t *pageBoundary, uint16_t *address);
+#define ALL_OPCODES(X) \
+   OPCODE_ROW(0, X) OPCODE_ROW(1, X) OPCODE_ROW(2, X) OPCODE_ROW(3, X) \
+   OPCODE_ROW(4, X) OPCODE_ROW(5, X) OPCODE_ROW(6, X) OPCODE_ROW(7, X) \
+   OPCODE_ROW(8, X) OPCODE_ROW(9, X) OPCODE_ROW(A, X) OPCODE_ROW(B, X) \
+   OPCODE_ROW(C, X) OPCODE_ROW(D, X) OPCODE_ROW(E, X) OPCODE_ROW(F, X)
+
+#ifdef SPECIALIZED_DISPATCH
+
+#define SPECIALIZED_ENTRY(n) executeOpcode<0x##n>,
+
+static int (*const SpecializedTable[256])(nes_t *) = { ALL_OPCODES(SPECIALIZED_ENTRY) };
+
+#endif
+
+const char *opcodeName(uint8_t opcode) {
+   return InstructionTable[findRow(opcode)].name;
+}
+
+void opcodeInfo(uint8_t opcode, int *mode, int *cycles, int *extraCycles) {
+   *mode        = opcodeMode(opcode);
+   *cycles      = InstructionTable[findRow(opcode)].cycles[opcodeSlot(opcode)];
+   *extraCycles = InstructionTable[findRow(opcode)].extraCycles[opcodeSlot(opcode)];
+}
+
+void raiseNMI(nes_t *nes) {
+   nes->nmiPending = 1;
+   pollEvents(nes);
+}
+
+void setIRQ(nes_t *nes, int source, int level) {
+   if (level) {
+      nes->irqLines |= source;
+      pollEvents(nes);
+   } else {
+      nes->irqLines &= ~source;
+   }
+}
+
+void stallCPU(nes_t *nes, int cycles) {
+   nes->stallCycles += cycles;
+   pollEvents(nes);
+}
 
-int runInstruction(instruction_t *inst, int ndx);
+// CLI, PLP and RTI let an IRQ that is already held in
+void checkIRQ(nes_t *nes) {
+   if (nes->irqLines && !nes->registers.P.interruptDisable) {
+      pollEvents(nes);
+   }
+}
+
+// BRK's sequence without the B flag, 7 cycles
+void interrupt(nes_t *nes, uint16_t vector) {
+   push(nes, (nes->registers.PC >> 8) & 0xFF);
+   push(nes, (nes->registers.PC     ) & 0xFF);
+   push(nes, registerFlags(nes));
+   nes->registers.P.interruptDisable = 1;
+   nes->registers.PC = fetch16(nes, vector);
+   nes->masterCycles += 7;
+}
+
+// The run loop got to nes->nextEvent. Fires what is due and takes a pending
+// interrupt, returns nonzero when the loop has reached its cycle limit.
+int serviceEvents(nes_t *nes) {
+   int stopped = 0;
+
+   // A DMA an event starts stalls before anything after it fires
+   do {
+      nes->masterCycles += nes->stallCycles;
+      nes->stallCycles = 0;
+      stopped |= runEvents(nes);
+   } while (nes->stallCycles);
+
+   int irq = nes->irqLines && !nes->registers.P.interruptDisable;
+
+   // The interrupt waits for the next run, runEvents() just moved
+   // nextEvent past it
+   if (stopped) {
+      if (nes->nmiPending || irq) {
+         pollEvents(nes);
+      }
+      return 1;
+   }
+
+   if (nes->nmiPending) {
+      nes->nmiPending = 0;
+      interrupt(nes, 0xFFFA);
+   } else if (irq) {
+      interrupt(nes, 0xFFFE);
+   }
+   return 0;
+}
+
+#ifdef THREADED_DISPATCH
+
+#define OPCODE_LABEL(n) &&op_##n,
+
+// Each opcode ends in its own fetch and indirect jump, so the host branch
+// predictor sees one dispatch branch per opcode instead of a shared one
+#define NEXT_OPCODE() \
+   if (count == 0 || nes->halted || (stop && stop(arg)) || \
+       (nes->masterCycles >= nes->nextEvent && serviceEvents(nes))) { \
+      cancelEvent(nes, EVENT_STOP); \
+      nes->instructions += limit - count; \
+      return nes->masterCycles - start; \
+   } \
+   count--; \
+   pc = nes->registers.PC; \
+   opcode = fetchPC(nes); \
+   TRACE_INSTRUCTION(nes, nes->masterCycles, pc, opcode, nes->registers.A, nes->registers.X, nes->registers.Y, registerFlags(nes), nes->registers.SP); \
+   goto *labels[opcode]
+
+#define OPCODE_BODY(n) \
+   op_##n: \
+   nes->masterCycles += executeOpcode<0x##n>(nes); \
+   NEXT_OPCODE();
+
+uint64_t runLoop(nes_t *nes, uint64_t cycle, long count, stopCondition_t stop, void *arg) {
+   static void *labels[256] = { ALL_OPCODES(OPCODE_LABEL) };
+   long limit = count;
+   uint64_t start = nes->masterCycles;
+   uint16_t pc;
+   uint8_t opcode;
+
+   // Event handlers see nes->masterCycles, so it's kept current rather than
+   // in a local
+   schedule(nes, EVENT_STOP, cycle);
+   NEXT_OPCODE();
+
+   ALL_OPCODES(OPCODE_BODY)
+}
+
+#else
+
+#ifdef DECODE_CACHE
+
+// Instruction length by table column. The Impl opcodes that do take an
+// operand (JMP, JSR and the *_ZPY handlers) still fetch it themselves.
+static const uint8_t ModeLength[NUM_INDEX_MODES] = {1, 2, 2, 2, 3, 3, 3, 2, 2};
+
+// Decodes pc into the cache without going through the bus, NULL when one of
+// its bytes isn't directly mapped
+const decoded_t *decodeInstruction(nes_t *nes, uint16_t pc) {
+   uint8_t *bytes = readPointer(nes, pc);
+
+   if (!bytes || !OpcodeTable[*bytes].execute) {
+      return NULL;
+   }
+
+   const opcode_t *op = OpcodeTable + *bytes;
+   decoded_t entry = {op->execute, 0, *bytes, op->mode, op->cycles, ModeLength[op->mode], op->extraCycles, op->writeOnly};
+
+   for (int i = 1; i < entry.length; i++) {
+      uint8_t *byte = readPointer(nes, pc + i);
+
+      if (!byte) {
+         return NULL;
+      }
+      entry.operand |= *byte << (8 * (i - 1));
+   }
 
-void initCPU() {
-   registers.A  = 0;
-   registers.X  = 0;
-   registers.Y  = 0;
-   registers.P  = {0,0,1,0,0,1,0,0};
-   registers.SP = 0xFD;
-   registers.PC = 0xC000;
+   decodeFill(nes, pc, &entry);
+   return nes->decode->entries + pc;
 }
 
-void cleanCPU() {
+// runInstruction() with the operand bytes already in hand
+int runDecoded(nes_t *nes, const decoded_t *d) {
+   uint8_t val = nes->registers.A;
+   uint16_t address = 0;
+   uint8_t pageBoundary = 0;
 
+   TRACE_INSTRUCTION(nes, nes->masterCycles, nes->registers.PC, d->opcode, nes->registers.A, nes->registers.X, nes->registers.Y, registerFlags(nes), nes->registers.SP);
+   nes->registers.PC += d->length;
+   nes->opCycles = d->cycles;
+
+   switch (d->mode) {
+      case MODE_IMM:
+         val = d->operand;
+         break;
+      case MODE_ZP:
+      case MODE_ABS:
+         address = d->operand;
+         val = d->writeOnly ? 0 : fetch(nes, address);
+         break;
+      case MODE_ZPX:
+         address = (d->operand + nes->registers.X) & 0xFF;
+         val = d->writeOnly ? 0 : fetch(nes, address);
+         break;
+      case MODE_ABSX:
+         address = d->operand + nes->registers.X;
+         pageBoundary = crossesPage(d->operand, address);
+         val = fetch(nes, address);
+         break;
+      case MODE_ABSY:
+         address = d->operand + nes->registers.Y;
+         pageBoundary = crossesPage(d->operand, address);
+         val = fetch(nes, address);
+         break;
+      case MODE_INDX:
+         address = fetchZP16(nes, (d->operand + nes->registers.X) & 0xFF);
+         val = d->writeOnly ? 0 : fetch(nes, address);
+         break;
+      case MODE_INDY: {
+         uint16_t base = fetchZP16(nes, d->operand);
+
+         address = base + nes->registers.Y;
+         pageBoundary = crossesPage(base, address);
+         val = fetch(nes, address);
+         break;
+      }
+   }
+
+   return d->execute(nes, val, address) + d->cycles + (pageBoundary ? d->extraCycles : 0);
 }
 
-int step() {
-   uint16_t pc = registers.PC;
-   uint8_t opcode = fetchPC();
-   printf("0x%04X: 0x%02X 0x%02X 0x%02X 0x%02X 0x%02X 0x%02X\n", pc, opcode, registers.A, registers.X, registers.Y, registerFlags(), registers.SP);
-   fflush(stdout);
+#endif
 
+inline int executeInstruction(nes_t *nes) {
+#ifdef DECODE_CACHE
+   // Bus records need the opcode and operand fetches the cache skips
+   if (!TRACE_BUS_ENABLED(nes)) {
+      const decoded_t *d = nes->decode->entries + nes->registers.PC;
+
+      if (d->execute) {
+         nes->decode->hits++;
+         return runDecoded(nes, d);
+      }
+
+      nes->decode->misses++;
+      if ((d = decodeInstruction(nes, nes->registers.PC))) {
+         return runDecoded(nes, d);
+      }
+   }
+#endif
+
+   uint16_t pc = nes->registers.PC;
+   uint8_t opcode = fetchPC(nes);
+   TRACE_INSTRUCTION(nes, nes->masterCycles, pc, opcode, nes->registers.A, nes->registers.X, nes->registers.Y, registerFlags(nes), nes->registers.SP);
+
+#ifdef LINEAR_DISPATCH
+   // Original table scan, kept so bench can compare against it
    if (opcode != 0xFF) {
       int instNdx = 0;
 
       while (InstructionTable[instNdx].execute) {
          for (int ndx = 0; ndx < NUM_INDEX_MODES; ndx++) {
             if (InstructionTable[instNdx].opcode[ndx] == opcode) {
-               return runInstruction(InstructionTable + instNdx, ndx);
+               opcode_t op = {InstructionTable[instNdx].execute, (uint8_t)ndx, InstructionTable[instNdx].cycles[ndx], InstructionTable[instNdx].extraCycles[ndx],
+                              writesOnly(InstructionTable[instNdx].execute, ndx)};
+               return runInstruction(nes, &op);
             }
          }
 
@@ -359,75 +818,346 @@ int step() {
          instNdx++;
       }
 
-      return runInstruction(InstructionTable + instNdx, 5);
+      opcode_t op = {ISC, 5, InstructionTable[instNdx].cycles[5], InstructionTable[instNdx].extraCycles[5], 0};
+      return runInstruction(nes, &op);
+   }
+#elif defined(SPECIALIZED_DISPATCH)
+   return SpecializedTable[opcode](nes);
+#else
+   if (OpcodeTable[opcode].execute) {
+      return runInstruction(nes, OpcodeTable + opcode);
    }
+#endif
 
    fprintf(stderr, "Invalid opcode 0x%02X\n", opcode);
    return 1;
 }
 
-int runInstruction(instruction_t *inst, int ndx) {
+#ifdef JIT
+
+void toJitState(nes_t *nes) {
+   jitState_t *state = &nes->jitState;
+
+   state->cycles = nes->masterCycles;
+   state->PC     = nes->registers.PC;
+   state->A      = nes->registers.A;
+   state->X      = nes->registers.X;
+   state->Y      = nes->registers.Y;
+   state->P      = registerFlags(nes);
+   state->SP     = nes->registers.SP;
+}
+
+void fromJitState(nes_t *nes) {
+   const jitState_t *state = &nes->jitState;
+
+   nes->masterCycles = state->cycles;
+   nes->registers.PC = state->PC;
+   nes->registers.A  = state->A;
+   nes->registers.X  = state->X;
+   nes->registers.Y  = state->Y;
+   setFlags(nes, state->P);
+   nes->registers.SP = state->SP;
+}
+
+void jitInterpret(nes_t *nes) {
+   fromJitState(nes);
+   nes->masterCycles += executeInstruction(nes);
+   toJitState(nes);
+
+   // An I/O access raised an interrupt or rescheduled an event, the block
+   // leaves so the run loop sees it on time
+   if (nes->masterCycles >= nes->nextEvent) {
+      nes->jitState.invalidated = 1;
+   }
+}
+
+void runBlock(nes_t *nes, const jitBlock_t *block) {
+   toJitState(nes);
+   nes->jitState.invalidated = 0;
+   block->code(&nes->jitState);
+   fromJitState(nes);
+}
+
+#endif
+
+uint64_t runLoop(nes_t *nes, uint64_t cycle, long count, stopCondition_t stop, void *arg) {
+   long limit = count;
+   uint64_t start = nes->masterCycles;
+
+   // The cycle limit is one more event, so each instruction only compares
+   // against nes->nextEvent
+   schedule(nes, EVENT_STOP, cycle);
+#ifdef JIT
+   int jumped = 1;
+#endif
+
+   while (count != 0 && !nes->halted && !(stop && stop(arg))) {
+      if (nes->masterCycles >= nes->nextEvent && serviceEvents(nes)) {
+         break;
+      }
+#ifdef JIT
+      // Blocks run whole, so one that could pass the next event or the
+      // instruction limit, or a stop condition that has to be checked
+      // between instructions, leaves the next instruction to the interpreter.
+      // Blocks end at control flow, so only a PC that was jumped to (or that
+      // follows a block) is looked up, and straight-line code pays nothing
+      if (jumped) {
+         jitBlock_t *block = stop ? NULL : jitBlock(nes, nes->registers.PC);
+
+         if (block && (unsigned long)block->length <= (unsigned long)count && nes->masterCycles + block->maxCycles <= nes->nextEvent) {
+            runBlock(nes, block);
+            count -= block->length;
+            continue;
+         }
+      }
+      uint16_t pc = nes->registers.PC;
+#endif
+      nes->masterCycles += executeInstruction(nes);
+      count--;
+#ifdef JIT
+      jumped = (uint16_t)(nes->registers.PC - pc - 1) > 2;
+#endif
+   }
+
+   cancelEvent(nes, EVENT_STOP);
+   nes->instructions += limit - count;
+   return nes->masterCycles - start;
+}
+
+#endif
+
+int step(nes_t *nes) {
+   return runLoop(nes, UINT64_MAX, 1, NULL, NULL);
+}
+
+int run(nes_t *nes, int count) {
+   return runLoop(nes, UINT64_MAX, count, NULL, NULL);
+}
+
+uint64_t runCycles(nes_t *nes, uint64_t cycles) {
+   return runLoop(nes, nes->masterCycles + cycles, -1, NULL, NULL);
+}
+
+uint64_t runFrame(nes_t *nes) {
+   uint64_t frame = nes->masterCycles * 3 / PPU_DOTS_PER_FRAME;
+   return runLoop(nes, ((frame + 1) * PPU_DOTS_PER_FRAME + 2) / 3, -1, NULL, NULL);
+}
+
+uint64_t runUntil(nes_t *nes, stopCondition_t stop, void *arg, uint64_t maxCycles) {
+   return runLoop(nes, nes->masterCycles + maxCycles, -1, stop, arg);
+}
+
+uint64_t cpuCycles(nes_t *nes) {
+   return nes->masterCycles;
+}
+
+uint64_t cpuFrame(nes_t *nes) {
+   return nes->masterCycles * 3 / PPU_DOTS_PER_FRAME;
+}
+
+uint64_t busCycle(nes_t *nes) {
+   return nes->masterCycles + (nes->opCycles ? nes->opCycles - 1 : 0);
+}
+
+uint64_t cpuInstructions(nes_t *nes) {
+   return nes->instructions;
+}
+
+int cpuHalted(nes_t *nes) {
+   return nes->halted;
+}
+
+void setPC(nes_t *nes, uint16_t pc) {
+   nes->registers.PC = pc;
+}
+
+
+int runInstruction(nes_t *nes, const opcode_t *op) {
    uint8_t val;
    uint8_t pageBoundary;
    uint16_t address = 0;
 
-   switch (ndx) {
+   nes->opCycles = op->cycles;
+
+   if (op->writeOnly) {
+      switch (op->mode) {
+         case MODE_ZP:
+            address = fetchPC(nes);
+            break;
+         case MODE_ZPX:
+            address = (fetchPC(nes) + nes->registers.X) & 0xFF;
+            break;
+         case MODE_ABS:
+            address = fetchPC16(nes);
+            break;
+         default:
+            address = fetchZP16(nes, (fetchPC(nes) + nes->registers.X) & 0xFF);
+            break;
+      }
+      return op->execute(nes, 0, address) + op->cycles;
+   }
+
+   switch (op->mode) {
       case 0:
-         val = registers.A;
+         val = nes->registers.A;
          pageBoundary = 0;
          break;
       case 1:
-         val = Imm(&pageBoundary, &address);
+         val = Imm(nes, &pageBoundary, &address);
          break;
       case 2:
-         val = ZP(&pageBoundary, &address);
+         val = ZP(nes, &pageBoundary, &address);
          break;
       case 3:
-         val = ZPX(&pageBoundary, &address);
+         val = ZPX(nes, &pageBoundary, &address);
          break;
       case 4:
-         val = Abs(&pageBoundary, &address);
+         val = Abs(nes, &pageBoundary, &address);
          break;
       case 5:
-         val = AbsX(&pageBoundary, &address);
+         val = AbsX(nes, &pageBoundary, &address);
          break;
       case 6:
-         val = AbsY(&pageBoundary, &address);
+         val = AbsY(nes, &pageBoundary, &address);
          break;
       case 7:
-         val = IndX(&pageBoundary, &address);
+         val = IndX(nes, &pageBoundary, &address);
          break;
       case 8:
-         val = IndY(&pageBoundary, &address);
+         val = IndY(nes, &pageBoundary, &address);
          break;
       default:
-         fprintf(stderr, "Wrong ndx %d\n", ndx);
+         fprintf(stderr, "Wrong ndx %d\n", op->mode);
          return 1;
    }
 
-   return inst->execute(val, address) + inst->cycles[ndx] + (pageBoundary ? inst->extraCycles[ndx] : 0);
+   return op->execute(nes, val, address) + op->cycles + (pageBoundary ? op->extraCycles : 0);
 }
 
-uint8_t fetchPC() {
-   return fetch(registers.PC++);
+uint8_t fetchPC(nes_t *nes) {
+   return fetch(nes, nes->registers.PC++);
 }
 
-uint16_t fetchPC16() {
-   uint16_t ret = fetch16(registers.PC);
-   registers.PC += 2;
+uint16_t fetchPC16(nes_t *nes) {
+   uint16_t ret = fetch16(nes, nes->registers.PC);
+   nes->registers.PC += 2;
    return ret;
 }
 
-uint8_t registerFlags() {
+#ifdef LAZY_FLAGS
+
+inline void setNZ(nes_t *nes, uint8_t v) {
+   nes->registers.flags.sign = v;
+   nes->registers.flags.zero = v;
+}
+
+inline void setN(nes_t *nes, uint8_t v) {
+   nes->registers.flags.sign = v;
+}
+
+inline void setZ(nes_t *nes, uint8_t v) {
+   nes->registers.flags.zero = v;
+}
+
+inline void setC(nes_t *nes, uint8_t c) {
+   nes->registers.flags.carry = c ? 0x100 : 0;
+}
+
+// Carry out of a 9 bit result
+inline void setCarry9(nes_t *nes, uint16_t res) {
+   nes->registers.flags.carry = res;
+}
+
+inline void setV(nes_t *nes, uint8_t v) {
+   nes->registers.flags.overflowA = v ? 0x80 : 0;
+   nes->registers.flags.overflowB = v ? 0x80 : 0;
+   nes->registers.flags.overflowR = 0;
+}
+
+// Signed overflow of a + b giving r
+inline void setOverflow(nes_t *nes, uint8_t a, uint8_t b, uint8_t r) {
+   nes->registers.flags.overflowA = a;
+   nes->registers.flags.overflowB = b;
+   nes->registers.flags.overflowR = r;
+}
+
+inline uint8_t flagN(nes_t *nes) {
+   return (nes->registers.flags.sign >> 7) & 1;
+}
+
+inline uint8_t flagZ(nes_t *nes) {
+   return nes->registers.flags.zero == 0 ? 1 : 0;
+}
+
+inline uint8_t flagC(nes_t *nes) {
+   return (nes->registers.flags.carry >> 8) & 1;
+}
+
+inline uint8_t flagV(nes_t *nes) {
+   return (((nes->registers.flags.overflowA ^ nes->registers.flags.overflowR) & (nes->registers.flags.overflowB ^ nes->registers.flags.overflowR)) >> 7) & 1;
+}
+
+#else
+
+inline void setNZ(nes_t *nes, uint8_t v) {
+   nes->registers.P.negative = (v >> 7) & 1;
+   nes->registers.P.zero     = v == 0 ? 1 : 0;
+}
+
+inline void setN(nes_t *nes, uint8_t v) {
+   nes->registers.P.negative = (v >> 7) & 1;
+}
+
+inline void setZ(nes_t *nes, uint8_t v) {
+   nes->registers.P.zero = v == 0 ? 1 : 0;
+}
+
+inline void setC(nes_t *nes, uint8_t c) {
+   nes->registers.P.carry = c ? 1 : 0;
+}
+
+// Carry out of a 9 bit result
+inline void setCarry9(nes_t *nes, uint16_t res) {
+   nes->registers.P.carry = (res >> 8) & 1;
+}
+
+inline void setV(nes_t *nes, uint8_t v) {
+   nes->registers.P.overflow = v ? 1 : 0;
+}
+
+// Signed overflow of a + b giving r
+inline void setOverflow(nes_t *nes, uint8_t a, uint8_t b, uint8_t r) {
+   nes->registers.P.overflow = (((a ^ r) & (b ^ r)) >> 7) & 1;
+}
+
+inline uint8_t flagN(nes_t *nes) {
+   return nes->registers.P.negative;
+}
+
+inline uint8_t flagZ(nes_t *nes) {
+   return nes->registers.P.zero;
+}
+
+inline uint8_t flagC(nes_t *nes) {
+   return nes->registers.P.carry;
+}
+
+inline uint8_t flagV(nes_t *nes) {
+   return nes->registers.P.overflow;
+}
+
+#endif
+
+uint8_t registerFlags(nes_t *nes) {
    return
-      (registers.P.carry            ? 1<<0 : 0) |
-      (registers.P.zero             ? 1<<1 : 0) |
-      (registers.P.interruptDisable ? 1<<2 : 0) |
-      (registers.P.decimalMode      ? 1<<3 : 0) |
-      (registers.P.breakCmd         ? 1<<4 : 0) |
-      (registers.P.unused           ? 1<<5 : 0) |
-      (registers.P.overflow         ? 1<<6 : 0) |
-      (registers.P.negative         ? 1<<7 : 0);
+      (flagC(nes)                      ? 1<<0 : 0) |
+      (flagZ(nes)                      ? 1<<1 : 0) |
+      (nes->registers.P.interruptDisable ? 1<<2 : 0) |
+      (nes->registers.P.decimalMode      ? 1<<3 : 0) |
+      (nes->registers.P.breakCmd         ? 1<<4 : 0) |
+      (nes->registers.P.unused           ? 1<<5 : 0) |
+      (flagV(nes)                      ? 1<<6 : 0) |
+      (flagN(nes)                      ? 1<<7 : 0);
 }
 
 status_t flagsToRegister(uint8_t f) {
@@ -443,12 +1173,22 @@ status_t flagsToRegister(uint8_t f) {
    return P;
 }
 
-void push(uint8_t val) {
-   store(0x100 | registers.SP--, val);
+void setFlags(nes_t *nes, uint8_t f) {
+   nes->registers.P = flagsToRegister(f);
+#ifdef LAZY_FLAGS
+   setN(nes, f);
+   setZ(nes, ~f & 1<<1);
+   setC(nes, f & 1<<0);
+   setV(nes, f & 1<<6);
+#endif
+}
+
+void push(nes_t *nes, uint8_t val) {
+   store(nes, 0x100 | nes->registers.SP--, val);
 }
 
-uint8_t pop() {
-   return fetch(0x100 | ++registers.SP);
+uint8_t pop(nes_t *nes) {
+   return fetch(nes, 0x100 | ++nes->registers.SP);
 }
 
 int8_t asSigned(uint8_t v) {
@@ -463,598 +1203,587 @@ uint8_t MSB2(uint16_t v) {
    return (v >> 6) & 1;
 }
 
-uint8_t Imm(uint8_t *pageBoundary, uint16_t *address) {
+uint8_t Imm(nes_t *nes, uint8_t *pageBoundary, uint16_t *address) {
    *pageBoundary = 0;
-   return fetchPC();
+   return fetchPC(nes);
 }
 
-uint8_t ZP(uint8_t *pageBoundary, uint16_t *address) {
+uint8_t ZP(nes_t *nes, uint8_t *pageBoundary, uint16_t *address) {
    *pageBoundary = 0;
-   *address = fetchPC();
-   return fetch(*address);
+   *address = fetchPC(nes);
+   return fetch(nes, *address);
 }
 
-uint8_t ZPX(uint8_t *pageBoundary, uint16_t *address) {
+uint8_t ZPX(nes_t *nes, uint8_t *pageBoundary, uint16_t *address) {
    *pageBoundary = 0;
-   *address = (fetchPC() + registers.X) & 0xFF;
-   return fetch(*address);
+   *address = (fetchPC(nes) + nes->registers.X) & 0xFF;
+   return fetch(nes, *address);
 }
 
-uint8_t ZPY(uint8_t *pageBoundary, uint16_t *address) {
+uint8_t ZPY(nes_t *nes, uint8_t *pageBoundary, uint16_t *address) {
    *pageBoundary = 0;
-   *address = (fetchPC() + registers.Y) & 0xFF;
-   return fetch(*address);
+   *address = (fetchPC(nes) + nes->registers.Y) & 0xFF;
+   return fetch(nes, *address);
 }
 
-uint8_t Abs(uint8_t *pageBoundary, uint16_t *address) {
+uint8_t Abs(nes_t *nes, uint8_t *pageBoundary, uint16_t *address) {
    *pageBoundary = 0;
-   *address = fetchPC16();
-   return fetch(*address);
+   *address = fetchPC16(nes);
+   return fetch(nes, *address);
 }
 
-uint8_t AbsX(uint8_t *pageBoundary, uint16_t *address) {
-   *pageBoundary = 0;
-   *address = fetchPC16() + registers.X;
-   return fetch(*address);
+uint8_t AbsX(nes_t *nes, uint8_t *pageBoundary, uint16_t *address) {
+   uint16_t base = fetchPC16(nes);
+
+   *address = base + nes->registers.X;
+   *pageBoundary = crossesPage(base, *address);
+   return fetch(nes, *address);
 }
 
-uint8_t AbsY(uint8_t *pageBoundary, uint16_t *address) {
-   *pageBoundary = 0;
-   *address = fetchPC16() + registers.Y;
-   return fetch(*address);
+uint8_t AbsY(nes_t *nes, uint8_t *pageBoundary, uint16_t *address) {
+   uint16_t base = fetchPC16(nes);
+
+   *address = base + nes->registers.Y;
+   *pageBoundary = crossesPage(base, *address);
+   return fetch(nes, *address);
 }
 
-uint8_t IndX(uint8_t *pageBoundary, uint16_t *address) {
+uint8_t IndX(nes_t *nes, uint8_t *pageBoundary, uint16_t *address) {
    *pageBoundary = 0;
-   *address = fetchZP16((fetchPC() + registers.X) & 0xFF);
-   return fetch(*address);
+   *address = fetchZP16(nes, (fetchPC(nes) + nes->registers.X) & 0xFF);
+   return fetch(nes, *address);
 }
 
-uint8_t IndY(uint8_t *pageBoundary, uint16_t *address) {
-   *pageBoundary = 0;
-   *address = fetchZP16(fetchPC()) + registers.Y;
-   return fetch(*address);
+uint8_t IndY(nes_t *nes, uint8_t *pageBoundary, uint16_t *address) {
+   uint16_t base = fetchZP16(nes, fetchPC(nes));
+
+   *address = base + nes->registers.Y;
+   *pageBoundary = crossesPage(base, *address);
+   return fetch(nes, *address);
 }
 
-int ADC(uint8_t val, uint16_t addr) {
-   uint16_t res = registers.A + val + registers.P.carry;
+int ADC(nes_t *nes, uint8_t val, uint16_t addr) {
+   uint16_t res = nes->registers.A + val + flagC(nes);
    
-   registers.P.overflow = (MSB(registers.A) != MSB(res) && MSB(val) != MSB(res)) ? 1 : 0;
-   registers.P.negative = MSB(res)  ? 1 : 0;
-   registers.P.zero     = (res & 0xFF) == 0  ? 1 : 0;
-   registers.P.carry    = res > 255 ? 1 : 0;
+   setOverflow(nes, nes->registers.A, val, res);
+   setNZ(nes, res);
+   setCarry9(nes, res);
 
-   registers.A = res & 0xFF;
+   nes->registers.A = res & 0xFF;
    return 0;
 }
 
-int SBC(uint8_t val, uint16_t addr) {
-   return ADC(~val, addr);
-   // int16_t re = registers.A - val + (registers.P.carry ? 0x100 : 0);
-   // uint16_t res = registers.A - val - (registers.P.carry ? 0 : 1);
+int SBC(nes_t *nes, uint8_t val, uint16_t addr) {
+   return ADC(nes, ~val, addr);
+   // int16_t re = nes->registers.A - val + (nes->registers.P.carry ? 0x100 : 0);
+   // uint16_t res = nes->registers.A - val - (nes->registers.P.carry ? 0 : 1);
 
    // fprintf(stderr, "%d, %d\n", res, int8_t(re));
 
-   // registers.P.overflow = ((res & 0x100) == 0 && int16_t(res) < -128) ? 1 : 0;
-   // registers.P.negative = MSB(res)  ? 1 : 0;
-   // registers.P.zero     = (res & 0xFF) == 0  ? 1 : 0;
-   // registers.P.carry    = (int8_t(res) >= 0) ? 1 : 0;
+   // nes->registers.P.overflow = ((res & 0x100) == 0 && int16_t(res) < -128) ? 1 : 0;
+   // nes->registers.P.negative = MSB(res)  ? 1 : 0;
+   // nes->registers.P.zero     = (res & 0xFF) == 0  ? 1 : 0;
+   // nes->registers.P.carry    = (int8_t(res) >= 0) ? 1 : 0;
 
-   // registers.A = res & 0xFF;
+   // nes->registers.A = res & 0xFF;
    // return 0;
 }
 
-int ASL(uint8_t val, uint16_t addr) {
-   registers.P.carry = MSB(val) ? 1 : 0;
+int ASL(nes_t *nes, uint8_t val, uint16_t addr) {
+   setCarry9(nes, val << 1);
 
    val = (val << 1) & 0xFE;
 
-   registers.P.negative = MSB(val) ? 1 : 0;
-   registers.P.zero     = val == 0 ? 1 : 0;
+   setNZ(nes, val);
 
    if (addr) {
-      store(addr, val);
+      store(nes, addr, val);
    } else {
-      registers.A = val;
+      nes->registers.A = val;
    }
 
    return 0;
 }
 
-int LSR(uint8_t val, uint16_t addr) {
-   fprintf(stderr, "LSR %04X %02X\n", addr, val);
-   registers.P.negative = 0;
-   registers.P.carry = (val & 1) ? 1 : 0;
+int LSR(nes_t *nes, uint8_t val, uint16_t addr) {
+   setC(nes, val & 1);
 
    val = (val >> 1) & 0x7F;
-   registers.P.zero = val == 0 ? 1 : 0;
+   setNZ(nes, val);
 
    if (addr) {
-      store(addr, val);
+      store(nes, addr, val);
    } else {
-      registers.A = val;
+      nes->registers.A = val;
    }
 
    return 0;
 }
 
-int ROL(uint8_t val, uint16_t addr) {
+int ROL(nes_t *nes, uint8_t val, uint16_t addr) {
    uint8_t t = MSB(val) ? 1 : 0;
 
-   val = ((val << 1) & 0xFE) | (registers.P.carry ? 1 : 0);
+   val = ((val << 1) & 0xFE) | (flagC(nes) ? 1 : 0);
 
-   registers.P.carry    = t;
-   registers.P.negative = MSB(val) ? 1 : 0;
-   registers.P.zero     = val == 0 ? 1 : 0;
+   setC(nes, t);
+   setNZ(nes, val);
 
    if (addr) {
-      store(addr, val);
+      store(nes, addr, val);
    } else {
-      registers.A = val;
+      nes->registers.A = val;
    }
 
    return 0;
 }
 
-int ROR(uint8_t val, uint16_t addr) {
+int ROR(nes_t *nes, uint8_t val, uint16_t addr) {
    uint8_t t = (val & 1) ? 1 : 0;
 
-   val = ((val >> 1) & 0x7F) | (registers.P.carry ? 0x80 : 0x00);
+   val = ((val >> 1) & 0x7F) | (flagC(nes) ? 0x80 : 0x00);
 
-   registers.P.carry    = t;
-   registers.P.negative = MSB(val) ? 1 : 0;
-   registers.P.zero     = val == 0 ? 1 : 0;
+   setC(nes, t);
+   setNZ(nes, val);
 
    if (addr) {
-      store(addr, val);
+      store(nes, addr, val);
    } else {
-      registers.A = val;
+      nes->registers.A = val;
    }
 
    return 0;
 }
 
-int AND(uint8_t val, uint16_t addr) {
-   registers.A &= val;
-   registers.P.negative = MSB(registers.A) ? 1 : 0;
-   registers.P.zero     = registers.A == 0 ? 1 : 0;
+int AND(nes_t *nes, uint8_t val, uint16_t addr) {
+   nes->registers.A &= val;
+   setNZ(nes, nes->registers.A);
    return 0;
 }
 
-int EOR(uint8_t val, uint16_t addr) {
-   registers.A ^= val;
-   registers.P.negative = MSB(registers.A) ? 1 : 0;
-   registers.P.zero     = registers.A == 0 ? 1 : 0;
+int EOR(nes_t *nes, uint8_t val, uint16_t addr) {
+   nes->registers.A ^= val;
+   setNZ(nes, nes->registers.A);
    return 0;
 }
 
-int ORA(uint8_t val, uint16_t addr) {
-   registers.A |= val;
-   registers.P.negative = MSB(registers.A) ? 1 : 0;
-   registers.P.zero     = registers.A == 0 ? 1 : 0;
+int ORA(nes_t *nes, uint8_t val, uint16_t addr) {
+   nes->registers.A |= val;
+   setNZ(nes, nes->registers.A);
    return 0;
 }
 
-int Branch(uint8_t cond, uint8_t val) {
+int Branch(nes_t *nes, uint8_t cond, uint8_t val) {
    if (cond) {
-      uint16_t page = registers.PC & 0xFF00;
-      registers.PC += asSigned(val);
-      return (registers.PC & 0xFF00) == page ? 1 : 2;
+      uint16_t page = nes->registers.PC & 0xFF00;
+      nes->registers.PC += asSigned(val);
+      return (nes->registers.PC & 0xFF00) == page ? 1 : 2;
    }
    return 0;
 }
 
-int BCC(uint8_t val, uint16_t addr) {
-   return Branch(registers.P.carry == 0, val);
+int BCC(nes_t *nes, uint8_t val, uint16_t addr) {
+   return Branch(nes, flagC(nes) == 0, val);
 }
 
-int BCS(uint8_t val, uint16_t addr) {
-   return Branch(registers.P.carry == 1, val);
+int BCS(nes_t *nes, uint8_t val, uint16_t addr) {
+   return Branch(nes, flagC(nes) == 1, val);
 }
 
-int BEQ(uint8_t val, uint16_t addr) {
-   return Branch(registers.P.zero == 1, val);
+int BEQ(nes_t *nes, uint8_t val, uint16_t addr) {
+   return Branch(nes, flagZ(nes) == 1, val);
 }
 
-int BMI(uint8_t val, uint16_t addr) {
-   return Branch(registers.P.negative == 1, val);
+int BMI(nes_t *nes, uint8_t val, uint16_t addr) {
+   return Branch(nes, flagN(nes) == 1, val);
 }
 
-int BNE(uint8_t val, uint16_t addr) {
-   return Branch(registers.P.zero == 0, val);
+int BNE(nes_t *nes, uint8_t val, uint16_t addr) {
+   return Branch(nes, flagZ(nes) == 0, val);
 }
 
-int BPL(uint8_t val, uint16_t addr) {
-   return Branch(registers.P.negative == 0, val);
+int BPL(nes_t *nes, uint8_t val, uint16_t addr) {
+   return Branch(nes, flagN(nes) == 0, val);
 }
 
-int BVC(uint8_t val, uint16_t addr) {
-   return Branch(registers.P.overflow == 0, val);
+int BVC(nes_t *nes, uint8_t val, uint16_t addr) {
+   return Branch(nes, flagV(nes) == 0, val);
 }
 
-int BVS(uint8_t val, uint16_t addr) {
-   return Branch(registers.P.overflow == 1, val);
+int BVS(nes_t *nes, uint8_t val, uint16_t addr) {
+   return Branch(nes, flagV(nes) == 1, val);
 }
 
-int CLC(uint8_t val, uint16_t addr) {
-   registers.P.carry = 0;
+int CLC(nes_t *nes, uint8_t val, uint16_t addr) {
+   setC(nes, 0);
    return 0;
 }
 
-int CLD(uint8_t val, uint16_t addr) {
-   registers.P.decimalMode = 0;
+int CLD(nes_t *nes, uint8_t val, uint16_t addr) {
+   nes->registers.P.decimalMode = 0;
    return 0;
 }
 
-int CLI(uint8_t val, uint16_t addr) {
-   registers.P.interruptDisable = 0;
+int CLI(nes_t *nes, uint8_t val, uint16_t addr) {
+   nes->registers.P.interruptDisable = 0;
+   checkIRQ(nes);
    return 0;
 }
 
-int CLV(uint8_t val, uint16_t addr) {
-   registers.P.overflow = 0;
+int CLV(nes_t *nes, uint8_t val, uint16_t addr) {
+   setV(nes, 0);
    return 0;
 }
 
-int SEC(uint8_t val, uint16_t addr) {
-   registers.P.carry = 1;
+int SEC(nes_t *nes, uint8_t val, uint16_t addr) {
+   setC(nes, 1);
    return 0;
 }
 
-int SED(uint8_t val, uint16_t addr) {
-   registers.P.decimalMode = 1;
+int SED(nes_t *nes, uint8_t val, uint16_t addr) {
+   nes->registers.P.decimalMode = 1;
    return 0;
 }
 
-int SEI(uint8_t val, uint16_t addr) {
-   registers.P.interruptDisable = 1;
+int SEI(nes_t *nes, uint8_t val, uint16_t addr) {
+   nes->registers.P.interruptDisable = 1;
    return 0;
 }
 
-int Compare(uint8_t val, uint8_t mem) {
-   fprintf(stderr, "%d, %d\n", (val), (mem));
-   registers.P.negative = MSB(val - mem) ? 1 : 0;
-   registers.P.carry    = val >= mem ? 1 : 0;
-   registers.P.zero     = val == mem ? 1 : 0;
+int Compare(nes_t *nes, uint8_t val, uint8_t mem) {
+   setNZ(nes, val - mem);
+   setC(nes, val >= mem);
    return 0;
 }
 
-int CMP(uint8_t val, uint16_t addr) {
-   return Compare(registers.A, val);
+int CMP(nes_t *nes, uint8_t val, uint16_t addr) {
+   return Compare(nes, nes->registers.A, val);
 }
 
-int CPX(uint8_t val, uint16_t addr) {
-   return Compare(registers.X, val);
+int CPX(nes_t *nes, uint8_t val, uint16_t addr) {
+   return Compare(nes, nes->registers.X, val);
 }
 
-int CPY(uint8_t val, uint16_t addr) {
-   return Compare(registers.Y, val);
+int CPY(nes_t *nes, uint8_t val, uint16_t addr) {
+   return Compare(nes, nes->registers.Y, val);
 }
 
-int DEC(uint8_t val, uint16_t addr) {
-   store(addr, --val);
-   registers.P.negative = MSB(val) ? 1 : 0;
-   registers.P.zero     = val == 0 ? 1 : 0;
+int DEC(nes_t *nes, uint8_t val, uint16_t addr) {
+   store(nes, addr, --val);
+   setNZ(nes, val);
    return 0;
 }
 
-int DEX(uint8_t val, uint16_t addr) {
-   registers.X--;
-   registers.P.negative = MSB(registers.X) ? 1 : 0;
-   registers.P.zero     = registers.X == 0 ? 1 : 0;
+int DEX(nes_t *nes, uint8_t val, uint16_t addr) {
+   nes->registers.X--;
+   setNZ(nes, nes->registers.X);
    return 0;
 }
 
-int DEY(uint8_t val, uint16_t addr) {
-   registers.Y--;
-   registers.P.negative = MSB(registers.Y) ? 1 : 0;
-   registers.P.zero     = registers.Y == 0 ? 1 : 0;
+int DEY(nes_t *nes, uint8_t val, uint16_t addr) {
+   nes->registers.Y--;
+   setNZ(nes, nes->registers.Y);
    return 0;
 }
 
-int INC(uint8_t val, uint16_t addr) {
-   store(addr, ++val);
-   registers.P.negative = MSB(val) ? 1 : 0;
-   registers.P.zero     = val == 0 ? 1 : 0;
+int INC(nes_t *nes, uint8_t val, uint16_t addr) {
+   store(nes, addr, ++val);
+   setNZ(nes, val);
    return 0;
 }
 
-int INX(uint8_t val, uint16_t addr) {
-   registers.X++;
-   registers.P.negative = MSB(registers.X) ? 1 : 0;
-   registers.P.zero     = registers.X == 0 ? 1 : 0;
+int INX(nes_t *nes, uint8_t val, uint16_t addr) {
+   nes->registers.X++;
+   setNZ(nes, nes->registers.X);
    return 0;
 }
 
-int INY(uint8_t val, uint16_t addr) {
-   registers.Y++;
-   registers.P.negative = MSB(registers.Y) ? 1 : 0;
-   registers.P.zero     = registers.Y == 0 ? 1 : 0;
+int INY(nes_t *nes, uint8_t val, uint16_t addr) {
+   nes->registers.Y++;
+   setNZ(nes, nes->registers.Y);
    return 0;
 }
 
-int JMP_ABS(uint8_t val, uint16_t addr) {
-   registers.PC = fetchPC16();
+int JMP_ABS(nes_t *nes, uint8_t val, uint16_t addr) {
+   nes->registers.PC = fetchPC16(nes);
    return 0;
 }
 
-int JMP_IND(uint8_t val, uint16_t addr) {
-   uint16_t first = fetchPC16();
-   registers.PC = fetch(first) | (fetch((first & 0xFF00) | ((first+1) & 0xFF)) << 8);
+int JMP_IND(nes_t *nes, uint8_t val, uint16_t addr) {
+   uint16_t first = fetchPC16(nes);
+   nes->registers.PC = fetch(nes, first) | (fetch(nes, (first & 0xFF00) | ((first+1) & 0xFF)) << 8);
    return 0;
 }
 
-int BRK(uint8_t val, uint16_t addr) {
-   push((registers.PC >> 8) & 0xFF);
-   push((registers.PC     ) & 0xFF);
-   push(registerFlags()     | 0x10);
-   registers.PC = fetch16(0xFFFE);
+int BRK(nes_t *nes, uint8_t val, uint16_t addr) {
+   push(nes, (nes->registers.PC >> 8) & 0xFF);
+   push(nes, (nes->registers.PC     ) & 0xFF);
+   push(nes, registerFlags(nes)     | 0x10);
+   nes->registers.P.interruptDisable = 1;
+   nes->registers.PC = fetch16(nes, 0xFFFE);
    return 0;
 }
 
-int JSR(uint8_t val, uint16_t addr) {
-   uint16_t nextPC = fetchPC16();
-   registers.PC--;
-   push((registers.PC >> 8) & 0xFF);
-   push((registers.PC     ) & 0xFF);
-   registers.PC = nextPC;
+int JSR(nes_t *nes, uint8_t val, uint16_t addr) {
+   uint16_t nextPC = fetchPC16(nes);
+   nes->registers.PC--;
+   push(nes, (nes->registers.PC >> 8) & 0xFF);
+   push(nes, (nes->registers.PC     ) & 0xFF);
+   nes->registers.PC = nextPC;
    return 0;
 }
 
-int RTI(uint8_t val, uint16_t addr) {
-   registers.P  = flagsToRegister(pop() | 0x20);
-   registers.PC = pop() | (pop() << 8);
+int RTI(nes_t *nes, uint8_t val, uint16_t addr) {
+   setFlags(nes, pop(nes) | 0x20);
+   nes->registers.PC = pop(nes) | (pop(nes) << 8);
+   checkIRQ(nes);
    return 0;
 }
 
-int RTS(uint8_t val, uint16_t addr) {
-   registers.PC = (pop() | (pop() << 8)) + 1;
+int RTS(nes_t *nes, uint8_t val, uint16_t addr) {
+   nes->registers.PC = (pop(nes) | (pop(nes) << 8)) + 1;
    return 0;
 }
 
-int LDA(uint8_t val, uint16_t addr) {
-   registers.A = val;
-   registers.P.negative = MSB(registers.A) ? 1 : 0;
-   registers.P.zero     = registers.A == 0 ? 1 : 0;
+int LDA(nes_t *nes, uint8_t val, uint16_t addr) {
+   nes->registers.A = val;
+   setNZ(nes, nes->registers.A);
    return 0;
 }
 
-int LDX(uint8_t val, uint16_t addr) {
-   registers.X = val;
-   registers.P.negative = MSB(registers.X) ? 1 : 0;
-   registers.P.zero     = registers.X == 0 ? 1 : 0;
+int LDX(nes_t *nes, uint8_t val, uint16_t addr) {
+   nes->registers.X = val;
+   setNZ(nes, nes->registers.X);
    return 0;
 }
 
-int LDX_ZPY(uint8_t val, uint16_t addr) {
+int LDX_ZPY(nes_t *nes, uint8_t val, uint16_t addr) {
    uint8_t pageBoundary = 0;
-   return LDX(ZPY(&pageBoundary, &addr), addr);
+   val = ZPY(nes, &pageBoundary, &addr);
+   return LDX(nes, val, addr);
 }
 
-int LDY(uint8_t val, uint16_t addr) {
-   registers.Y = val;
-   registers.P.negative = MSB(registers.Y) ? 1 : 0;
-   registers.P.zero     = registers.Y == 0 ? 1 : 0;
+int LDY(nes_t *nes, uint8_t val, uint16_t addr) {
+   nes->registers.Y = val;
+   setNZ(nes, nes->registers.Y);
    return 0;
 }
 
-int STA(uint8_t val, uint16_t addr) {
-   store(addr, registers.A);
+int STA(nes_t *nes, uint8_t val, uint16_t addr) {
+   store(nes, addr, nes->registers.A);
    return 0;
 }
 
-int STX(uint8_t val, uint16_t addr) {
-   store(addr, registers.X);
+int STX(nes_t *nes, uint8_t val, uint16_t addr) {
+   store(nes, addr, nes->registers.X);
    return 0;
 }
 
-int STX_ZPY(uint8_t val, uint16_t addr) {
+int STX_ZPY(nes_t *nes, uint8_t val, uint16_t addr) {
    uint8_t pageBoundary = 0;
-   return STX(ZPY(&pageBoundary, &addr), addr);
+   val = ZPY(nes, &pageBoundary, &addr);
+   return STX(nes, val, addr);
 }
 
-int STY(uint8_t val, uint16_t addr) {
-   store(addr, registers.Y);
+int STY(nes_t *nes, uint8_t val, uint16_t addr) {
+   store(nes, addr, nes->registers.Y);
    return 0;
 }
 
-int PHA(uint8_t val, uint16_t addr) {
-   push(registers.A);
+int PHA(nes_t *nes, uint8_t val, uint16_t addr) {
+   push(nes, nes->registers.A);
    return 0;
 }
 
-int PHP(uint8_t val, uint16_t addr) {
-   push(registerFlags() | 0x10);
+int PHP(nes_t *nes, uint8_t val, uint16_t addr) {
+   push(nes, registerFlags(nes) | 0x10);
    return 0;
 }
 
-int PLA(uint8_t val, uint16_t addr) {
-   registers.A = pop();
-   registers.P.negative = MSB(registers.A) ? 1 : 0;
-   registers.P.zero     = registers.A == 0 ? 1 : 0;
+int PLA(nes_t *nes, uint8_t val, uint16_t addr) {
+   nes->registers.A = pop(nes);
+   setNZ(nes, nes->registers.A);
    return 0;
 }
 
-int PLP(uint8_t val, uint16_t addr) {
-   registers.P = flagsToRegister((pop() & 0xEF) | 0x20);
+int PLP(nes_t *nes, uint8_t val, uint16_t addr) {
+   setFlags(nes, (pop(nes) & 0xEF) | 0x20);
+   checkIRQ(nes);
    return 0;
 }
 
-int TAX(uint8_t val, uint16_t addr) {
-   registers.X = registers.A;
-   registers.P.negative = MSB(registers.X) ? 1 : 0;
-   registers.P.zero     = registers.X == 0 ? 1 : 0;
+int TAX(nes_t *nes, uint8_t val, uint16_t addr) {
+   nes->registers.X = nes->registers.A;
+   setNZ(nes, nes->registers.X);
    return 0;
 }
 
-int TAY(uint8_t val, uint16_t addr) {
-   registers.Y = registers.A;
-   registers.P.negative = MSB(registers.Y) ? 1 : 0;
-   registers.P.zero     = registers.Y == 0 ? 1 : 0;
+int TAY(nes_t *nes, uint8_t val, uint16_t addr) {
+   nes->registers.Y = nes->registers.A;
+   setNZ(nes, nes->registers.Y);
    return 0;
 }
 
-int TSX(uint8_t val, uint16_t addr) {
-   registers.X = registers.SP;
-   registers.P.negative = MSB(registers.X) ? 1 : 0;
-   registers.P.zero     = registers.X == 0 ? 1 : 0;
+int TSX(nes_t *nes, uint8_t val, uint16_t addr) {
+   nes->registers.X = nes->registers.SP;
+   setNZ(nes, nes->registers.X);
    return 0;
 }
 
-int TXA(uint8_t val, uint16_t addr) {
-   registers.A = registers.X;
-   registers.P.negative = MSB(registers.A) ? 1 : 0;
-   registers.P.zero     = registers.A == 0 ? 1 : 0;
+int TXA(nes_t *nes, uint8_t val, uint16_t addr) {
+   nes->registers.A = nes->registers.X;
+   setNZ(nes, nes->registers.A);
    return 0;
 }
 
-int TYA(uint8_t val, uint16_t addr) {
-   registers.A = registers.Y;
-   registers.P.negative = MSB(registers.A) ? 1 : 0;
-   registers.P.zero     = registers.A == 0 ? 1 : 0;
+int TYA(nes_t *nes, uint8_t val, uint16_t addr) {
+   nes->registers.A = nes->registers.Y;
+   setNZ(nes, nes->registers.A);
    return 0;
 }
 
-int TXS(uint8_t val, uint16_t addr) {
-   registers.SP = registers.X;
+int TXS(nes_t *nes, uint8_t val, uint16_t addr) {
+   nes->registers.SP = nes->registers.X;
    return 0;
 }
 
-int BIT(uint8_t val, uint16_t addr) {
-   uint8_t t = registers.A & val;
-   registers.P.negative = MSB(val)  ? 1 : 0;
-   registers.P.overflow = MSB2(val) ? 1 : 0;
-   registers.P.zero     = t == 0    ? 1 : 0;
+int BIT(nes_t *nes, uint8_t val, uint16_t addr) {
+   uint8_t t = nes->registers.A & val;
+   setN(nes, val);
+   setV(nes, MSB2(val));
+   setZ(nes, t);
    return 0;
 }
 
-int NOP(uint8_t val, uint16_t addr) {
+int NOP(nes_t *nes, uint8_t val, uint16_t addr) {
    return 0;
 }
 
 // undocumented
 
-int AAC(uint8_t val, uint16_t addr) {
+int AAC(nes_t *nes, uint8_t val, uint16_t addr) {
    return 0;
 }
 
-int XAA(uint8_t val, uint16_t addr) {
+int XAA(nes_t *nes, uint8_t val, uint16_t addr) {
    return 0;
 }
 
-int AAX(uint8_t val, uint16_t addr) {
-   val = registers.A & registers.X;
-   // registers.P.negative = MSB(val) ? 1 : 0;
-   // registers.P.zero     = val == 0 ? 1 : 0;
-   store(addr, val);
+int AAX(nes_t *nes, uint8_t val, uint16_t addr) {
+   val = nes->registers.A & nes->registers.X;
+   // nes->registers.P.negative = MSB(val) ? 1 : 0;
+   // nes->registers.P.zero     = val == 0 ? 1 : 0;
+   store(nes, addr, val);
    return 0;
 }
 
-int AAX_ZPY(uint8_t val, uint16_t addr) {
+int AAX_ZPY(nes_t *nes, uint8_t val, uint16_t addr) {
    uint8_t pageBoundary = 0;
-   return AAX(ZPY(&pageBoundary, &addr), addr);
+   val = ZPY(nes, &pageBoundary, &addr);
+   return AAX(nes, val, addr);
 }
 
-int LAX(uint8_t val, uint16_t addr) {
-   registers.A = val;
-   registers.X = val;
-   registers.P.negative = MSB(registers.X) ? 1 : 0;
-   registers.P.zero     = registers.X == 0 ? 1 : 0;
+int LAX(nes_t *nes, uint8_t val, uint16_t addr) {
+   nes->registers.A = val;
+   nes->registers.X = val;
+   setNZ(nes, nes->registers.X);
    return 0;
 }
 
-int LAX_ZPY(uint8_t val, uint16_t addr) {
+int LAX_ZPY(nes_t *nes, uint8_t val, uint16_t addr) {
    uint8_t pageBoundary = 0;
-   return LAX(ZPY(&pageBoundary, &addr), addr);
+   val = ZPY(nes, &pageBoundary, &addr);
+   return LAX(nes, val, addr);
 }
 
-int ARR(uint8_t val, uint16_t addr) {
+int ARR(nes_t *nes, uint8_t val, uint16_t addr) {
    return 0;
 }
 
-int ASR(uint8_t val, uint16_t addr) {
+int ASR(nes_t *nes, uint8_t val, uint16_t addr) {
    return 0;
 }
 
-int ATX(uint8_t val, uint16_t addr) {
+int ATX(nes_t *nes, uint8_t val, uint16_t addr) {
    return 0;
 }
 
-int AXS(uint8_t val, uint16_t addr) {
+int AXS(nes_t *nes, uint8_t val, uint16_t addr) {
    return 0;
 }
 
-int AXA(uint8_t val, uint16_t addr) {
+int AXA(nes_t *nes, uint8_t val, uint16_t addr) {
    return 0;
 }
 
-int SXA(uint8_t val, uint16_t addr) {
+int SXA(nes_t *nes, uint8_t val, uint16_t addr) {
    return 0;
 }
 
-int SYA(uint8_t val, uint16_t addr) {
+int SYA(nes_t *nes, uint8_t val, uint16_t addr) {
    return 0;
 }
 
-int DCP(uint8_t val, uint16_t addr) {
-   DEC(val, addr);
-   CMP(fetch(addr), addr);
+int DCP(nes_t *nes, uint8_t val, uint16_t addr) {
+   DEC(nes, val, addr);
+   CMP(nes, fetch(nes, addr), addr);
    return 0;
 }
 
-int ISC(uint8_t val, uint16_t addr) {
-   INC(val, addr);
-   SBC(fetch(addr), addr);
+int ISC(nes_t *nes, uint8_t val, uint16_t addr) {
+   INC(nes, val, addr);
+   SBC(nes, fetch(nes, addr), addr);
    return 0;
 }
 
-int RLA(uint8_t val, uint16_t addr) {
-   ROL(val, addr);
-   AND(fetch(addr), addr);
+int RLA(nes_t *nes, uint8_t val, uint16_t addr) {
+   ROL(nes, val, addr);
+   AND(nes, fetch(nes, addr), addr);
    return 0;
 }
 
-int RRA(uint8_t val, uint16_t addr) {
-   ROR(val, addr);
-   ADC(fetch(addr), addr);
+int RRA(nes_t *nes, uint8_t val, uint16_t addr) {
+   ROR(nes, val, addr);
+   ADC(nes, fetch(nes, addr), addr);
    return 0;
 }
 
-int SLO(uint8_t val, uint16_t addr) {
-   ASL(val, addr);
-   ORA(fetch(addr), addr);
+int SLO(nes_t *nes, uint8_t val, uint16_t addr) {
+   ASL(nes, val, addr);
+   ORA(nes, fetch(nes, addr), addr);
    return 0;
 }
 
-int SRE(uint8_t val, uint16_t addr) {
-   registers.P.carry = val & 0x01 ? 1 : 0;
+int SRE(nes_t *nes, uint8_t val, uint16_t addr) {
+   setC(nes, val & 0x01);
 
    val = (val >> 1) & 0x7F;
 
-   registers.P.negative = MSB(val) ? 1 : 0;
-   registers.P.zero     = val == 0 ? 1 : 0;
+   setNZ(nes, val);
 
-   store(addr, val);
-   EOR(fetch(addr), addr);
+   store(nes, addr, val);
+   EOR(nes, fetch(nes, addr), addr);
    return 0;
 }
 
-int LAR(uint8_t val, uint16_t addr) {
+int LAR(nes_t *nes, uint8_t val, uint16_t addr) {
    return 0;
 }
 
-int XAS(uint8_t val, uint16_t addr) {
+int XAS(nes_t *nes, uint8_t val, uint16_t addr) {
    return 0;
 }
 
-int DOP(uint8_t val, uint16_t addr) {
+int DOP(nes_t *nes, uint8_t val, uint16_t addr) {
    return 0;
 }
 
-int TOP(uint8_t val, uint16_t addr) {
+int TOP(nes_t *nes, uint8_t val, uint16_t addr) {
    return 0;
 }
 
-int KIL(uint8_t val, uint16_t addr) {
-   exit(0);
+// Jams the CPU on the KIL until the next initCPU(), the run loops stop here
+int KIL(nes_t *nes, uint8_t val, uint16_t addr) {
+   nes->registers.PC--;
+   nes->halted = 1;
+   return 0;
 }
@@ -1,10 +1,91 @@
 #ifndef CPU_H
 #define CPU_H
 
-void initCPU();
+#include <inttypes.h>
 
-void cleanCPU();
+// NTSC: 341 dots x 262 scanlines, 3 dots per CPU cycle
+#define PPU_DOTS_PER_FRAME 89342
 
-int step();
+// Console state, see nes.h
+typedef struct nes_s nes_t;
+
+// Returns nonzero to stop runUntil() before the next instruction
+typedef int (*stopCondition_t)(void *arg);
+
+// Addressing modes in InstructionTable column order, plus the zero page,Y
+// opcodes that sit in the Impl column
+enum {
+   MODE_IMPL, MODE_IMM, MODE_ZP, MODE_ZPX, MODE_ABS,
+   MODE_ABSX, MODE_ABSY, MODE_INDX, MODE_INDY, MODE_ZPY
+};
+
+// IRQ sources, the line stays low while any of them holds it
+enum {
+   IRQ_APU_FRAME = 0x1,
+   IRQ_MAPPER    = 0x2,
+   IRQ_DMC       = 0x4
+};
+
+// Power on state of the registers and the cycle count
+void initCPU(nes_t *nes);
+
+void cleanCPU(nes_t *nes);
+
+int step(nes_t *nes);
+
+int run(nes_t *nes, int count);
+
+uint64_t runCycles(nes_t *nes, uint64_t cycles);
+
+uint64_t runFrame(nes_t *nes);
+
+uint64_t runUntil(nes_t *nes, stopCondition_t stop, void *arg, uint64_t maxCycles);
+
+uint64_t cpuCycles(nes_t *nes);
+
+uint64_t cpuFrame(nes_t *nes);
+
+// The cycle a register access by the running instruction lands on. The
+// core only counts whole instructions, so it's taken to be the last cycle
+// without a page crossing, which is where loads and stores touch the bus.
+uint64_t busCycle(nes_t *nes);
+
+// Instructions run since initCPU(), a JIT block counts all of its
+// instructions
+uint64_t cpuInstructions(nes_t *nes);
+
+// Nonzero once a KIL opcode has jammed the CPU, nothing runs after that
+int cpuHalted(nes_t *nes);
+
+// nestest's automation entry point. Started here instead of at its reset
+// vector it runs every test without a screen and ends on a KIL, which is
+// what nestest.log records.
+#define NESTEST_AUTOMATION 0xC000
+
+// Jumps to pc without running anything, to start a ROM somewhere other
+// than its reset vector
+void setPC(nes_t *nes, uint16_t pc);
+
+// NMI is edge triggered, it's taken once at the next instruction boundary
+void raiseNMI(nes_t *nes);
+
+// IRQ is level triggered, taken at every instruction boundary with I clear
+// until the source lets go
+void setIRQ(nes_t *nes, int source, int level);
+
+// DMA holds the CPU off the bus for cycles more CPU cycles, charged to the
+// cycle count at the next instruction boundary before any event fires
+void stallCPU(nes_t *nes, int cycles);
+
+// P as PHP would push it, with LAZY_FLAGS the flags are rebuilt first
+uint8_t registerFlags(nes_t *nes);
+
+const char *dispatchName();
+
+const char *opcodeName(uint8_t opcode);
+
+// Addressing mode, base cycles and page crossing cycles the interpreter
+// uses for opcode
+void opcodeInfo(uint8_t opcode, int *mode, int *cycles, int *extraCycles);
 
 #endif
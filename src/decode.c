@@ -0,0 +1,86 @@
+#include <string.h>
+
+#include "decode.h"
+#include "memory.h"
+#include "nes.h"
+
+#ifdef DECODE_CACHE
+
+// Longest instruction, a store can hit the last byte of one starting this
+// far back
+#define MAX_LENGTH 3
+
+static void watchPage(nes_t *nes, uint16_t addr) {
+   if (!writePointer(nes, addr)) {
+      return;
+   }
+   if (addr < 0x2000) {
+      for (int mirror = 0; mirror < 0x2000; mirror += 0x800) {
+         nes->decode->pages[((addr & 0x7FF) + mirror) >> 8] = 1;
+      }
+   } else {
+      nes->decode->pages[addr >> 8] = 1;
+   }
+}
+
+void decodeFill(nes_t *nes, uint16_t pc, const decoded_t *entry) {
+   decode_t *decode = nes->decode;
+
+   decode->entries[pc] = *entry;
+
+   for (int i = 0; i < entry->length; i++) {
+      watchPage(nes, pc + i);
+   }
+
+   if (decode->numFilled < (int)(sizeof(decode->filled) / sizeof(decode->filled[0]))) {
+      decode->filled[decode->numFilled++] = pc;
+   } else {
+      decode->overflowed = 1;
+   }
+}
+
+void decodeFlush(nes_t *nes) {
+   decode_t *decode = nes->decode;
+
+   if (decode->overflowed) {
+      memset(decode->entries, 0, sizeof(decode->entries));
+   } else {
+      for (int i = 0; i < decode->numFilled; i++) {
+         decode->entries[decode->filled[i]].execute = NULL;
+      }
+   }
+   memset(decode->pages, 0, sizeof(decode->pages));
+   decode->numFilled  = 0;
+   decode->overflowed = 0;
+}
+
+void decodeInvalidate(nes_t *nes, uint16_t addr) {
+   decoded_t *entries = nes->decode->entries;
+
+   if (addr < 0x2000) {
+      for (int mirror = 0; mirror < 0x2000; mirror += 0x800) {
+         uint16_t ramAddr = (addr & 0x7FF) + mirror;
+
+         for (int back = 0; back < MAX_LENGTH; back++) {
+            entries[(uint16_t)(ramAddr - back)].execute = NULL;
+         }
+      }
+   } else {
+      for (int back = 0; back < MAX_LENGTH; back++) {
+         entries[(uint16_t)(addr - back)].execute = NULL;
+      }
+   }
+}
+
+void decodeInvalidateRange(nes_t *nes, uint16_t addr, int size) {
+   decoded_t *entries = nes->decode->entries;
+
+   for (int back = 1; back < MAX_LENGTH; back++) {
+      entries[(uint16_t)(addr - back)].execute = NULL;
+   }
+   for (int pc = addr; pc < addr + size; pc++) {
+      entries[pc].execute = NULL;
+   }
+}
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef DECODE_H
+#define DECODE_H
+
+#include <inttypes.h>
+
+// Console state, see nes.h
+typedef struct nes_s nes_t;
+
+// One pre-decoded instruction, 16 bytes. execute is NULL for a PC nothing
+// has been decoded at yet.
+typedef struct {
+   int (*execute)(nes_t *, uint8_t, uint16_t);
+   uint16_t operand; // operand bytes, little endian
+   uint8_t  opcode;
+   uint8_t  mode;
+   uint8_t  cycles;
+   uint8_t  length;
+   uint8_t  extraCycles; // on a page crossing
+   uint8_t  writeOnly;   // a store that never reads its operand
+} decoded_t;
+
+// A console's cache, allocated by createNES() in DECODE_CACHE builds
+typedef struct {
+   // Indexed by PC. Entries from ROM stay until a bank switch drops them,
+   // entries from RAM/SRAM until a store to one of their bytes.
+   decoded_t entries[0x10000];
+
+   // Nonzero for pages of RAM/SRAM with decoded instructions, store() calls
+   // decodeInvalidate() for writes to them
+   uint8_t pages[256];
+
+   uint64_t hits;
+   uint64_t misses;
+
+   // PCs filled since the last flush, so a flush doesn't clear the whole 1MB
+   // array. Refills after an invalidation can repeat a PC, past the end of
+   // the list everything is cleared instead.
+   uint16_t filled[0x10000];
+   int numFilled;
+   int overflowed;
+} decode_t;
+
+// Fills the entry for pc and notes it for the next decodeFlush()
+void decodeFill(nes_t *nes, uint16_t pc, const decoded_t *entry);
+
+void decodeFlush(nes_t *nes);
+
+// Drops every instruction that has a byte at addr, in every RAM mirror
+void decodeInvalidate(nes_t *nes, uint16_t addr);
+
+void decodeInvalidateRange(nes_t *nes, uint16_t addr, int size);
+
+#endif
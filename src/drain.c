@@ -0,0 +1,26 @@
+#include <chrono>
+#include <thread>
+
+#include "drain.h"
+
+void drainRing(const drain_t *drain) {
+   while (1) {
+      uint64_t end   = drain->head->load(std::memory_order_acquire);
+      uint64_t start = drain->tail->load(std::memory_order_relaxed);
+
+      if (start == end) {
+         if (!drain->running->load(std::memory_order_acquire)) {
+            // The producer may have published between the two loads of
+            // head, only an empty ring after running is cleared is the end
+            if (drain->head->load(std::memory_order_acquire) == start) {
+               return;
+            }
+            continue;
+         }
+         std::this_thread::sleep_for(std::chrono::milliseconds(1));
+         continue;
+      }
+
+      drain->tail->store(drain->write(drain->arg, start, end), std::memory_order_release);
+   }
+}
@@ -0,0 +1,28 @@
+#ifndef DRAIN_H
+#define DRAIN_H
+
+#include <inttypes.h>
+
+#include <atomic>
+
+// Consumer side of a single-producer ring drained to disk by its own
+// thread, shared by the trace flusher and the capture writer. The producer
+// bumps head after filling an entry, the consumer bumps tail after writing
+// one.
+typedef struct {
+   std::atomic<uint64_t> *head;
+   std::atomic<uint64_t> *tail;
+   std::atomic<bool>     *running;
+
+   // Writes entries start up to end, may stop short, returns the entry it
+   // got up to
+   uint64_t (*write)(void *arg, uint64_t start, uint64_t end);
+   void *arg;
+} drain_t;
+
+// Writes entries as they're published, sleeping a millisecond whenever
+// the ring is empty so the producer never has to wake it. Returns once
+// running is cleared and everything published before that is written.
+void drainRing(const drain_t *drain);
+
+#endif
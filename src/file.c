@@ -0,0 +1,28 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "file.h"
+
+void loadFile(const char *fileName, void **contents, int *fileSize) {
+   FILE *fp = NULL;
+
+   if ((fp = fopen(fileName, "rb"))) {
+      fseek(fp, 0, SEEK_END);
+      *fileSize = ftell(fp);
+      fseek(fp, 0, SEEK_SET);
+
+      if ((*contents = malloc(*fileSize))) {
+         if (fread(*contents, 1, *fileSize, fp) != (size_t)*fileSize) {
+            fprintf(stderr, "File read error\n");
+            exit(1);
+         }
+         fclose(fp);
+      } else {
+         fprintf(stderr, "Could not allocate memory\n");
+         exit(1);
+      }
+   } else {
+      fprintf(stderr, "Could not load file %s\n", fileName);
+      exit(1);
+   }
+}
@@ -0,0 +1,6 @@
+#ifndef FILE_H
+#define FILE_H
+
+void loadFile(const char *fileName, void **contents, int *fileSize);
+
+#endif
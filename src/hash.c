@@ -0,0 +1,24 @@
+#include "hash.h"
+
+uint64_t hashBytes(uint64_t hash, const void *bytes, size_t size) {
+   const uint8_t *p = (const uint8_t *)bytes;
+
+   for (size_t i = 0; i < size; i++) {
+      hash = (hash ^ p[i]) * FNV_PRIME;
+   }
+   return hash;
+}
+
+uint64_t hashFrame(nes_t *nes) {
+   uint64_t hash = hashBytes(FNV_OFFSET, nes->ppu.framebuffer, sizeof(nes->ppu.framebuffer));
+
+   return hashBytes(hash, nes->ppu.lineMask, sizeof(nes->ppu.lineMask));
+}
+
+uint64_t hashAudio(nes_t *nes) {
+   return hashBytes(FNV_OFFSET, nes->apu.samples, nes->apu.sampleCount * sizeof(nes->apu.samples[0]));
+}
+
+uint64_t hashMemory(nes_t *nes) {
+   return hashBytes(hashBytes(FNV_OFFSET, nes->ram, sizeof(nes->ram)), nes->sram, sizeof(nes->sram));
+}
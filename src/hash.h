@@ -0,0 +1,25 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include "nes.h"
+
+// 64-bit FNV-1a, for telling runs apart and catching desyncs, not security
+#define FNV_OFFSET 0xCBF29CE484222325ULL
+#define FNV_PRIME  0x100000001B3ULL
+
+// Hashes more bytes onto hash, start with FNV_OFFSET
+uint64_t hashBytes(uint64_t hash, const void *bytes, size_t size);
+
+// The picture the PPU drew, with the mask each line was drawn under
+uint64_t hashFrame(nes_t *nes);
+
+// The last frame's samples
+uint64_t hashAudio(nes_t *nes);
+
+// RAM and SRAM
+uint64_t hashMemory(nes_t *nes);
+
+#endif
@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+
+#include "capture.h"
+#include "cpu.h"
+#include "file.h"
+#include "hash.h"
+#include "movie.h"
+#include "nes.h"
+
+// Headless front end for machines without a display: no SDL, no stdin. It
+// runs a ROM for a number of frames as fast as the core goes, optionally
+// playing a movie, and writes one line per frame with the hashes of the
+// picture, the audio and RAM, to compare runs against each other. It can
+// also capture every frame and its audio to disk, see capture.h.
+
+int main(int argc, char *argv[]) {
+   const char *movieName = NULL, *hashName = NULL, *captureName = NULL;
+   int outputs = OUTPUT_VIDEO | OUTPUT_AUDIO;
+   int format = CAPTURE_RAW;
+
+   if (argc < 3) {
+      fprintf(stderr, "Usage: %s rom.nes frames [-movie movie.fm2] [-hashes file|-] [-novideo] [-noaudio] [-capture base [-format raw|y4m]]\n", argv[0]);
+      fprintf(stderr, "  -hashes writes 'frame video audio ram' for every frame, - for stdout\n");
+      fprintf(stderr, "  -novideo and -noaudio stop drawing and making samples, their hashes stay fixed\n");
+      fprintf(stderr, "  -capture writes every frame and its audio to base.cap, or base.y4m and base.wav\n");
+      return 1;
+   }
+   for (int i = 3; i < argc; i++) {
+      if (!strcmp(argv[i], "-movie") && i + 1 < argc) {
+         movieName = argv[++i];
+      } else if (!strcmp(argv[i], "-hashes") && i + 1 < argc) {
+         hashName = argv[++i];
+      } else if (!strcmp(argv[i], "-capture") && i + 1 < argc) {
+         captureName = argv[++i];
+      } else if (!strcmp(argv[i], "-format") && i + 1 < argc) {
+         if ((format = findCaptureFormat(argv[++i])) < 0) {
+            fprintf(stderr, "Unknown capture format %s\n", argv[i]);
+            return 1;
+         }
+      } else if (!strcmp(argv[i], "-novideo")) {
+         outputs &= ~OUTPUT_VIDEO;
+      } else if (!strcmp(argv[i], "-noaudio")) {
+         outputs &= ~OUTPUT_AUDIO;
+      } else {
+         fprintf(stderr, "Unknown option %s\n", argv[i]);
+         return 1;
+      }
+   }
+
+   int frames = atoi(argv[2]);
+   movie_t movie = {NULL, 0};
+
+   if (movieName && !loadMovie(movieName, &movie)) {
+      return 1;
+   }
+
+   FILE *hashes = NULL;
+
+   if (hashName) {
+      hashes = strcmp(hashName, "-") ? fopen(hashName, "w") : stdout;
+      if (!hashes) {
+         fprintf(stderr, "Could not open %s\n", hashName);
+         return 1;
+      }
+   }
+
+   capture_t *capture = NULL;
+
+   if (captureName && !(capture = createCapture(captureName, format))) {
+      return 1;
+   }
+
+   void *rom = NULL;
+   int fileSize = 0;
+
+   loadFile(argv[1], &rom, &fileSize);
+
+   nes_t *nes = createNES(rom, fileSize);
+
+   free(rom);
+   setOutputs(nes, outputs);
+
+   auto start = std::chrono::steady_clock::now();
+   int frame;
+
+   for (frame = 0; frame < frames && !cpuHalted(nes); frame++) {
+      setButtons(nes, 0, movieButtons(&movie, 0, frame));
+      setButtons(nes, 1, movieButtons(&movie, 1, frame));
+      runFrame(nes);
+
+      if (capture) {
+         captureFrame(capture, nes);
+      }
+      if (hashes) {
+         fprintf(hashes, "%d %016" PRIx64 " %016" PRIx64 " %016" PRIx64 "\n",
+            frame, hashFrame(nes), hashAudio(nes), hashMemory(nes));
+      }
+   }
+
+   double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+   fprintf(stderr, "%d frames, %" PRIu64 " cycles, %.3f s, %.1f frames/s%s%s\n", frame, cpuCycles(nes), seconds,
+      seconds > 0 ? frame / seconds : 0, (outputs & OUTPUT_VIDEO) ? "" : ", no video", (outputs & OUTPUT_AUDIO) ? "" : ", no audio");
+
+   if (capture) {
+      uint64_t captured = capturedFrames(capture), dropped = droppedCaptureFrames(capture);
+
+      if (!destroyCapture(capture)) {
+         fprintf(stderr, "Capture write error\n");
+      }
+      fprintf(stderr, "Captured %" PRIu64 " of %" PRIu64 " frames as %s, %" PRIu64 " dropped\n",
+         captured - dropped, captured, captureFormatName(format), dropped);
+   }
+   if (hashes && hashes != stdout) {
+      fclose(hashes);
+   }
+   freeMovie(&movie);
+   destroyNES(nes);
+
+   return 0;
+}
@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <thread>
+#include <vector>
+
+#include "cpu.h"
+#include "file.h"
+#include "memory.h"
+#include "nes.h"
+
+// Runs a ROM on one console on the main thread, then on many consoles at
+// once, one thread each, and checks every one of them produced the same
+// instruction trace, RAM and cycle count. Any state left shared between
+// consoles shows up as a mismatch.
+
+#define DEFAULT_CONSOLES 8
+
+// nestest stops on a KIL after ~9200 instructions, this is only a backstop
+#define MAX_STEPS 1000000
+
+typedef struct {
+   uint64_t cycles;
+   uint16_t PC;
+   uint8_t  A;
+   uint8_t  X;
+   uint8_t  Y;
+   uint8_t  P;
+   uint8_t  SP;
+   uint8_t  opcode;
+} state_t;
+
+typedef struct {
+   std::vector<state_t> trace;
+   uint8_t  ram[0x800];
+   uint64_t cycles;
+   int      halted;
+} result_t;
+
+static void runConsole(void *rom, int fileSize, result_t *result) {
+   nes_t *nes = createNES(rom, fileSize);
+
+   setPC(nes, NESTEST_AUTOMATION);
+   for (int i = 0; i < MAX_STEPS && !cpuHalted(nes); i++) {
+      state_t state = {
+         cpuCycles(nes), nes->registers.PC,
+         nes->registers.A, nes->registers.X, nes->registers.Y,
+         registerFlags(nes), nes->registers.SP, fetch(nes, nes->registers.PC)
+      };
+
+      result->trace.push_back(state);
+      step(nes);
+   }
+
+   memcpy(result->ram, nes->ram, sizeof(result->ram));
+   result->cycles = cpuCycles(nes);
+   result->halted = cpuHalted(nes);
+   destroyNES(nes);
+}
+
+// Index of the first differing instruction, -1 if the traces match
+static long firstMismatch(const result_t *a, const result_t *b) {
+   size_t length = a->trace.size() < b->trace.size() ? a->trace.size() : b->trace.size();
+
+   for (size_t i = 0; i < length; i++) {
+      if (memcmp(&a->trace[i], &b->trace[i], sizeof(state_t))) {
+         return i;
+      }
+   }
+   return a->trace.size() == b->trace.size() ? -1 : (long)length;
+}
+
+int main(int argc, char *argv[]) {
+   if (argc < 2) {
+      fprintf(stderr, "Usage: %s rom.nes [consoles]\n", argv[0]);
+      return 1;
+   }
+
+   int consoles = argc > 2 ? atoi(argv[2]) : DEFAULT_CONSOLES;
+   void *rom = NULL;
+   int fileSize = 0;
+
+   if (consoles < 1) {
+      fprintf(stderr, "Need at least one console\n");
+      return 1;
+   }
+
+   loadFile(argv[1], &rom, &fileSize);
+
+   result_t reference;
+   std::vector<result_t> results(consoles);
+   std::vector<std::thread> threads;
+
+   runConsole(rom, fileSize, &reference);
+
+   for (int i = 0; i < consoles; i++) {
+      threads.push_back(std::thread(runConsole, rom, fileSize, &results[i]));
+   }
+   for (int i = 0; i < consoles; i++) {
+      threads[i].join();
+   }
+
+   int failed = 0;
+
+   for (int i = 0; i < consoles; i++) {
+      long mismatch = firstMismatch(&reference, &results[i]);
+
+      if (mismatch >= 0) {
+         fprintf(stderr, "Console %d: trace differs at instruction %ld\n", i, mismatch);
+         failed++;
+      } else if (memcmp(reference.ram, results[i].ram, sizeof(reference.ram))) {
+         fprintf(stderr, "Console %d: RAM differs\n", i);
+         failed++;
+      } else if (reference.cycles != results[i].cycles || reference.halted != results[i].halted) {
+         fprintf(stderr, "Console %d: stopped at cycle %" PRIu64 ", expected %" PRIu64 "\n",
+            i, results[i].cycles, reference.cycles);
+         failed++;
+      }
+   }
+
+   free(rom);
+
+   printf("%s: %d consoles on %d threads, %zu instructions, %" PRIu64 " cycles each, %d mismatched\n",
+      dispatchName(), consoles, consoles, reference.trace.size(), reference.cycles, failed);
+
+   return failed ? 1 : 0;
+}
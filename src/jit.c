@@ -0,0 +1,1216 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpu.h"
+#include "jit.h"
+#include "memory.h"
+#include "nes.h"
+#include "trace.h"
+
+#ifdef JIT
+
+#ifndef __x86_64__
+#error "The JIT only emits x86-64 code"
+#endif
+
+#include <sys/mman.h>
+
+// Compiles straight runs of 6502 code into x86-64. A block ends at the first
+// branch, jump, return or instruction the interpreter has to run, and runs
+// whole, so the CPU loop only enters one when nothing needs to stop inside it.
+
+#define CODE_SIZE (16 << 20)
+#define MAX_BLOCKS 0x8000
+#define MAX_BLOCK_INSTRUCTIONS 32
+#define MAX_BLOCK_BYTES (MAX_BLOCK_INSTRUCTIONS * 3)
+#define MAX_EXITS (MAX_BLOCK_INSTRUCTIONS * 3)
+
+// Times the interpreter runs from a PC before it gets a block, so code that
+// only runs once never pays for compiling
+#define HOT_THRESHOLD 64
+
+// Upper bound on the host code for one block, checked before compiling
+#define MAX_BLOCK_CODE (MAX_BLOCK_INSTRUCTIONS * 256)
+
+enum {
+   RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+   R8, R9, R10, R11, R12, R13, R14, R15
+};
+
+// The 6502 registers live in callee saved host registers, so calls out to
+// fetch()/store() don't spill them. RAX holds results and host pointers, RCX
+// zero page and stack offsets, RDX operands, RSI/RDI are scratch.
+#define REG_STATE RBX
+#define REG_A     RBP
+#define REG_X     R12
+#define REG_Y     R13
+#define REG_P     R14
+#define REG_SP    R15
+
+#define FLAG_C 0x01
+#define FLAG_Z 0x02
+#define FLAG_I 0x04
+#define FLAG_D 0x08
+#define FLAG_B 0x10
+#define FLAG_V 0x40
+#define FLAG_N 0x80
+
+enum { ALU_ADD = 0, ALU_OR = 1, ALU_AND = 4, ALU_SUB = 5, ALU_XOR = 6 };
+enum { SHIFT_SHL = 4, SHIFT_SHR = 5 };
+enum { CC_Z = 0x4, CC_NZ = 0x5 };
+
+#define STATE(field) ((int32_t)offsetof(jitState_t, field))
+
+enum {
+   OP_INTERPRET, OP_CONTROL,
+   OP_LDA, OP_LDX, OP_LDY, OP_STA, OP_STX, OP_STY,
+   OP_ADC, OP_SBC, OP_AND, OP_ORA, OP_EOR, OP_CMP, OP_CPX, OP_CPY, OP_BIT,
+   OP_INC, OP_DEC, OP_ASL, OP_LSR, OP_ROL, OP_ROR,
+   OP_INX, OP_INY, OP_DEX, OP_DEY,
+   OP_TAX, OP_TAY, OP_TXA, OP_TYA, OP_TSX, OP_TXS,
+   OP_CLC, OP_SEC, OP_SEI, OP_CLD, OP_SED, OP_CLV, OP_NOP,
+   OP_PHA, OP_PHP, OP_PLA,
+   OP_BRANCH, OP_JMP, OP_JSR, OP_RTS,
+   NUM_OPS
+};
+
+// Indexed by OP_*, matched against opcodeName() to sort the opcodes. CLI
+// and PLP are left to the interpreter, which lets a held IRQ in.
+static const char *const OpNames[NUM_OPS] = {
+   "", "",
+   "LDA", "LDX", "LDY", "STA", "STX", "STY",
+   "ADC", "SBC", "AND", "ORA", "EOR", "CMP", "CPX", "CPY", "BIT",
+   "INC", "DEC", "ASL", "LSR", "ROL", "ROR",
+   "INX", "INY", "DEX", "DEY",
+   "TAX", "TAY", "TXA", "TYA", "TSX", "TXS",
+   "CLC", "SEC", "SEI", "CLD", "SED", "CLV", "NOP",
+   "PHA", "PHP", "PLA",
+   "", "JMP", "JSR", "RTS"
+};
+
+// Branch opcodes are ffc10000: ff picks the flag, c the value that branches
+static const uint8_t BranchFlags[4] = {FLAG_N, FLAG_V, FLAG_C, FLAG_Z};
+
+// Shared by every console, built once by the first initJIT()
+static uint8_t opKind[256];
+static uint8_t opMode[256];
+static uint8_t opCycles[256];
+static uint8_t opExtraCycles[256];
+
+struct jit_s {
+   uint8_t *codeBuffer;
+   uint8_t *top;            // where the next block goes
+   jitBlock_t *blockMap[0x10000];
+   uint8_t hits[0x10000];
+   jitBlock_t blockPool[MAX_BLOCKS];
+   int blocksUsed;
+
+   // Trace flags the cached blocks were compiled for
+   int compiledTrace;
+
+   uint64_t compiledBlocks;
+   uint64_t fallbacks;
+};
+
+// Per block compile state. Consoles on different threads compile at the
+// same time, so each thread has its own.
+static thread_local nes_t *compiling;
+static thread_local uint8_t *out;
+static thread_local uint8_t *ram;
+static thread_local int blockStart;
+static thread_local int pendingCycles;
+static thread_local uint8_t *exits[MAX_EXITS];
+static thread_local int numExits;
+
+static void emit8(uint8_t b) {
+   *out++ = b;
+}
+
+static void emit32(uint32_t v) {
+   memcpy(out, &v, 4);
+   out += 4;
+}
+
+static void emit64(uint64_t v) {
+   memcpy(out, &v, 8);
+   out += 8;
+}
+
+// Left out when it adds nothing, except byte stores always take one so
+// registers 4-7 mean SPL-DIL rather than AH-BH
+static void rex(int w, int reg, int index, int base, int force) {
+   uint8_t prefix = 0x40 | (w << 3) | ((reg & 8) >> 1) | ((index & 8) >> 2) | ((base & 8) >> 3);
+
+   if (prefix != 0x40 || force) {
+      emit8(prefix);
+   }
+}
+
+static void modrmReg(int reg, int rm) {
+   emit8(0xC0 | (reg & 7) << 3 | (rm & 7));
+}
+
+// [base + disp32], base is never RSP or R12
+static void modrmMem(int reg, int base, int32_t disp) {
+   emit8(0x80 | (reg & 7) << 3 | (base & 7));
+   emit32(disp);
+}
+
+// [base + index + disp32]
+static void modrmIndex(int reg, int base, int index, int32_t disp) {
+   emit8(0x84 | (reg & 7) << 3);
+   emit8((index & 7) << 3 | (base & 7));
+   emit32(disp);
+}
+
+static void movImm(int reg, uint32_t imm) {
+   rex(0, 0, 0, reg, 0);
+   emit8(0xB8 + (reg & 7));
+   emit32(imm);
+}
+
+static void movImm64(int reg, uint64_t imm) {
+   rex(1, 0, 0, reg, 0);
+   emit8(0xB8 + (reg & 7));
+   emit64(imm);
+}
+
+static void movReg(int dst, int src) {
+   rex(0, src, 0, dst, 0);
+   emit8(0x89);
+   modrmReg(src, dst);
+}
+
+static void movReg64(int dst, int src) {
+   rex(1, src, 0, dst, 0);
+   emit8(0x89);
+   modrmReg(src, dst);
+}
+
+// movzx dst, src8 for RAX-RDX
+static void zeroExtend(int dst, int src) {
+   rex(0, dst, 0, src, 0);
+   emit8(0x0F);
+   emit8(0xB6);
+   modrmReg(dst, src);
+}
+
+// dst op= src, the 32 bit r/m,reg forms are op * 8 + 1
+static void alu(int op, int dst, int src) {
+   rex(0, src, 0, dst, 0);
+   emit8(op * 8 + 1);
+   modrmReg(src, dst);
+}
+
+static void aluImm(int op, int dst, int32_t imm) {
+   rex(0, 0, 0, dst, 0);
+   if (imm >= -128 && imm <= 127) {
+      emit8(0x83);
+      modrmReg(op, dst);
+      emit8(imm);
+   } else {
+      emit8(0x81);
+      modrmReg(op, dst);
+      emit32(imm);
+   }
+}
+
+static void shiftImm(int op, int reg, uint8_t n) {
+   rex(0, 0, 0, reg, 0);
+   emit8(0xC1);
+   modrmReg(op, reg);
+   emit8(n);
+}
+
+static void load8(int dst, int base, int32_t disp) {
+   rex(0, dst, 0, base, 0);
+   emit8(0x0F);
+   emit8(0xB6);
+   modrmMem(dst, base, disp);
+}
+
+static void load8Index(int dst, int base, int index, int32_t disp) {
+   rex(0, dst, index, base, 0);
+   emit8(0x0F);
+   emit8(0xB6);
+   modrmIndex(dst, base, index, disp);
+}
+
+static void store8(int src, int base, int32_t disp) {
+   rex(0, src, 0, base, 1);
+   emit8(0x88);
+   modrmMem(src, base, disp);
+}
+
+static void store8Index(int src, int base, int index, int32_t disp) {
+   rex(0, src, index, base, 1);
+   emit8(0x88);
+   modrmIndex(src, base, index, disp);
+}
+
+static void store16(int src, int base, int32_t disp) {
+   emit8(0x66);
+   rex(0, src, 0, base, 0);
+   emit8(0x89);
+   modrmMem(src, base, disp);
+}
+
+static void store16Imm(int base, int32_t disp, uint16_t imm) {
+   emit8(0x66);
+   rex(0, 0, 0, base, 0);
+   emit8(0xC7);
+   modrmMem(0, base, disp);
+   emit8(imm & 0xFF);
+   emit8(imm >> 8);
+}
+
+static void add64(int base, int32_t disp, int src) {
+   rex(1, src, 0, base, 0);
+   emit8(0x01);
+   modrmMem(src, base, disp);
+}
+
+static void add64Imm(int base, int32_t disp, int32_t imm) {
+   rex(1, 0, 0, base, 0);
+   emit8(0x81);
+   modrmMem(0, base, disp);
+   emit32(imm);
+}
+
+static void cmp8Imm(int base, int32_t disp, uint8_t imm) {
+   rex(0, 0, 0, base, 0);
+   emit8(0x80);
+   modrmMem(7, base, disp);
+   emit8(imm);
+}
+
+static void testImm(int reg, uint32_t imm) {
+   rex(0, 0, 0, reg, 0);
+   emit8(0xF7);
+   modrmReg(0, reg);
+   emit32(imm);
+}
+
+static void push(int reg) {
+   rex(0, 0, 0, reg, 0);
+   emit8(0x50 + (reg & 7));
+}
+
+static void pop(int reg) {
+   rex(0, 0, 0, reg, 0);
+   emit8(0x58 + (reg & 7));
+}
+
+// The code buffer can be anywhere, so calls go through RAX
+static void call(void *function) {
+   movImm64(RAX, (uint64_t)function);
+   emit8(0xFF);
+   emit8(0xD0);
+}
+
+// Calls out to functions taking the console first. A block only ever runs on
+// the console it was compiled for, so that goes in as a constant.
+static void callNES(void *function) {
+   movImm64(RDI, (uint64_t)compiling);
+   call(function);
+}
+
+// Forward jumps return where their rel32 goes for patch()
+static uint8_t *jmp() {
+   emit8(0xE9);
+   emit32(0);
+   return out - 4;
+}
+
+static uint8_t *jcc(int cc) {
+   emit8(0x0F);
+   emit8(0x80 | cc);
+   emit32(0);
+   return out - 4;
+}
+
+static void patch(uint8_t *rel, uint8_t *target) {
+   int32_t offset = target - (rel + 4);
+   memcpy(rel, &offset, 4);
+}
+
+#ifndef NO_TRACE
+static void jitTrace(nes_t *nes, uint8_t opcode) {
+   jitState_t *state = &nes->jitState;
+
+   TRACE_INSTRUCTION(nes, state->cycles, state->PC, opcode, state->A, state->X, state->Y, state->P, state->SP);
+}
+#endif
+
+// Indexed stores read their target first, as the interpreter's decode does.
+// (zp,X) stores don't, see writesOnly() in cpu.c.
+static void jitStore(nes_t *nes, uint16_t addr, uint8_t value) {
+   fetch(nes, addr);
+   store(nes, addr, value);
+}
+
+static void spill() {
+   store8(REG_A,  REG_STATE, STATE(A));
+   store8(REG_X,  REG_STATE, STATE(X));
+   store8(REG_Y,  REG_STATE, STATE(Y));
+   store8(REG_P,  REG_STATE, STATE(P));
+   store8(REG_SP, REG_STATE, STATE(SP));
+}
+
+static void reload() {
+   load8(REG_A,  REG_STATE, STATE(A));
+   load8(REG_X,  REG_STATE, STATE(X));
+   load8(REG_Y,  REG_STATE, STATE(Y));
+   load8(REG_P,  REG_STATE, STATE(P));
+   load8(REG_SP, REG_STATE, STATE(SP));
+}
+
+static void flushCycles() {
+   if (pendingCycles) {
+      add64Imm(REG_STATE, STATE(cycles), pendingCycles);
+      pendingCycles = 0;
+   }
+}
+
+// Leaves the block with PC already in the state. Cycles still pending are
+// added on this path only, the fall through keeps them.
+static void exitBlock() {
+   if (pendingCycles) {
+      add64Imm(REG_STATE, STATE(cycles), pendingCycles);
+   }
+   exits[numExits++] = jmp();
+}
+
+static void exitTo(uint16_t pc) {
+   store16Imm(REG_STATE, STATE(PC), pc);
+   exitBlock();
+}
+
+static void exitIfInvalidated(uint16_t next) {
+   cmp8Imm(REG_STATE, STATE(invalidated), 0);
+   uint8_t *valid = jcc(CC_Z);
+   exitTo(next);
+   patch(valid, out);
+}
+
+// N and Z of the byte in EAX
+static void setNZ() {
+   aluImm(ALU_AND, REG_P, ~(FLAG_N | FLAG_Z) & 0xFF);
+   load8Index(RSI, REG_STATE, RAX, STATE(nz));
+   alu(ALU_OR, REG_P, RSI);
+}
+
+// Carry out of the 9 bit result in EAX
+static void setCarry9() {
+   movReg(RSI, RAX);
+   shiftImm(SHIFT_SHR, RSI, 8);
+   aluImm(ALU_AND, RSI, FLAG_C);
+   aluImm(ALU_AND, REG_P, ~FLAG_C & 0xFF);
+   alu(ALU_OR, REG_P, RSI);
+}
+
+// Carry from bit 0 of reg, what LSR and ROR shift out
+static void setCarry0(int reg) {
+   movReg(RSI, reg);
+   aluImm(ALU_AND, RSI, FLAG_C);
+   aluImm(ALU_AND, REG_P, ~FLAG_C & 0xFF);
+   alu(ALU_OR, REG_P, RSI);
+}
+
+static int instructionLength(uint8_t opcode, int mode) {
+   switch (mode) {
+      case MODE_IMPL:
+         return opcode == 0x20 || opcode == 0x4C || opcode == 0x6C ? 3 : 1;
+      case MODE_ABS:
+      case MODE_ABSX:
+      case MODE_ABSY:
+         return 3;
+      default:
+         return 2;
+   }
+}
+
+// Blocks only ever hold code from directly mapped memory, read here
+// without going through the bus
+static int peek(int addr, uint8_t *value) {
+   uint8_t *host = addr < 0x10000 ? readPointer(compiling, addr) : NULL;
+
+   if (host) {
+      *value = *host;
+   }
+   return host != NULL;
+}
+
+// Stores to a page of RAM/SRAM holding code go through store(), which drops
+// the blocks on it
+static void watchPage(uint16_t addr) {
+   if (!writePointer(compiling, addr)) {
+      return;
+   }
+   if (addr < 0x2000) {
+      for (int mirror = 0; mirror < 0x2000; mirror += 0x800) {
+         compiling->jitState.codePages[((addr & 0x7FF) + mirror) >> 8] = 1;
+      }
+   } else {
+      compiling->jitState.codePages[addr >> 8] = 1;
+   }
+}
+
+// Zero page index wrapped into ECX
+static void zeroPageIndex(int reg, uint8_t base) {
+   movReg(RCX, reg);
+   aluImm(ALU_ADD, RCX, base);
+   aluImm(ALU_AND, RCX, 0xFF);
+}
+
+// Run time address for the indexed and indirect modes into ESI, where
+// fetch() and store() take it
+static void dynamicAddress(int mode, uint16_t operand) {
+   switch (mode) {
+      case MODE_ABSX:
+      case MODE_ABSY:
+         movReg(RSI, mode == MODE_ABSX ? REG_X : REG_Y);
+         aluImm(ALU_ADD, RSI, operand);
+         aluImm(ALU_AND, RSI, 0xFFFF);
+         break;
+      case MODE_INDX:
+         zeroPageIndex(REG_X, operand);
+         movImm64(RAX, (uint64_t)ram);
+         load8Index(RSI, RAX, RCX, 0);
+         aluImm(ALU_ADD, RCX, 1);
+         aluImm(ALU_AND, RCX, 0xFF);
+         load8Index(RCX, RAX, RCX, 0);
+         shiftImm(SHIFT_SHL, RCX, 8);
+         alu(ALU_OR, RSI, RCX);
+         break;
+      case MODE_INDY:
+         movImm64(RAX, (uint64_t)ram);
+         load8(RSI, RAX, operand);
+         load8(RCX, RAX, (operand + 1) & 0xFF);
+         shiftImm(SHIFT_SHL, RCX, 8);
+         alu(ALU_OR, RSI, RCX);
+         alu(ALU_ADD, RSI, REG_Y);
+         aluImm(ALU_AND, RSI, 0xFFFF);
+         break;
+   }
+}
+
+// A byte at a fixed address into EDX. RAM is read in place. ROM in the same
+// 16KB window as the block is folded, a bank switch there drops the block
+// anyway; other ROM goes through fetch(). Returns 0 for I/O, which the
+// interpreter handles.
+static int readStatic(uint16_t addr) {
+   uint8_t *host = readPointer(compiling, addr);
+
+   if (!host) {
+      return 0;
+   }
+
+   if (writePointer(compiling, addr)) {
+      movImm64(RAX, (uint64_t)host);
+      load8(RDX, RAX, 0);
+   } else if (addr >= 0x8000 && (addr & 0xC000) == (blockStart & 0xC000)) {
+      movImm(RDX, *host);
+   } else {
+      movImm(RSI, addr);
+      callNES((void *)fetch);
+      zeroExtend(RDX, RAX);
+   }
+   return 1;
+}
+
+// Adds the carry out of the low address byte, 0 or 1, to the cycle count.
+// Only the index is in a register, the base is the operand or in RAM.
+static void pageCrossCycle(int mode, uint16_t operand) {
+   switch (mode) {
+      case MODE_ABSX:
+      case MODE_ABSY:
+         movReg(RCX, mode == MODE_ABSX ? REG_X : REG_Y);
+         aluImm(ALU_ADD, RCX, operand & 0xFF);
+         break;
+      case MODE_INDY:
+         movImm64(RAX, (uint64_t)ram);
+         load8(RCX, RAX, operand);
+         alu(ALU_ADD, RCX, REG_Y);
+         break;
+      default:
+         return;
+   }
+   shiftImm(SHIFT_SHR, RCX, 8);
+   add64(REG_STATE, STATE(cycles), RCX);
+}
+
+// The operand of a read instruction into EDX, 0 if it has to be interpreted.
+// extraCycles is what a page crossing costs it.
+static int readOperand(int mode, uint16_t operand, int extraCycles) {
+   switch (mode) {
+      case MODE_IMM:
+         movImm(RDX, operand);
+         return 1;
+      case MODE_ZP:
+      case MODE_ABS:
+         return readStatic(operand);
+      case MODE_ZPX:
+      case MODE_ZPY:
+         zeroPageIndex(mode == MODE_ZPX ? REG_X : REG_Y, operand);
+         movImm64(RAX, (uint64_t)ram);
+         load8Index(RDX, RAX, RCX, 0);
+         return 1;
+      case MODE_ABSX:
+      case MODE_ABSY:
+      case MODE_INDX:
+      case MODE_INDY:
+         dynamicAddress(mode, operand);
+         if (extraCycles) {
+            pageCrossCycle(mode, operand);
+         }
+         callNES((void *)fetch);
+         zeroExtend(RDX, RAX);
+         return 1;
+   }
+   return 0;
+}
+
+// Stores val to host, plus ECX when indexed, where addr (+ ECX) is the bus
+// address. Leaves for next if the store dropped compiled code, unless next
+// is negative.
+static void storeRam(uint8_t *host, int indexed, uint16_t addr, int val, int next) {
+   cmp8Imm(REG_STATE, STATE(codePages) + (addr >> 8), 0);
+   uint8_t *watched = jcc(CC_NZ);
+
+   movImm64(RAX, (uint64_t)host);
+   if (indexed) {
+      store8Index(val, RAX, RCX, 0);
+   } else {
+      store8(val, RAX, 0);
+   }
+   uint8_t *done = jmp();
+
+   patch(watched, out);
+   movReg(RDX, val);
+   if (indexed) {
+      movReg(RSI, RCX);
+      aluImm(ALU_ADD, RSI, addr);
+   } else {
+      movImm(RSI, addr);
+   }
+   callNES((void *)store);
+   if (next >= 0) {
+      exitIfInvalidated(next);
+   }
+   patch(done, out);
+}
+
+// STA/STX/STY, 0 if it has to be interpreted
+static int writeOperand(int mode, uint16_t operand, int val, uint16_t next) {
+   uint8_t *host;
+
+   switch (mode) {
+      case MODE_ZP:
+      case MODE_ABS:
+         if (!(host = writePointer(compiling, operand))) {
+            return 0;
+         }
+         storeRam(host, 0, operand, val, next);
+         return 1;
+      case MODE_ZPX:
+      case MODE_ZPY:
+         zeroPageIndex(mode == MODE_ZPX ? REG_X : REG_Y, operand);
+         storeRam(ram, 1, 0, val, next);
+         return 1;
+      case MODE_ABSX:
+      case MODE_ABSY:
+      case MODE_INDX:
+      case MODE_INDY:
+         dynamicAddress(mode, operand);
+         movReg(RDX, val);
+         callNES(mode == MODE_INDX ? (void *)store : (void *)jitStore);
+         exitIfInvalidated(next);
+         return 1;
+   }
+   return 0;
+}
+
+static void pushByte(int val, int next) {
+   movReg(RCX, REG_SP);
+   storeRam(ram + 0x100, 1, 0x100, val, next);
+   aluImm(ALU_SUB, REG_SP, 1);
+   aluImm(ALU_AND, REG_SP, 0xFF);
+}
+
+// Into EDX
+static void popByte() {
+   aluImm(ALU_ADD, REG_SP, 1);
+   aluImm(ALU_AND, REG_SP, 0xFF);
+   movImm64(RAX, (uint64_t)(ram + 0x100));
+   load8Index(RDX, RAX, REG_SP, 0);
+}
+
+// ASL/LSR/ROL/ROR of EDX into EAX
+static void shift(int kind) {
+   movReg(RAX, RDX);
+   switch (kind) {
+      case OP_ASL:
+         shiftImm(SHIFT_SHL, RAX, 1);
+         setCarry9();
+         aluImm(ALU_AND, RAX, 0xFF);
+         break;
+      case OP_ROL:
+         shiftImm(SHIFT_SHL, RAX, 1);
+         movReg(RSI, REG_P);
+         aluImm(ALU_AND, RSI, FLAG_C);
+         alu(ALU_OR, RAX, RSI);
+         setCarry9();
+         aluImm(ALU_AND, RAX, 0xFF);
+         break;
+      case OP_LSR:
+         shiftImm(SHIFT_SHR, RAX, 1);
+         setCarry0(RDX);
+         break;
+      case OP_ROR:
+         shiftImm(SHIFT_SHR, RAX, 1);
+         movReg(RSI, REG_P);
+         aluImm(ALU_AND, RSI, FLAG_C);
+         shiftImm(SHIFT_SHL, RSI, 7);
+         alu(ALU_OR, RAX, RSI);
+         setCarry0(RDX);
+         break;
+   }
+   setNZ();
+}
+
+// reg - EDX, C set when there's no borrow
+static void compare(int reg) {
+   movReg(RAX, reg);
+   aluImm(ALU_ADD, RAX, 0x100);
+   alu(ALU_SUB, RAX, RDX);
+   setCarry9();
+   aluImm(ALU_AND, RAX, 0xFF);
+   setNZ();
+}
+
+static void addWithCarry() {
+   movReg(RAX, REG_A);
+   alu(ALU_ADD, RAX, RDX);
+   movReg(RSI, REG_P);
+   aluImm(ALU_AND, RSI, FLAG_C);
+   alu(ALU_ADD, RAX, RSI);
+
+   // V = bit 7 of (A ^ R) & (M ^ R)
+   movReg(RSI, REG_A);
+   alu(ALU_XOR, RSI, RAX);
+   movReg(RDI, RDX);
+   alu(ALU_XOR, RDI, RAX);
+   alu(ALU_AND, RSI, RDI);
+   shiftImm(SHIFT_SHR, RSI, 1);
+   aluImm(ALU_AND, RSI, FLAG_V);
+   aluImm(ALU_AND, REG_P, ~FLAG_V & 0xFF);
+   alu(ALU_OR, REG_P, RSI);
+
+   setCarry9();
+   aluImm(ALU_AND, RAX, 0xFF);
+   movReg(REG_A, RAX);
+   setNZ();
+}
+
+static void transfer(int dst, int src, int flags) {
+   movReg(dst, src);
+   if (flags) {
+      movReg(RAX, dst);
+      setNZ();
+   }
+}
+
+static void increment(int reg, int delta) {
+   aluImm(ALU_ADD, reg, delta);
+   aluImm(ALU_AND, reg, 0xFF);
+   movReg(RAX, reg);
+   setNZ();
+}
+
+// Read-modify-write on memory: RAM at a fixed address, or zero page,X
+static int modifyMemory(int kind, int mode, uint16_t operand, uint16_t next) {
+   uint8_t *host;
+
+   if (mode == MODE_ZPX && (kind == OP_INC || kind == OP_DEC)) {
+      zeroPageIndex(REG_X, operand);
+      movImm64(RAX, (uint64_t)ram);
+      load8Index(RDX, RAX, RCX, 0);
+      host = ram;
+   } else if (mode == MODE_ZP || mode == MODE_ABS) {
+      // The interpreter's shifts treat address 0 as the accumulator
+      if (operand == 0 && kind != OP_INC && kind != OP_DEC) {
+         return 0;
+      }
+      if (!(host = writePointer(compiling, operand)) || !readPointer(compiling, operand)) {
+         return 0;
+      }
+      movImm64(RAX, (uint64_t)host);
+      load8(RDX, RAX, 0);
+   } else {
+      return 0;
+   }
+
+   if (kind == OP_INC || kind == OP_DEC) {
+      movReg(RAX, RDX);
+      aluImm(ALU_ADD, RAX, kind == OP_INC ? 1 : -1);
+      aluImm(ALU_AND, RAX, 0xFF);
+      setNZ();
+   } else {
+      shift(kind);
+   }
+
+   movReg(RDX, RAX);
+   if (mode == MODE_ZPX) {
+      storeRam(ram, 1, 0, RDX, next);
+   } else {
+      storeRam(host, 0, operand, RDX, next);
+   }
+   return 1;
+}
+
+// Native code for one instruction. Returns 0 when it has to go to the
+// interpreter, nothing having been emitted.
+static int compileInstruction(uint8_t opcode, int kind, int mode, uint16_t operand, uint16_t next, int *ends) {
+   uint8_t *start = out;
+   int ok = 1;
+
+   switch (kind) {
+      case OP_LDA:
+      case OP_LDX:
+      case OP_LDY:
+         if ((ok = readOperand(mode, operand, opExtraCycles[opcode]))) {
+            transfer(kind == OP_LDA ? REG_A : kind == OP_LDX ? REG_X : REG_Y, RDX, 1);
+         }
+         break;
+      case OP_STA:
+      case OP_STX:
+      case OP_STY:
+         ok = writeOperand(mode, operand, kind == OP_STA ? REG_A : kind == OP_STX ? REG_X : REG_Y, next);
+         break;
+      case OP_ADC:
+      case OP_SBC:
+         if ((ok = readOperand(mode, operand, opExtraCycles[opcode]))) {
+            if (kind == OP_SBC) {
+               aluImm(ALU_XOR, RDX, 0xFF);
+            }
+            addWithCarry();
+         }
+         break;
+      case OP_AND:
+      case OP_ORA:
+      case OP_EOR:
+         if ((ok = readOperand(mode, operand, opExtraCycles[opcode]))) {
+            alu(kind == OP_AND ? ALU_AND : kind == OP_ORA ? ALU_OR : ALU_XOR, REG_A, RDX);
+            movReg(RAX, REG_A);
+            setNZ();
+         }
+         break;
+      case OP_CMP:
+      case OP_CPX:
+      case OP_CPY:
+         if ((ok = readOperand(mode, operand, opExtraCycles[opcode]))) {
+            compare(kind == OP_CMP ? REG_A : kind == OP_CPX ? REG_X : REG_Y);
+         }
+         break;
+      case OP_BIT:
+         if ((ok = readOperand(mode, operand, opExtraCycles[opcode]))) {
+            aluImm(ALU_AND, REG_P, ~(FLAG_N | FLAG_V | FLAG_Z) & 0xFF);
+            movReg(RSI, RDX);
+            aluImm(ALU_AND, RSI, FLAG_N | FLAG_V);
+            alu(ALU_OR, REG_P, RSI);
+            movReg(RAX, REG_A);
+            alu(ALU_AND, RAX, RDX);
+            load8Index(RSI, REG_STATE, RAX, STATE(nz));
+            aluImm(ALU_AND, RSI, FLAG_Z);
+            alu(ALU_OR, REG_P, RSI);
+         }
+         break;
+      case OP_ASL:
+      case OP_LSR:
+      case OP_ROL:
+      case OP_ROR:
+         if (mode == MODE_IMPL) {
+            movReg(RDX, REG_A);
+            shift(kind);
+            movReg(REG_A, RAX);
+            break;
+         }
+         ok = modifyMemory(kind, mode, operand, next);
+         break;
+      case OP_INC:
+      case OP_DEC:
+         ok = modifyMemory(kind, mode, operand, next);
+         break;
+      case OP_INX: increment(REG_X,  1); break;
+      case OP_INY: increment(REG_Y,  1); break;
+      case OP_DEX: increment(REG_X, -1); break;
+      case OP_DEY: increment(REG_Y, -1); break;
+      case OP_TAX: transfer(REG_X, REG_A, 1); break;
+      case OP_TAY: transfer(REG_Y, REG_A, 1); break;
+      case OP_TXA: transfer(REG_A, REG_X, 1); break;
+      case OP_TYA: transfer(REG_A, REG_Y, 1); break;
+      case OP_TSX: transfer(REG_X, REG_SP, 1); break;
+      case OP_TXS: transfer(REG_SP, REG_X, 0); break;
+      case OP_CLC: aluImm(ALU_AND, REG_P, ~FLAG_C & 0xFF); break;
+      case OP_SEC: aluImm(ALU_OR, REG_P, FLAG_C); break;
+      case OP_SEI: aluImm(ALU_OR, REG_P, FLAG_I); break;
+      case OP_CLD: aluImm(ALU_AND, REG_P, ~FLAG_D & 0xFF); break;
+      case OP_SED: aluImm(ALU_OR, REG_P, FLAG_D); break;
+      case OP_CLV: aluImm(ALU_AND, REG_P, ~FLAG_V & 0xFF); break;
+      case OP_NOP:
+         ok = mode == MODE_IMPL;
+         break;
+      case OP_PHA:
+         pushByte(REG_A, next);
+         break;
+      case OP_PHP:
+         movReg(RDX, REG_P);
+         aluImm(ALU_OR, RDX, FLAG_B);
+         pushByte(RDX, next);
+         break;
+      case OP_PLA:
+         popByte();
+         transfer(REG_A, RDX, 1);
+         break;
+      case OP_BRANCH: {
+         uint16_t target = next + (int8_t)operand;
+         int extra = (target & 0xFF00) == (next & 0xFF00) ? 1 : 2;
+
+         testImm(REG_P, BranchFlags[opcode >> 6]);
+         uint8_t *notTaken = jcc((opcode & 0x20) ? CC_Z : CC_NZ);
+         pendingCycles += extra;
+         exitTo(target);
+         pendingCycles -= extra;
+         patch(notTaken, out);
+         exitTo(next);
+         *ends = 1;
+         break;
+      }
+      case OP_JMP:
+         if (opcode != 0x4C) {
+            ok = 0;
+            break;
+         }
+         exitTo(operand);
+         *ends = 1;
+         break;
+      case OP_JSR:
+         // Return address is the last byte of the JSR
+         movImm(RDX, (uint16_t)(next - 1) >> 8);
+         pushByte(RDX, -1);
+         movImm(RDX, (uint16_t)(next - 1) & 0xFF);
+         pushByte(RDX, -1);
+         exitTo(operand);
+         *ends = 1;
+         break;
+      case OP_RTS:
+         popByte();
+         movReg(R8, RDX);
+         popByte();
+         shiftImm(SHIFT_SHL, RDX, 8);
+         alu(ALU_OR, RDX, R8);
+         aluImm(ALU_ADD, RDX, 1);
+         store16(RDX, REG_STATE, STATE(PC));
+         exitBlock();
+         *ends = 1;
+         break;
+      default:
+         ok = 0;
+         break;
+   }
+
+   if (!ok) {
+      out = start;
+   }
+   return ok;
+}
+
+// Spills the registers and runs the instruction at pc through the
+// interpreter. Anything that changes PC or drops compiled code leaves.
+static void interpret(uint16_t pc, int kind, uint16_t next, int *ends) {
+   flushCycles();
+   spill();
+   store16Imm(REG_STATE, STATE(PC), pc);
+   callNES((void *)jitInterpret);
+   reload();
+
+   if (kind == OP_CONTROL || kind == OP_BRANCH || kind == OP_JMP || kind == OP_JSR || kind == OP_RTS) {
+      exitBlock();
+      *ends = 1;
+   } else {
+      cmp8Imm(REG_STATE, STATE(invalidated), 0);
+      uint8_t *valid = jcc(CC_Z);
+      exitBlock();
+      patch(valid, out);
+   }
+   compiling->jit->fallbacks++;
+}
+
+static jitBlock_t *compileBlock(nes_t *nes, uint16_t pc) {
+   jit_t *jit = nes->jit;
+   uint8_t opcode;
+   int ends = 0;
+
+   compiling = nes;
+   if (!peek(pc, &opcode)) {
+      return NULL;
+   }
+
+   if (jit->blocksUsed == MAX_BLOCKS || jit->top + MAX_BLOCK_CODE > jit->codeBuffer + CODE_SIZE) {
+      jitFlush(nes);
+   }
+
+   jitBlock_t *block = jit->blockPool + jit->blocksUsed++;
+   block->code      = (void (*)(jitState_t *))jit->top;
+   block->start     = pc;
+   block->length    = 0;
+   block->maxCycles = 0;
+
+   out           = jit->top;
+   ram           = nes->ram;
+   blockStart    = pc;
+   pendingCycles = 0;
+   numExits      = 0;
+
+   push(RBX);
+   push(RBP);
+   push(R12);
+   push(R13);
+   push(R14);
+   push(R15);
+   // sub rsp, 8 keeps calls out 16 byte aligned
+   emit8(0x48); emit8(0x83); emit8(0xEC); emit8(0x08);
+   movReg64(REG_STATE, RDI);
+   reload();
+
+   int addr = pc;
+   while (!ends) {
+      uint8_t lo = 0, hi = 0;
+
+      if (block->length == MAX_BLOCK_INSTRUCTIONS || !peek(addr, &opcode)) {
+         exitTo(addr);
+         break;
+      }
+
+      int mode   = opMode[opcode];
+      int cycles = opCycles[opcode];
+      int length = instructionLength(opcode, mode);
+
+      if ((length > 1 && !peek(addr + 1, &lo)) || (length > 2 && !peek(addr + 2, &hi))) {
+         exitTo(addr);
+         break;
+      }
+
+      for (int i = 0; i < length; i++) {
+         watchPage(addr + i);
+      }
+
+      uint16_t operand = length == 3 ? lo | hi << 8 : lo;
+      uint16_t next    = addr + length;
+
+      // Interpreted instructions trace themselves, so this is undone for them
+      uint8_t *mark = out;
+      int pendingMark = pendingCycles;
+
+#ifndef NO_TRACE
+      if (jit->compiledTrace) {
+         flushCycles();
+         spill();
+         store16Imm(REG_STATE, STATE(PC), addr);
+         movImm(RSI, opcode);
+         callNES((void *)jitTrace);
+      }
+#endif
+
+      // Branches may take 2 more, and leave room for page crossings
+      block->maxCycles += cycles + 2;
+
+      pendingCycles += cycles;
+      if (!compileInstruction(opcode, opKind[opcode], mode, operand, next, &ends)) {
+         // A block that starts by calling back into the interpreter, like a
+         // $2002 polling loop, only adds its entry and exit to that. The
+         // interpreter keeps it and the PC has to get hot again
+         if (block->length == 0) {
+            jit->blocksUsed--;
+            jit->hits[pc] = 0;
+            return NULL;
+         }
+         out = mark;
+         pendingCycles = pendingMark;
+         interpret(addr, opKind[opcode], next, &ends);
+      }
+
+      block->length++;
+      addr += length;
+
+      if (!ends && addr >= 0x10000) {
+         exitTo(0);
+         break;
+      }
+   }
+
+   block->end = addr;
+
+   uint8_t *epilogue = out;
+   spill();
+   emit8(0x48); emit8(0x83); emit8(0xC4); emit8(0x08);
+   pop(R15);
+   pop(R14);
+   pop(R13);
+   pop(R12);
+   pop(RBP);
+   pop(RBX);
+   emit8(0xC3);
+
+   for (int i = 0; i < numExits; i++) {
+      patch(exits[i], epilogue);
+   }
+
+   jit->top = out;
+   jit->compiledBlocks++;
+   jit->blockMap[pc] = block;
+   return block;
+}
+
+static int buildOpTables() {
+   for (int opcode = 0; opcode < 256; opcode++) {
+      const char *name = opcodeName(opcode);
+      int mode, cycles, extraCycles;
+
+      opcodeInfo(opcode, &mode, &cycles, &extraCycles);
+      opMode[opcode]        = mode;
+      opCycles[opcode]      = cycles;
+      opExtraCycles[opcode] = extraCycles;
+
+      opKind[opcode] = OP_INTERPRET;
+      for (int kind = OP_LDA; kind < NUM_OPS; kind++) {
+         if (!strcmp(name, OpNames[kind])) {
+            opKind[opcode] = kind;
+         }
+      }
+      if ((opcode & 0x1F) == 0x10) {
+         opKind[opcode] = OP_BRANCH;
+      }
+      if (!strcmp(name, "BRK") || !strcmp(name, "RTI") || !strcmp(name, "KIL")) {
+         opKind[opcode] = OP_CONTROL;
+      }
+   }
+   return 1;
+}
+
+void initJIT(nes_t *nes) {
+   // Static local, so consoles starting on several threads build it once
+   static int built = buildOpTables();
+   (void)built;
+
+   jit_t *jit = (jit_t *)calloc(1, sizeof(jit_t));
+   if (!jit) {
+      fprintf(stderr, "Could not allocate memory\n");
+      exit(1);
+   }
+
+   // Only reserves address space, pages are backed as blocks fill them
+   jit->codeBuffer = (uint8_t *)mmap(NULL, CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+   if (jit->codeBuffer == MAP_FAILED) {
+      fprintf(stderr, "Could not map JIT code buffer\n");
+      exit(1);
+   }
+
+   for (int v = 0; v < 256; v++) {
+      nes->jitState.nz[v] = (v & FLAG_N) | (v == 0 ? FLAG_Z : 0);
+   }
+
+   nes->jit = jit;
+   jitFlush(nes);
+}
+
+void cleanJIT(nes_t *nes) {
+   if (nes->jit) {
+      munmap(nes->jit->codeBuffer, CODE_SIZE);
+      free(nes->jit);
+      nes->jit = NULL;
+   }
+}
+
+void jitFlush(nes_t *nes) {
+   jit_t *jit = nes->jit;
+
+   // Cheaper than clearing the whole map when few blocks were compiled
+   for (int i = 0; i < jit->blocksUsed; i++) {
+      jit->blockMap[jit->blockPool[i].start] = NULL;
+   }
+   memset(jit->hits, 0, sizeof(jit->hits));
+   memset(nes->jitState.codePages, 0, sizeof(nes->jitState.codePages));
+   jit->blocksUsed = 0;
+   jit->top = jit->codeBuffer;
+}
+
+jitBlock_t *jitBlock(nes_t *nes, uint16_t pc) {
+   jit_t *jit = nes->jit;
+
+#ifndef NO_TRACE
+   // Bus records come from the interpreter's own fetches, which compiled
+   // code skips
+   if (nes->traceFlags & TRACE_BUS_ACCESSES) {
+      return NULL;
+   }
+   if ((nes->traceFlags & TRACE_INSTRUCTIONS) != jit->compiledTrace) {
+      jitFlush(nes);
+      jit->compiledTrace = nes->traceFlags & TRACE_INSTRUCTIONS;
+   }
+#endif
+
+   // Cold code only touches the small hits table
+   if (jit->hits[pc] < HOT_THRESHOLD) {
+      jit->hits[pc]++;
+      return NULL;
+   }
+   if (jit->blockMap[pc]) {
+      return jit->blockMap[pc];
+   }
+   return compileBlock(nes, pc);
+}
+
+void jitInvalidate(nes_t *nes, uint16_t addr) {
+   if (addr < 0x2000) {
+      for (int mirror = 0; mirror < 0x2000; mirror += 0x800) {
+         jitInvalidateRange(nes, ((addr & 0x700) + mirror), 0x100);
+      }
+   } else {
+      jitInvalidateRange(nes, addr & 0xFF00, 0x100);
+   }
+}
+
+void jitInvalidateRange(nes_t *nes, uint16_t addr, int size) {
+   jit_t *jit = nes->jit;
+
+   // Nothing to drop, as at every initMemory()
+   if (jit->blocksUsed == 0) {
+      return;
+   }
+
+   int first = addr > MAX_BLOCK_BYTES ? addr - MAX_BLOCK_BYTES : 0;
+
+   for (int pc = first; pc < addr + size; pc++) {
+      if (jit->blockMap[pc] && jit->blockMap[pc]->end > addr) {
+         jit->blockMap[pc] = NULL;
+      }
+   }
+   for (int page = addr >> 8; page < (addr + size) >> 8; page++) {
+      nes->jitState.codePages[page] = 0;
+   }
+   nes->jitState.invalidated = 1;
+}
+
+uint64_t jitCompiledBlocks(nes_t *nes) {
+   return nes->jit->compiledBlocks;
+}
+
+uint64_t jitFallbacks(nes_t *nes) {
+   return nes->jit->fallbacks;
+}
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <inttypes.h>
+
+// Console state, see nes.h
+typedef struct nes_s nes_t;
+
+// Registers as the compiled blocks see them. Blocks keep A/X/Y/P/SP in host
+// registers and only spill them here on exit, around interpreter fallbacks
+// and trace calls.
+typedef struct {
+   uint64_t cycles;
+   uint16_t PC;
+   uint8_t  A;
+   uint8_t  X;
+   uint8_t  Y;
+   uint8_t  P;
+   uint8_t  SP;
+   uint8_t  invalidated;    // a store hit compiled code or an event came due, the block must exit
+   uint8_t  nz[256];        // N and Z bits of P for every result byte
+   uint8_t  codePages[256]; // nonzero for pages of RAM/SRAM holding compiled code
+} jitState_t;
+
+typedef struct {
+   void (*code)(jitState_t *state);
+   int      start;
+   int      end;      // one past the last byte compiled
+   int      length;   // instructions
+   int      maxCycles;
+} jitBlock_t;
+
+// A console's code buffer and block tables, private to jit.c
+typedef struct jit_s jit_t;
+
+// Blocks compiled for a console only ever run on it, so each console has
+// its own. store() calls jitInvalidate() when it writes to one of
+// nes->jitState.codePages.
+void initJIT(nes_t *nes);
+
+void cleanJIT(nes_t *nes);
+
+// Drops every compiled block
+void jitFlush(nes_t *nes);
+
+// The block starting at pc, compiled on first use. NULL when pc isn't in
+// directly mapped memory or bus tracing is on, the interpreter runs those.
+jitBlock_t *jitBlock(nes_t *nes, uint16_t pc);
+
+// Drops blocks overlapping the page written at addr, in every RAM mirror
+void jitInvalidate(nes_t *nes, uint16_t addr);
+
+void jitInvalidateRange(nes_t *nes, uint16_t addr, int size);
+
+// Block statistics for the benchmark
+uint64_t jitCompiledBlocks(nes_t *nes);
+uint64_t jitFallbacks(nes_t *nes);
+
+// Runs one instruction on the interpreter from the registers in
+// nes->jitState and writes them back, defined by cpu.c
+void jitInterpret(nes_t *nes);
+
+#endif
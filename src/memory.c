@@ -1,9 +1,9 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "memory.h"
-
-static uint8_t memory[65536];
+#include "nes.h"
 
 // $0000 $800  2KB of work RAM
 // $0800 $800  Mirror of $000-$7FF
@@ -17,45 +17,266 @@ static uint8_t memory[65536];
 // $8000 $4000 PRG-ROM
 // $C000 $4000 PRG-ROM
 
-void initMemory(void *rom, int fileSize) {
-   memcpy(memory + 0xC000, ((uint8_t*)rom)+16, 16*1024);
-   // memcpy(memory + 0x8000, rom, fileSize);
+#define PAGE_SIZE 0x100
+
+#define PRG_BANK_SIZE 0x4000
+#define CHR_BANK_SIZE 0x2000
+#define INES_HEADER_SIZE 16
+#define INES_TRAINER_SIZE 512
+
+uint8_t ioRead(nes_t *nes, uint16_t addr);
+void ioWrite(nes_t *nes, uint16_t addr, uint8_t value);
+uint8_t openBusRead(nes_t *nes, uint16_t addr);
+void ignoreWrite(nes_t *nes, uint16_t addr, uint8_t value);
+void uxromWrite(nes_t *nes, uint16_t addr, uint8_t value);
+
+void mapPages(nes_t *nes, uint16_t addr, int size, uint8_t *readBase, uint8_t *writeBase) {
+   for (int page = addr >> 8; page < (addr + size) >> 8; page++) {
+      nes->readPages[page]  = readBase  ? readBase  + ((page << 8) - addr) : NULL;
+      nes->writePages[page] = writeBase ? writeBase + ((page << 8) - addr) : NULL;
+   }
 }
 
-uint8_t fetch(uint16_t addr) {
-   fprintf(stderr, "Fetching 0x%04X\n", addr);
-   if (addr < 0x2000) {
-      return memory[addr & 0x7FF];
-   } else if (addr < 0x4000) {
-      // ppu register[addr & 0x7];
-      return addr & 0x7;
-   } else if (addr < 0x4020) {
-      // registers
-      return addr - 0x4000;
-   } else {
-      return memory[addr];
+void mapHandlers(nes_t *nes, uint16_t addr, int size, readHandler_t read, writeHandler_t write) {
+   for (int page = addr >> 8; page < (addr + size) >> 8; page++) {
+      nes->readPages[page]     = NULL;
+      nes->writePages[page]    = NULL;
+      nes->readHandlers[page]  = read;
+      nes->writeHandlers[page] = write;
+   }
+}
+
+// Mapping the bank already there is a no-op, so the JIT and decode cache
+// keep what they have for it
+void mapPrgBank(nes_t *nes, uint16_t addr, int bank) {
+   uint8_t *base = nes->prg + (bank % nes->prgBanks) * PRG_BANK_SIZE;
+
+   if (nes->readPages[addr >> 8] == base) {
+      return;
+   }
+   for (int page = addr >> 8; page < (addr + PRG_BANK_SIZE) >> 8; page++) {
+      nes->readPages[page] = base + ((page << 8) - addr);
+   }
+#ifdef JIT
+   jitInvalidateRange(nes, addr, PRG_BANK_SIZE);
+#endif
+#ifdef DECODE_CACHE
+   decodeInvalidateRange(nes, addr, PRG_BANK_SIZE);
+#endif
+}
+
+void initMemory(nes_t *nes, void *rom, int fileSize) {
+   uint8_t *header = (uint8_t *)rom;
+
+   if (fileSize < INES_HEADER_SIZE || memcmp(header, "NES\x1A", 4)) {
+      fprintf(stderr, "Bad iNES file\n");
+      exit(1);
+   }
+
+   int prgStart = INES_HEADER_SIZE + ((header[6] & 0x04) ? INES_TRAINER_SIZE : 0);
+   int chrBanks = header[5];
+
+   nes->prgBanks  = header[4];
+   nes->mapper    = (header[6] >> 4) | (header[7] & 0xF0);
+   nes->mirroring = (header[6] & 0x01) ? MIRROR_VERTICAL : MIRROR_HORIZONTAL;
+
+   if (nes->prgBanks == 0 || fileSize < prgStart + nes->prgBanks * PRG_BANK_SIZE + chrBanks * CHR_BANK_SIZE) {
+      fprintf(stderr, "Bad iNES file\n");
+      exit(1);
+   }
+
+   // No CHR-ROM means the board has 8KB of CHR-RAM instead
+   nes->chrRam  = chrBanks == 0;
+   nes->chrSize = nes->chrRam ? CHR_BANK_SIZE : chrBanks * CHR_BANK_SIZE;
+
+   free(nes->prg);
+   free(nes->chr);
+   nes->prg = (uint8_t *)malloc(nes->prgBanks * PRG_BANK_SIZE);
+   nes->chr = (uint8_t *)calloc(nes->chrSize, 1);
+   if (!nes->prg || !nes->chr) {
+      fprintf(stderr, "Could not allocate memory\n");
+      exit(1);
+   }
+   memcpy(nes->prg, header + prgStart, nes->prgBanks * PRG_BANK_SIZE);
+   if (!nes->chrRam) {
+      memcpy(nes->chr, header + prgStart + nes->prgBanks * PRG_BANK_SIZE, nes->chrSize);
+   }
+
+#ifdef JIT
+   jitFlush(nes);
+#endif
+#ifdef DECODE_CACHE
+   decodeFlush(nes);
+#endif
+
+   memset(nes->ram, 0, sizeof(nes->ram));
+   memset(nes->sram, 0, sizeof(nes->sram));
+
+   // RAM and its three mirrors all point at the same 2KB
+   for (uint16_t mirror = 0; mirror < 0x2000; mirror += sizeof(nes->ram)) {
+      mapPages(nes, mirror, sizeof(nes->ram), nes->ram, nes->ram);
+   }
+
+   // $4000-$401F shares its page with the start of expansion space
+   mapHandlers(nes, 0x2000, 0x2000, ppuRead, ppuWrite);
+   mapHandlers(nes, 0x4000, 0x2000, openBusRead, ignoreWrite);
+   mapHandlers(nes, 0x4000, PAGE_SIZE, ioRead, ioWrite);
+   mapPages(nes, 0x6000, sizeof(nes->sram), nes->sram, nes->sram);
+
+   // Writes to PRG-ROM are mapper registers
+   switch (nes->mapper) {
+      case 2:
+         mapHandlers(nes, 0x8000, 0x8000, NULL, uxromWrite);
+         nes->prgBank = 0;
+         mapPrgBank(nes, 0x8000, 0);
+         mapPrgBank(nes, 0xC000, nes->prgBanks - 1);
+         break;
+      default:
+         if (nes->mapper != 0) {
+            fprintf(stderr, "Unsupported mapper %d, running as NROM\n", nes->mapper);
+         }
+         mapHandlers(nes, 0x8000, 0x8000, NULL, ignoreWrite);
+         mapPrgBank(nes, 0x8000, 0);
+         mapPrgBank(nes, 0xC000, nes->prgBanks - 1);
+         break;
+   }
+}
+
+void cleanMemory(nes_t *nes) {
+   free(nes->prg);
+   free(nes->chr);
+   nes->prg = NULL;
+   nes->chr = NULL;
+}
+
+// A mapper counting CPU cycles schedules this for when its counter expires
+// and lowers the line again when the game acknowledges it
+void mapperIRQEvent(nes_t *nes) {
+   setIRQ(nes, IRQ_MAPPER, 1);
+}
+
+void setButtons(nes_t *nes, int port, uint8_t buttons) {
+   nes->buttons[port] = buttons;
+   if (nes->controllerStrobe) {
+      nes->controllerShift[port] = buttons;
    }
 }
 
-uint16_t fetchZP16(uint16_t addr) {
-   fprintf(stderr, "Fetching 0x%04X\n", addr);
-   return fetch(addr & 0x00FF) | (fetch((addr+1) & 0x00FF) << 8);
+// Each read shifts out the next button, A first. 1s after the eighth, the
+// upper bits are open bus.
+uint8_t controllerRead(nes_t *nes, int port) {
+   uint8_t bit = nes->controllerShift[port] & 1;
+
+   if (!nes->controllerStrobe) {
+      nes->controllerShift[port] = (nes->controllerShift[port] >> 1) | 0x80;
+   }
+   return bit | 0x40;
 }
 
-uint16_t fetch16(uint16_t addr) {
-   fprintf(stderr, "Fetching 0x%04X\n", addr);
-   return fetch(addr) | (fetch((addr+1)) << 8);
+uint8_t ioRead(nes_t *nes, uint16_t addr) {
+   if (addr == 0x4016 || addr == 0x4017) {
+      return controllerRead(nes, addr - 0x4016);
+   }
+   if (addr < 0x4020) {
+      return apuRead(nes, addr);
+   }
+   return openBusRead(nes, addr);
 }
 
-void store(uint16_t addr, uint8_t value) {
-   fprintf(stderr, "Storing 0x%02X into 0x%04X\n", value, addr);
-   if (addr < 0x2000) {
-      memory[addr & 0x7FF] = value;
-   } else if (addr < 0x4000) {
-      // ppu register[addr & 0x7];
+void ioWrite(nes_t *nes, uint16_t addr, uint8_t value) {
+   // While the strobe bit is set both controllers keep reloading the buttons
+   if (addr == 0x4016) {
+      nes->controllerStrobe = value & 1;
+      if (nes->controllerStrobe) {
+         nes->controllerShift[0] = nes->buttons[0];
+         nes->controllerShift[1] = nes->buttons[1];
+      }
+   } else if (addr == 0x4014) {
+      oamDMA(nes, value);
    } else if (addr < 0x4020) {
-      // registers
+      apuWrite(nes, addr, value);
+   }
+}
+
+// Nothing drives the bus, the high address byte is usually what's left on it
+uint8_t openBusRead(nes_t *nes, uint16_t addr) {
+   return addr >> 8;
+}
+
+void ignoreWrite(nes_t *nes, uint16_t addr, uint8_t value) {
+
+}
+
+// UxROM: any write to $8000-$FFFF picks the 16KB bank at $8000. Games
+// write the same bank again often, from their NMI handlers for one.
+void uxromWrite(nes_t *nes, uint16_t addr, uint8_t value) {
+   if (value % nes->prgBanks == nes->prgBank) {
+      return;
+   }
+   nes->prgBank = value % nes->prgBanks;
+   mapPrgBank(nes, 0x8000, nes->prgBank);
+}
+
+uint8_t *readPointer(nes_t *nes, uint16_t addr) {
+   uint8_t *page = nes->readPages[addr >> 8];
+   return page ? page + (addr & 0xFF) : NULL;
+}
+
+uint8_t *writePointer(nes_t *nes, uint16_t addr) {
+   uint8_t *page = nes->writePages[addr >> 8];
+   return page ? page + (addr & 0xFF) : NULL;
+}
+
+uint8_t fetch(nes_t *nes, uint16_t addr) {
+   uint8_t *page = nes->readPages[addr >> 8];
+   uint8_t value = page ? page[addr & 0xFF] : nes->readHandlers[addr >> 8](nes, addr);
+
+   TRACE_BUS(nes, RECORD_FETCH, addr, value);
+   return value;
+}
+
+uint16_t fetchZP16(nes_t *nes, uint16_t addr) {
+   // Zero page is always RAM
+   uint16_t value = nes->ram[addr & 0xFF] | (nes->ram[(addr + 1) & 0xFF] << 8);
+
+   TRACE_BUS(nes, RECORD_FETCH, addr & 0xFF, value & 0xFF);
+   TRACE_BUS(nes, RECORD_FETCH, (addr + 1) & 0xFF, value >> 8);
+   return value;
+}
+
+uint16_t fetch16(nes_t *nes, uint16_t addr) {
+   uint8_t *page = nes->readPages[addr >> 8];
+
+   // Both bytes in one directly mapped page, the common case for operands
+   // and vectors
+   if (page && (addr & 0xFF) != 0xFF) {
+      uint16_t value = page[addr & 0xFF] | (page[(addr & 0xFF) + 1] << 8);
+
+      TRACE_BUS(nes, RECORD_FETCH, addr, value & 0xFF);
+      TRACE_BUS(nes, RECORD_FETCH, addr + 1, value >> 8);
+      return value;
+   }
+
+   return fetch(nes, addr) | (fetch(nes, (addr+1)) << 8);
+}
+
+void store(nes_t *nes, uint16_t addr, uint8_t value) {
+   uint8_t *page = nes->writePages[addr >> 8];
+
+   TRACE_BUS(nes, RECORD_STORE, addr, value);
+   if (page) {
+      page[addr & 0xFF] = value;
+#ifdef JIT
+      if (nes->jitState.codePages[addr >> 8]) {
+         jitInvalidate(nes, addr);
+      }
+#endif
+#ifdef DECODE_CACHE
+      if (nes->decode->pages[addr >> 8]) {
+         decodeInvalidate(nes, addr);
+      }
+#endif
    } else {
-      memory[addr] = value;
+      nes->writeHandlers[addr >> 8](nes, addr, value);
    }
 }
@@ -3,16 +3,51 @@
 
 #include <inttypes.h>
 
-void initMemory(void *rom, int fileSize);
+// Console state, see nes.h
+typedef struct nes_s nes_t;
 
-void cleanMemory();
+// Nametable layout the cartridge wires up
+enum {
+   MIRROR_HORIZONTAL, // $2000 = $2400, $2800 = $2C00
+   MIRROR_VERTICAL    // $2000 = $2800, $2400 = $2C00
+};
 
-uint8_t fetch(uint16_t addr);
+typedef uint8_t (*readHandler_t)(nes_t *nes, uint16_t addr);
+typedef void (*writeHandler_t)(nes_t *nes, uint16_t addr, uint8_t value);
 
-uint16_t fetchZP16(uint16_t addr);
+// Loads the cartridge and clears RAM
+void initMemory(nes_t *nes, void *rom, int fileSize);
 
-uint16_t fetch16(uint16_t addr);
+void cleanMemory(nes_t *nes);
 
-void store(uint16_t addr, uint8_t value);
+// Buttons held on controller port 0 or 1 from now on, bit 0 to 7: A, B,
+// Select, Start, Up, Down, Left, Right
+void setButtons(nes_t *nes, int port, uint8_t buttons);
+
+// Point whole 256 byte pages of the bus at host memory (NULL for no direct
+// access in that direction) or at handlers. addr and size are page aligned.
+void mapPages(nes_t *nes, uint16_t addr, int size, uint8_t *readBase, uint8_t *writeBase);
+
+void mapHandlers(nes_t *nes, uint16_t addr, int size, readHandler_t read, writeHandler_t write);
+
+// Bank switch a 16KB PRG-ROM bank into $8000 or $C000
+void mapPrgBank(nes_t *nes, uint16_t addr, int bank);
+
+// Host pointer behind addr when its page is directly mapped for reading or
+// writing, NULL when it goes through a handler
+uint8_t *readPointer(nes_t *nes, uint16_t addr);
+
+uint8_t *writePointer(nes_t *nes, uint16_t addr);
+
+uint8_t fetch(nes_t *nes, uint16_t addr);
+
+uint16_t fetchZP16(nes_t *nes, uint16_t addr);
+
+uint16_t fetch16(nes_t *nes, uint16_t addr);
+
+void store(nes_t *nes, uint16_t addr, uint8_t value);
+
+// EVENT_MAPPER_IRQ, see scheduler.h
+void mapperIRQEvent(nes_t *nes);
 
 #endif
@@ -0,0 +1,81 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "movie.h"
+
+#define MAX_LINE 1024
+
+// Buttons in the order an .fm2 gamepad column lists them, RLDUTSBA
+#define BUTTON_CHARS 8
+
+static uint8_t parseGamepad(const char *column) {
+   uint8_t buttons = 0;
+
+   for (int i = 0; i < BUTTON_CHARS && column[i] && column[i] != '|'; i++) {
+      if (column[i] != '.' && column[i] != ' ') {
+         buttons |= 1 << (BUTTON_CHARS - 1 - i);
+      }
+   }
+   return buttons;
+}
+
+int loadMovie(const char *fileName, movie_t *movie) {
+   FILE *fp = NULL;
+   char line[MAX_LINE];
+   int capacity = 0;
+
+   movie->buttons = NULL;
+   movie->frames  = 0;
+
+   if (!(fp = fopen(fileName, "r"))) {
+      fprintf(stderr, "Could not load file %s\n", fileName);
+      return 0;
+   }
+
+   while (fgets(line, sizeof(line), fp)) {
+      // Input lines are |commands|port0|port1|port2|, everything else is
+      // header
+      if (line[0] != '|') {
+         continue;
+      }
+
+      char *port0 = strchr(line + 1, '|');
+      char *port1 = port0 ? strchr(port0 + 1, '|') : NULL;
+
+      if (!port1) {
+         fprintf(stderr, "Bad movie line in %s: %s", fileName, line);
+         fclose(fp);
+         freeMovie(movie);
+         return 0;
+      }
+
+      if (movie->frames == capacity) {
+         capacity = capacity ? capacity * 2 : 1024;
+         uint8_t (*grown)[2] = (uint8_t (*)[2])realloc(movie->buttons, capacity * sizeof(*grown));
+
+         if (!grown) {
+            fprintf(stderr, "Could not allocate memory\n");
+            exit(1);
+         }
+         movie->buttons = grown;
+      }
+
+      movie->buttons[movie->frames][0] = parseGamepad(port0 + 1);
+      movie->buttons[movie->frames][1] = parseGamepad(port1 + 1);
+      movie->frames++;
+   }
+
+   fclose(fp);
+   return 1;
+}
+
+void freeMovie(movie_t *movie) {
+   free(movie->buttons);
+   movie->buttons = NULL;
+   movie->frames  = 0;
+}
+
+uint8_t movieButtons(const movie_t *movie, int port, int frame) {
+   return frame < movie->frames ? movie->buttons[frame][port] : 0;
+}
@@ -0,0 +1,21 @@
+#ifndef MOVIE_H
+#define MOVIE_H
+
+#include <inttypes.h>
+
+// Controller input for each frame, as setButtons() takes it
+typedef struct {
+   uint8_t (*buttons)[2]; // ports 0 and 1
+   int frames;
+} movie_t;
+
+// Reads an FCEUX .fm2 movie, only the controller columns of its input
+// lines. Returns 0 after printing why on a bad file.
+int loadMovie(const char *fileName, movie_t *movie);
+
+void freeMovie(movie_t *movie);
+
+// What's held on port during frame, nothing past the end of the movie
+uint8_t movieButtons(const movie_t *movie, int port, int frame);
+
+#endif
@@ -0,0 +1,59 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nes.h"
+
+void *alignedAlloc(size_t size) {
+   void *block = NULL;
+
+   if (posix_memalign(&block, CACHE_LINE, size)) {
+      fprintf(stderr, "Could not allocate memory\n");
+      exit(1);
+   }
+   return block;
+}
+
+nes_t *createNES(void *rom, int fileSize) {
+   nes_t *nes = (nes_t *)alignedAlloc(sizeof(nes_t));
+
+   memset(nes, 0, sizeof(nes_t));
+   nes->outputs = OUTPUT_VIDEO | OUTPUT_AUDIO;
+
+#ifdef DECODE_CACHE
+   if (!(nes->decode = (decode_t *)calloc(1, sizeof(decode_t)))) {
+      fprintf(stderr, "Could not allocate memory\n");
+      exit(1);
+   }
+#endif
+#ifdef JIT
+   initJIT(nes);
+#endif
+
+   powerOnNES(nes, rom, fileSize);
+   return nes;
+}
+
+void powerOnNES(nes_t *nes, void *rom, int fileSize) {
+   initMemory(nes, rom, fileSize);
+   initCPU(nes);
+   initScheduler(nes);
+   initPPU(nes);
+   initAPU(nes);
+}
+
+void setOutputs(nes_t *nes, int outputs) {
+   nes->outputs = outputs;
+}
+
+void destroyNES(nes_t *nes) {
+   if (!nes) {
+      return;
+   }
+
+   traceClose(nes);
+   cleanCPU(nes);
+   cleanMemory(nes);
+   free(nes->decode);
+   free(nes);
+}
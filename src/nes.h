@@ -0,0 +1,139 @@
+#ifndef NES_H
+#define NES_H
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include "apu.h"
+#include "cpu.h"
+#include "decode.h"
+#include "jit.h"
+#include "memory.h"
+#include "ppu.h"
+#include "scheduler.h"
+#include "trace.h"
+
+#define CACHE_LINE 64
+
+#define NUM_PAGES 0x100
+
+// What a console makes besides running the game, see setOutputs()
+#define OUTPUT_VIDEO 0x1
+#define OUTPUT_AUDIO 0x2
+
+typedef struct {
+   uint8_t carry            : 1;
+   uint8_t zero             : 1;
+   uint8_t interruptDisable : 1;
+   uint8_t decimalMode      : 1;
+   uint8_t breakCmd         : 1;
+   uint8_t unused           : 1;
+   uint8_t overflow         : 1;
+   uint8_t negative         : 1;
+} status_t;
+
+// With LAZY_FLAGS, N/Z/C/V are left in P untouched and rebuilt from the
+// inputs of the last instruction that set them, only when something reads
+// them: branches, PHP/BRK and the trace
+typedef struct {
+   uint8_t  zero;      // Z = zero == 0
+   uint8_t  sign;      // N = bit 7
+   uint16_t carry;     // C = bit 8
+   uint8_t  overflowA; // V = bit 7 of (A ^ R) & (B ^ R)
+   uint8_t  overflowB;
+   uint8_t  overflowR;
+} lazyFlags_t;
+
+typedef struct {
+   uint8_t  A;
+   uint8_t  X;
+   uint8_t  Y;
+   status_t P;
+   uint8_t  SP;
+   uint16_t PC;
+#ifdef LAZY_FLAGS
+   lazyFlags_t flags;
+#endif
+} registers_t;
+
+// One console. Everything the machine has lives here, so any number of them
+// can run side by side, each on its own thread. What the CPU touches every
+// instruction comes first, then the bus page tables, then the memory itself.
+struct alignas(CACHE_LINE) nes_s {
+   registers_t registers;
+   uint8_t     halted;     // a KIL opcode jammed the CPU
+   int         traceFlags;
+   int         outputs;    // OUTPUT_* bits, both unless setOutputs() says
+
+   // Total CPU cycles since initCPU(), summed from what each instruction
+   // returns
+   uint64_t    masterCycles;
+   uint64_t    instructions;
+
+   // The run loop's one check between instructions: nothing is due before
+   // this cycle. At or below the first scheduled event, 0 when an interrupt
+   // needs looking at.
+   uint64_t    nextEvent;
+   uint8_t     nmiPending;
+   uint8_t     irqLines;   // IRQ_* sources holding the IRQ line low
+   uint8_t     opCycles;   // base cycles of the instruction running, see busCycle()
+   uint32_t    stallCycles; // DMA cycles not yet charged, see stallCPU()
+
+   trace_t    *trace;
+   decode_t   *decode;
+   jit_t      *jit;
+
+   scheduler_t scheduler;
+
+   // Every 256 byte page of the CPU bus is either a host pointer to the start
+   // of that page, or NULL and goes through the page's handler
+   alignas(CACHE_LINE) uint8_t *readPages[NUM_PAGES];
+   uint8_t       *writePages[NUM_PAGES];
+   readHandler_t  readHandlers[NUM_PAGES];
+   writeHandler_t writeHandlers[NUM_PAGES];
+
+   alignas(CACHE_LINE) uint8_t ram[0x800];
+   uint8_t  sram[0x2000];
+   uint8_t *prg;
+   int      prgBanks;
+   int      prgBank;   // UxROM's bank at $8000
+   int      mapper;
+   uint8_t *chr;       // pattern tables, the PPU sees the first 8KB
+   int      chrSize;
+   int      chrRam;    // chr is writable through $2007
+   int      mirroring; // MIRROR_* from the header, see ppu.c
+
+   // Standard controllers on $4016/$4017, see setButtons()
+   uint8_t  buttons[2];
+   uint8_t  controllerShift[2];
+   uint8_t  controllerStrobe;
+
+   ppu_t    ppu;
+   apu_t    apu;
+
+#ifdef JIT
+   alignas(CACHE_LINE) jitState_t jitState;
+#endif
+};
+
+// size bytes on a cache line boundary, for structs with alignas members
+// that plain new or malloc() don't line up. Exits if there's no memory,
+// free() it.
+void *alignedAlloc(size_t size);
+
+// A console with rom loaded and powered on, exits on a bad ROM like
+// initMemory()
+nes_t *createNES(void *rom, int fileSize);
+
+// Loads rom and powers the console back on: memory, CPU, schedule, PPU
+// and APU, in that order
+void powerOnNES(nes_t *nes, void *rom, int fileSize);
+
+void destroyNES(nes_t *nes);
+
+// Without OUTPUT_VIDEO the PPU only draws lines sprite 0 can still hit on
+// and the framebuffer is left stale, without OUTPUT_AUDIO the APU makes no
+// samples. The game runs the same either way.
+void setOutputs(nes_t *nes, int outputs);
+
+#endif
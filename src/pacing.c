@@ -0,0 +1,55 @@
+#include <math.h>
+#include <string.h>
+
+#include "pacing.h"
+
+static const char *PaceNames[NUM_PACES] = {"audio", "vsync", "uncapped"};
+
+const char *paceName(int pace) {
+   return pace >= 0 && pace < NUM_PACES ? PaceNames[pace] : "?";
+}
+
+int findPace(const char *name) {
+   for (int pace = 0; pace < NUM_PACES; pace++) {
+      if (!strcmp(name, PaceNames[pace])) {
+         return pace;
+      }
+   }
+   return -1;
+}
+
+double controlledRate(double rate, int queued, int capacity) {
+   double fill = capacity ? (double)queued / capacity : 0.5;
+
+   if (fill > 1) {
+      fill = 1;
+   }
+   return rate * (1 + RATE_CONTROL_MAX * (1 - 2 * fill));
+}
+
+void initFrameTimes(frameTimes_t *times) {
+   times->frames = 0;
+   times->mean   = 0;
+   times->m2     = 0;
+   times->min    = 0;
+   times->max    = 0;
+}
+
+// Welford's update, stays accurate over any number of frames
+void addFrameTime(frameTimes_t *times, double seconds) {
+   double delta = seconds - times->mean;
+
+   if (!times->frames || seconds < times->min) {
+      times->min = seconds;
+   }
+   if (!times->frames || seconds > times->max) {
+      times->max = seconds;
+   }
+   times->frames++;
+   times->mean += delta / times->frames;
+   times->m2   += delta * (seconds - times->mean);
+}
+
+double frameJitter(const frameTimes_t *times) {
+   return times->frames > 1 ? sqrt(times->m2 / (times->frames - 1)) : 0;
+}
@@ -0,0 +1,45 @@
+#ifndef PACING_H
+#define PACING_H
+
+#include <inttypes.h>
+
+// What a real-time front end waits on between frames
+enum {
+   PACE_AUDIO,    // the audio device taking samples
+   PACE_VSYNC,    // the display's refresh
+   PACE_UNCAPPED, // nothing, as fast as it goes
+   NUM_PACES
+};
+
+// Furthest dynamic rate control moves the output rate either way
+#define RATE_CONTROL_MAX 0.005
+
+const char *paceName(int pace);
+
+// PACE_* named by name, -1 for none
+int findPace(const char *name);
+
+// Dynamic rate control: the sample rate to make the next frame's audio at
+// so the ring drifts back to half full. Fuller than half makes fewer
+// samples, emptier more, never more than RATE_CONTROL_MAX off rate, far
+// too little to hear as a change in pitch.
+double controlledRate(double rate, int queued, int capacity);
+
+// Time from the start of one frame to the next, as a running mean and
+// variance so it costs nothing to keep
+typedef struct {
+   uint64_t frames;
+   double   mean;   // seconds
+   double   m2;     // sum of squared differences from the mean
+   double   min;
+   double   max;
+} frameTimes_t;
+
+void initFrameTimes(frameTimes_t *times);
+
+void addFrameTime(frameTimes_t *times, double seconds);
+
+// Standard deviation of the frame times, in seconds
+double frameJitter(const frameTimes_t *times);
+
+#endif
@@ -0,0 +1,527 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpu.h"
+#include "nes.h"
+#include "ppu.h"
+#include "scheduler.h"
+
+#define VISIBLE_END_DOT (FIRST_LINE_DOT + PPU_HEIGHT * DOTS_PER_LINE)
+
+// Dots of a line where the scroll changes while rendering: the horizontal
+// scroll reloads at 257 and the pre-render line reloads the vertical at 280.
+// A visible line is drawn at 257, once its last pixel is out at 256.
+#define LINE_END_DOT   257
+#define COPY_Y_DOT     280
+
+// $4014 stalls the CPU this long, one more starting on an odd cycle
+#define OAM_DMA_CYCLES 513
+
+// Per pixel in sprites[], beside the palette entry 0x10-0x1F
+#define SPRITE_BEHIND 0x20
+#define SPRITE_ZERO   0x40
+
+// $2002 bits
+#define STATUS_OVERFLOW 0x20
+#define STATUS_HIT      0x40
+#define STATUS_VBLANK   0x80
+
+// The next dot at or after dot that changes something
+static uint64_t nextFrameDot(uint64_t dot) {
+   uint64_t frameStart = dot - dot % PPU_DOTS_PER_FRAME;
+   uint64_t frameDot   = dot - frameStart;
+
+   if (frameDot <= VBLANK_DOT) {
+      return frameStart + VBLANK_DOT;
+   }
+   if (frameDot <= VBLANK_END_DOT) {
+      return frameStart + VBLANK_END_DOT;
+   }
+   if (frameDot <= PRERENDER_DOT + LINE_END_DOT) {
+      return frameStart + PRERENDER_DOT + LINE_END_DOT;
+   }
+   if (frameDot <= PRERENDER_DOT + COPY_Y_DOT) {
+      return frameStart + PRERENDER_DOT + COPY_Y_DOT;
+   }
+   if (frameDot <= FIRST_LINE_DOT + LINE_END_DOT) {
+      return frameStart + FIRST_LINE_DOT + LINE_END_DOT;
+   }
+   if (frameDot < VISIBLE_END_DOT) {
+      uint64_t lineStart = frameDot - (frameDot - FIRST_LINE_DOT) % DOTS_PER_LINE;
+
+      if (frameDot <= lineStart + LINE_END_DOT) {
+         return frameStart + lineStart + LINE_END_DOT;
+      }
+      if (lineStart + DOTS_PER_LINE < VISIBLE_END_DOT) {
+         return frameStart + lineStart + DOTS_PER_LINE + LINE_END_DOT;
+      }
+   }
+   return frameStart + PPU_DOTS_PER_FRAME + VBLANK_DOT;
+}
+
+// The next vblank after everything the PPU has run
+static uint64_t nextVblankDot(const ppu_t *ppu) {
+   uint64_t frameStart = ppu->dot - ppu->dot % PPU_DOTS_PER_FRAME;
+
+   return frameStart + VBLANK_DOT >= ppu->dot ? frameStart + VBLANK_DOT : frameStart + PPU_DOTS_PER_FRAME + VBLANK_DOT;
+}
+
+static int rendering(const ppu_t *ppu) {
+   return ppu->mask & 0x18;
+}
+
+// Down a pixel row, into the next tile row and from the bottom of a
+// nametable into the one below it
+static void incrementY(ppu_t *ppu) {
+   if ((ppu->v & 0x7000) != 0x7000) {
+      ppu->v += 0x1000;
+      return;
+   }
+
+   int coarseY = (ppu->v >> 5) & 0x1F;
+
+   ppu->v &= ~0x7000;
+   if (coarseY == 29) {
+      coarseY = 0;
+      ppu->v ^= 0x0800;
+   } else if (coarseY == 31) {
+      coarseY = 0;
+   } else {
+      coarseY++;
+   }
+   ppu->v = (ppu->v & ~0x03E0) | (coarseY << 5);
+}
+
+static void copyX(ppu_t *ppu) {
+   ppu->v = (ppu->v & ~0x041F) | (ppu->t & 0x041F);
+}
+
+static void copyY(ppu_t *ppu) {
+   ppu->v = (ppu->v & ~0x7BE0) | (ppu->t & 0x7BE0);
+}
+
+static const uint8_t *tilePixels(nes_t *nes, int tile) {
+   ppu_t *ppu = &nes->ppu;
+
+   if (ppu->tileDirty[tile]) {
+      const uint8_t *planes = nes->chr + tile * 16;
+      uint8_t *pixels = ppu->tiles[tile];
+
+      for (int row = 0; row < 8; row++) {
+         uint8_t low  = planes[row];
+         uint8_t high = planes[row + 8];
+
+         for (int x = 0; x < 8; x++) {
+            pixels[row * 8 + x] = ((low >> (7 - x)) & 1) | (((high >> (7 - x)) & 1) << 1);
+         }
+      }
+      ppu->tileDirty[tile] = 0;
+   }
+   return ppu->tiles[tile];
+}
+
+static uint8_t *nametableByte(ppu_t *ppu, uint16_t addr) {
+   return &ppu->nametables[ppu->ntMap[(addr >> 10) & 3]][addr & 0x3FF];
+}
+
+// $3F10/$3F14/$3F18/$3F1C are the same bytes as $3F00/$3F04/$3F08/$3F0C
+static uint8_t *paletteByte(ppu_t *ppu, uint16_t addr) {
+   addr &= 0x1F;
+   if ((addr & 0x13) == 0x10) {
+      addr &= ~0x10;
+   }
+   return &ppu->palette[addr];
+}
+
+static uint8_t busRead(nes_t *nes, uint16_t addr) {
+   addr &= 0x3FFF;
+   if (addr < 0x2000) {
+      return nes->chr[addr];
+   }
+   if (addr < 0x3F00) {
+      return *nametableByte(&nes->ppu, addr);
+   }
+   return *paletteByte(&nes->ppu, addr);
+}
+
+static void busWrite(nes_t *nes, uint16_t addr, uint8_t value) {
+   addr &= 0x3FFF;
+   if (addr < 0x2000) {
+      if (nes->chrRam) {
+         nes->chr[addr] = value;
+         nes->ppu.tileDirty[addr >> 4] = 1;
+      }
+   } else if (addr < 0x3F00) {
+      *nametableByte(&nes->ppu, addr) = value;
+   } else {
+      *paletteByte(&nes->ppu, addr) = value & 0x3F;
+   }
+}
+
+static int spriteHeight(const ppu_t *ppu) {
+   return (ppu->ctrl & 0x20) ? 16 : 8;
+}
+
+// Each sprite goes on the lines it covers, so a frame's lists cost one pass
+// over OAM rather than one per line. Counting past 8 is the overflow flag
+// as it should be, not the 2C02's buggy evaluation.
+static void buildSpriteLists(ppu_t *ppu) {
+   int height = spriteHeight(ppu);
+
+   for (int line = 0; line < PPU_HEIGHT; line++) {
+      ppu->spriteLists[line].count    = 0;
+      ppu->spriteLists[line].overflow = 0;
+   }
+
+   // Sprites are drawn a line below their OAM Y
+   for (int i = 0; i < 64; i++) {
+      for (int line = ppu->oam[i * 4] + 1; line < ppu->oam[i * 4] + 1 + height && line < PPU_HEIGHT; line++) {
+         spriteList_t *list = &ppu->spriteLists[line];
+
+         if (list->count < 8) {
+            list->sprites[list->count++] = i;
+         } else {
+            list->overflow = 1;
+         }
+      }
+   }
+   ppu->spriteListsValid = 1;
+}
+
+static const spriteList_t *spriteList(ppu_t *ppu, int line) {
+   if (!ppu->spriteListsValid) {
+      buildSpriteLists(ppu);
+   }
+   return &ppu->spriteLists[line];
+}
+
+// Whether sprite 0 is on line. Lists are in OAM order, so it can only be
+// first.
+static int spriteZeroOn(ppu_t *ppu, int line) {
+   const spriteList_t *list = spriteList(ppu, line);
+
+   return list->count && !list->sprites[0];
+}
+
+// Puts line's sprites in sprites[] in reverse, so the lowest numbered wins
+// where they overlap
+static void evaluateSprites(nes_t *nes, int line) {
+   ppu_t *ppu = &nes->ppu;
+   int height = spriteHeight(ppu);
+
+   ppu->spriteLine = line;
+   memset(ppu->sprites, 0, sizeof(ppu->sprites));
+   if (!(ppu->mask & 0x10)) {
+      return;
+   }
+
+   const spriteList_t *list = spriteList(ppu, line);
+
+   for (int n = list->count - 1; n >= 0; n--) {
+      const uint8_t *sprite = &ppu->oam[list->sprites[n] * 4];
+      uint8_t attr = sprite[2];
+      int row = line - sprite[0] - 1;
+      int tile;
+
+      if (attr & 0x80) {
+         row = height - 1 - row;
+      }
+      if (height == 8) {
+         tile = ((ppu->ctrl & 0x08) ? 256 : 0) + sprite[1];
+      } else {
+         tile = ((sprite[1] & 1) ? 256 : 0) + (sprite[1] & 0xFE) + (row >> 3);
+         row &= 7;
+      }
+
+      const uint8_t *pixels = tilePixels(nes, tile) + row * 8;
+      uint8_t flags = 0x10 | ((attr & 3) << 2) | ((attr & 0x20) ? SPRITE_BEHIND : 0) | (list->sprites[n] == 0 ? SPRITE_ZERO : 0);
+
+      for (int x = 0; x < 8 && sprite[3] + x < PPU_WIDTH; x++) {
+         uint8_t pixel = pixels[(attr & 0x40) ? 7 - x : x];
+
+         if (pixel) {
+            ppu->sprites[sprite[3] + x] = flags | pixel;
+         }
+      }
+   }
+}
+
+// Background palette entries 0-15 for pixels x0 up to x1, 0 for transparent,
+// a tile at a time from v's scroll
+static void drawBackground(nes_t *nes, uint8_t *bg, int x0, int x1) {
+   ppu_t *ppu = &nes->ppu;
+   int coarseY = (ppu->v >> 5) & 0x1F;
+   int fineY   = (ppu->v >> 12) & 7;
+   int ntY     = (ppu->v >> 11) & 1;
+   int scroll  = ((ppu->v >> 10) & 1) * 256 + (ppu->v & 0x1F) * 8 + ppu->fineX - ppu->lineAnchor;
+   int table   = (ppu->ctrl & 0x10) ? 256 : 0;
+   int x = x0;
+
+   while (x < x1) {
+      int sx = (scroll + x) & 511;
+      int column = (sx & 255) >> 3;
+      const uint8_t *nametable = ppu->nametables[ppu->ntMap[(sx >> 8) | (ntY << 1)]];
+      uint8_t attr = nametable[0x3C0 + (coarseY >> 2) * 8 + (column >> 2)];
+      const uint8_t *pixels = tilePixels(nes, table + nametable[coarseY * 32 + column]) + fineY * 8;
+
+      attr = ((attr >> (((coarseY & 2) << 1) | (column & 2))) & 3) << 2;
+      for (int px = sx & 7; px < 8 && x < x1; px++, x++) {
+         bg[x] = pixels[px] ? attr | pixels[px] : 0;
+      }
+   }
+}
+
+// Draws pixels x0 up to x1 of a visible line with the registers as they are
+static void drawPixels(nes_t *nes, int line, int x0, int x1) {
+   ppu_t *ppu = &nes->ppu;
+   uint8_t *out = ppu->framebuffer[line];
+   int bgStart     = (ppu->mask & 0x02) ? 0 : 8;
+   int spriteStart = (ppu->mask & 0x04) ? 0 : 8;
+   uint8_t bg[PPU_WIDTH];
+
+   if (x0 >= x1) {
+      return;
+   }
+   // Nobody looks at the pixels, only a sprite 0 hit could change the game
+   if (!(nes->outputs & OUTPUT_VIDEO) && ((ppu->status & STATUS_HIT) || !spriteZeroOn(ppu, line))) {
+      return;
+   }
+   if (ppu->spriteLine != line) {
+      evaluateSprites(nes, line);
+   }
+
+   if (ppu->mask & 0x08) {
+      drawBackground(nes, bg, x0, x1);
+   } else {
+      memset(bg + x0, 0, x1 - x0);
+   }
+
+   for (int x = x0; x < x1; x++) {
+      uint8_t b = x >= bgStart ? bg[x] : 0;
+      uint8_t s = x >= spriteStart ? ppu->sprites[x] : 0;
+      uint8_t entry = b;
+
+      if (s && (!b || !(s & SPRITE_BEHIND))) {
+         entry = s & 0x1F;
+      }
+      // Sprite 0 over background, never at the last pixel
+      if ((s & SPRITE_ZERO) && b && x != PPU_WIDTH - 1) {
+         ppu->status |= STATUS_HIT;
+      }
+      out[x] = ppu->palette[entry];
+   }
+}
+
+// Draws the rest of the line in progress up to the dot the PPU is at, so
+// what's written next only changes the pixels after it
+static void drawToDot(nes_t *nes) {
+   ppu_t *ppu = &nes->ppu;
+   uint64_t frameDot = ppu->dot % PPU_DOTS_PER_FRAME;
+
+   if (frameDot <= FIRST_LINE_DOT || frameDot >= VISIBLE_END_DOT) {
+      return;
+   }
+
+   int line    = (frameDot - FIRST_LINE_DOT) / DOTS_PER_LINE;
+   int lineDot = (frameDot - FIRST_LINE_DOT) % DOTS_PER_LINE;
+
+   // Pixel x comes out on dot x + 1
+   if (lineDot > 1 && lineDot <= LINE_END_DOT) {
+      int x = lineDot - 1 < PPU_WIDTH ? lineDot - 1 : PPU_WIDTH;
+
+      drawPixels(nes, line, ppu->lineX, x);
+      ppu->lineX = x;
+   }
+}
+
+static void runDot(nes_t *nes, uint64_t frameDot) {
+   ppu_t *ppu = &nes->ppu;
+
+   switch (frameDot) {
+      case VBLANK_DOT:
+         ppu->status |= STATUS_VBLANK;
+         if (ppu->ctrl & 0x80) {
+            raiseNMI(nes);
+         }
+         return;
+      case VBLANK_END_DOT:
+         ppu->status &= ~(STATUS_VBLANK | STATUS_HIT | STATUS_OVERFLOW);
+         return;
+      case PRERENDER_DOT + LINE_END_DOT:
+         if (rendering(ppu)) {
+            copyX(ppu);
+         }
+         return;
+      case PRERENDER_DOT + COPY_Y_DOT:
+         if (rendering(ppu)) {
+            copyY(ppu);
+         }
+         return;
+   }
+
+   // The end of a visible line
+   int line = (frameDot - FIRST_LINE_DOT) / DOTS_PER_LINE;
+
+   drawPixels(nes, line, ppu->lineX, PPU_WIDTH);
+   ppu->lineMask[line] = ppu->mask;
+   ppu->lineX      = 0;
+   ppu->lineAnchor = 0;
+   ppu->spriteLine = -1;
+   if (rendering(ppu)) {
+      incrementY(ppu);
+      copyX(ppu);
+
+      // The next line's sprites were evaluated during this one
+      if (line + 1 < PPU_HEIGHT && spriteList(ppu, line + 1)->overflow) {
+         ppu->status |= STATUS_OVERFLOW;
+      }
+   }
+}
+
+void initPPU(nes_t *nes) {
+   ppu_t *ppu = &nes->ppu;
+
+   memset(ppu, 0, sizeof(ppu_t));
+   ppu->spriteLine = -1;
+   memset(ppu->tileDirty, 1, sizeof(ppu->tileDirty));
+
+   for (int i = 0; i < 4; i++) {
+      ppu->ntMap[i] = nes->mirroring == MIRROR_VERTICAL ? i & 1 : i >> 1;
+   }
+   schedule(nes, EVENT_VBLANK, DOT_CYCLE(nextVblankDot(ppu)));
+}
+
+// Jumps from one dot that matters to the next instead of stepping through
+// the ones in between
+void ppuCatchUp(nes_t *nes, uint64_t cycle) {
+   ppu_t *ppu = &nes->ppu;
+   uint64_t target = cycle * 3;
+
+   while (ppu->dot < target) {
+      uint64_t next = nextFrameDot(ppu->dot);
+
+      if (next >= target) {
+         ppu->dot = target;
+         break;
+      }
+      ppu->dot = next + 1;
+      runDot(nes, next % PPU_DOTS_PER_FRAME);
+   }
+}
+
+uint8_t ppuRead(nes_t *nes, uint16_t addr) {
+   ppu_t *ppu = &nes->ppu;
+   uint8_t value;
+
+   ppuCatchUp(nes, busCycle(nes));
+
+   switch (addr & 0x7) {
+      // Reading $2002 ends the vblank flag. Sprite 0 can hit part way
+      // through a line, so the line is drawn up to here first.
+      case 2:
+         drawToDot(nes);
+         value = (ppu->status & 0xE0) | (ppu->latch & 0x1F);
+         ppu->status &= ~STATUS_VBLANK;
+         ppu->writeToggle = 0;
+         return value;
+      case 4:
+         return ppu->oam[ppu->oamAddr];
+      case 7:
+         if ((ppu->v & 0x3FFF) >= 0x3F00) {
+            value = busRead(nes, ppu->v);
+            ppu->readBuffer = busRead(nes, ppu->v - 0x1000);
+         } else {
+            value = ppu->readBuffer;
+            ppu->readBuffer = busRead(nes, ppu->v);
+         }
+         ppu->v += (ppu->ctrl & 0x04) ? 32 : 1;
+         return value;
+      default:
+         return ppu->latch;
+   }
+}
+
+void ppuWrite(nes_t *nes, uint16_t addr, uint8_t value) {
+   ppu_t *ppu = &nes->ppu;
+
+   ppuCatchUp(nes, busCycle(nes));
+   drawToDot(nes);
+   ppu->latch = value;
+
+   switch (addr & 0x7) {
+      // Turning NMI on in the middle of vblank raises one straight away
+      case 0:
+         if (!(ppu->ctrl & 0x80) && (value & 0x80) && (ppu->status & STATUS_VBLANK)) {
+            raiseNMI(nes);
+         }
+         if ((ppu->ctrl ^ value) & 0x20) {
+            ppu->spriteListsValid = 0;
+         }
+         ppu->ctrl = value;
+         ppu->t = (ppu->t & ~0x0C00) | ((value & 3) << 10);
+         break;
+      case 1:
+         ppu->mask = value;
+         break;
+      case 3:
+         ppu->oamAddr = value;
+         break;
+      case 4:
+         ppu->oam[ppu->oamAddr++] = value;
+         ppu->spriteListsValid = 0;
+         break;
+      case 5:
+         if (!ppu->writeToggle) {
+            ppu->t = (ppu->t & ~0x001F) | (value >> 3);
+            ppu->fineX = value & 7;
+         } else {
+            ppu->t = (ppu->t & ~0x73E0) | ((value & 7) << 12) | ((value & 0xF8) << 2);
+         }
+         ppu->writeToggle ^= 1;
+         break;
+      case 6:
+         if (!ppu->writeToggle) {
+            ppu->t = (ppu->t & 0x00FF) | ((value & 0x3F) << 8);
+         } else {
+            ppu->t = (ppu->t & 0xFF00) | value;
+            ppu->v = ppu->t;
+            ppu->lineAnchor = ppu->lineX;
+         }
+         ppu->writeToggle ^= 1;
+         break;
+      case 7:
+         busWrite(nes, ppu->v, value);
+         ppu->v += (ppu->ctrl & 0x04) ? 32 : 1;
+         break;
+   }
+}
+
+// One block copy when the page is memory, a read per byte through its
+// handler when it's I/O. The CPU is stalled for a dummy cycle, an alignment
+// cycle when the write was on an odd cycle, and a read and write per byte.
+void oamDMA(nes_t *nes, uint8_t page) {
+   ppu_t *ppu = &nes->ppu;
+   uint64_t cycle = busCycle(nes);
+   const uint8_t *source = readPointer(nes, page << 8);
+
+   ppuCatchUp(nes, cycle);
+   drawToDot(nes);
+
+   if (source) {
+      memcpy(ppu->oam + ppu->oamAddr, source, 256 - ppu->oamAddr);
+      memcpy(ppu->oam, source + 256 - ppu->oamAddr, ppu->oamAddr);
+   } else {
+      for (int i = 0; i < 256; i++) {
+         ppu->oam[(uint8_t)(ppu->oamAddr + i)] = fetch(nes, page << 8 | i);
+      }
+   }
+   ppu->spriteListsValid = 0;
+
+   stallCPU(nes, OAM_DMA_CYCLES + (cycle & 1));
+}
+
+void vblankEvent(nes_t *nes) {
+   ppuCatchUp(nes, nes->masterCycles);
+   schedule(nes, EVENT_VBLANK, DOT_CYCLE(nextVblankDot(&nes->ppu)));
+}
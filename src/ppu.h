@@ -0,0 +1,101 @@
+#ifndef PPU_H
+#define PPU_H
+
+#include <inttypes.h>
+
+// Console state, see nes.h
+typedef struct nes_s nes_t;
+
+#define PPU_WIDTH  256
+#define PPU_HEIGHT 240
+
+// Frame timing in dots from the start of a frame, which is where the CPU
+// powers on: scanline 241 dot 0. The pre-render line comes 20 lines later
+// and the visible lines 0-239 after it.
+#define DOTS_PER_LINE  341
+#define VBLANK_DOT     1
+#define PRERENDER_DOT  (20 * DOTS_PER_LINE)
+#define VBLANK_END_DOT (PRERENDER_DOT + 1)
+#define FIRST_LINE_DOT (21 * DOTS_PER_LINE)
+
+// Pattern tables at $0000-$1FFF as 8x8 tiles
+#define NUM_TILES 512
+
+// Sprites on one line, at most 8 in OAM order, built for the whole frame
+// in one pass over OAM instead of scanning OAM every line
+typedef struct {
+   uint8_t count;
+   uint8_t overflow;   // a 9th sprite was on the line
+   uint8_t sprites[8]; // OAM indices
+} spriteList_t;
+
+// The PPU doesn't run alongside the CPU. It's caught up to the CPU's cycle
+// when something can see it: a read or write of $2000-$3FFF, or a scheduled
+// event it raises an interrupt from. Catching up draws each visible line
+// whole once the PPU is past it, only a register write part way through a
+// line splits it at the write's dot.
+typedef struct {
+   uint64_t dot;        // dots run since power on
+   uint8_t  ctrl;       // $2000
+   uint8_t  mask;       // $2001
+   uint8_t  status;     // $2002
+   uint8_t  oamAddr;    // $2003
+   uint8_t  latch;      // last byte written, the low bits of a $2002 read
+   uint8_t  readBuffer; // $2007 reads come one read late below the palette
+
+   // VRAM address and the one it's reloaded from, in the bit layout the
+   // scroll uses: fine Y, nametable, coarse Y, coarse X
+   uint16_t v;
+   uint16_t t;
+   uint8_t  fineX;
+   uint8_t  writeToggle; // next $2005/$2006 write is the second one
+
+   int      lineX;       // pixels of the line in progress already drawn
+   int      lineAnchor;  // pixel v's horizontal scroll starts from on this line
+   int      spriteLine;  // line sprites[] was built for, -1 for none
+   uint8_t  sprites[PPU_WIDTH]; // per pixel: palette entry, SPRITE_* flags
+
+   // Rebuilt from OAM when a line needs them after an OAM write or a
+   // sprite size change, lines already drawn keep what they had
+   spriteList_t spriteLists[PPU_HEIGHT];
+   int      spriteListsValid;
+
+   uint8_t  nametables[2][0x400];
+   uint8_t  ntMap[4];    // nametable behind each of $2000/$2400/$2800/$2C00
+   uint8_t  palette[32];
+   uint8_t  oam[256];
+
+   // The pattern tables decoded to one byte per pixel, 0-3. A CHR-RAM write
+   // marks its 16 byte tile dirty and it's decoded again when next drawn.
+   uint8_t  tiles[NUM_TILES][64];
+   uint8_t  tileDirty[NUM_TILES];
+
+   // Colour 0-63 of the NES palette for every pixel, and $2001 as each line
+   // finished for its greyscale and emphasis bits, see video.h
+   uint8_t  framebuffer[PPU_HEIGHT][PPU_WIDTH];
+   uint8_t  lineMask[PPU_HEIGHT];
+} ppu_t;
+
+// First CPU cycle by the end of which the PPU has run dot
+#define DOT_CYCLE(dot) ((dot) / 3 + 1)
+
+// Power on state, schedules the first vblank. Needs the cartridge loaded.
+void initPPU(nes_t *nes);
+
+// Runs the PPU until it has done 3 dots for every CPU cycle before cycle,
+// nothing when it's already there
+void ppuCatchUp(nes_t *nes, uint64_t cycle);
+
+// $2000-$3FFF, mirrored every 8 bytes
+uint8_t ppuRead(nes_t *nes, uint16_t addr);
+
+void ppuWrite(nes_t *nes, uint16_t addr, uint8_t value);
+
+// $4014: copies a 256 byte page of the CPU bus into OAM from $2003 on
+void oamDMA(nes_t *nes, uint8_t page);
+
+// EVENT_VBLANK: nothing may have read $2002 this frame, catches up so the
+// NMI is raised on time
+void vblankEvent(nes_t *nes);
+
+#endif
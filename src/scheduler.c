@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "nes.h"
+#include "scheduler.h"
+
+void frameEvent(nes_t *nes);
+
+// Indexed by event type. Every handler lives with the state it changes.
+static const eventHandler_t EventHandlers[NUM_EVENTS] = {
+   frameEvent,
+   vblankEvent,
+   apuFrameEvent,
+   mapperIRQEvent,
+   dmcEvent,
+   NULL
+};
+
+// First CPU cycle of a frame, as runFrame() counts them
+static uint64_t frameCycle(uint64_t frame) {
+   return (frame * PPU_DOTS_PER_FRAME + 2) / 3;
+}
+
+// Orders by cycle, then by type so ties never depend on scheduling order
+static int before(const scheduler_t *s, int a, int b) {
+   return s->cycles[a] < s->cycles[b] || (s->cycles[a] == s->cycles[b] && a < b);
+}
+
+static void place(scheduler_t *s, int slot, int type) {
+   s->heap[slot] = type;
+   s->slots[type] = slot;
+}
+
+static void siftUp(scheduler_t *s, int slot) {
+   int type = s->heap[slot];
+
+   while (slot > 0 && before(s, type, s->heap[(slot - 1) / 2])) {
+      place(s, slot, s->heap[(slot - 1) / 2]);
+      slot = (slot - 1) / 2;
+   }
+   place(s, slot, type);
+}
+
+static void siftDown(scheduler_t *s, int slot) {
+   int type = s->heap[slot];
+
+   for (;;) {
+      int child = slot * 2 + 1;
+
+      if (child >= s->size) {
+         break;
+      }
+      if (child + 1 < s->size && before(s, s->heap[child + 1], s->heap[child])) {
+         child++;
+      }
+      if (!before(s, s->heap[child], type)) {
+         break;
+      }
+      place(s, slot, s->heap[child]);
+      slot = child;
+   }
+   place(s, slot, type);
+}
+
+static void removeSlot(scheduler_t *s, int slot) {
+   int type = s->heap[slot];
+   int last = s->heap[--s->size];
+
+   s->slots[type] = NUM_EVENTS;
+   if (slot == s->size) {
+      return;
+   }
+
+   place(s, slot, last);
+   siftDown(s, slot);
+   siftUp(s, s->slots[last]);
+}
+
+void initScheduler(nes_t *nes) {
+   scheduler_t *s = &nes->scheduler;
+
+   s->size  = 0;
+   s->frame = 0;
+   for (int type = 0; type < NUM_EVENTS; type++) {
+      s->slots[type] = NUM_EVENTS;
+   }
+   nes->nextEvent = UINT64_MAX;
+#ifdef LOCKSTEP
+   s->lockstepCycle = 0;
+#endif
+
+   schedule(nes, EVENT_FRAME, frameCycle(1));
+}
+
+void schedule(nes_t *nes, int type, uint64_t cycle) {
+   scheduler_t *s = &nes->scheduler;
+
+   if (s->slots[type] != NUM_EVENTS) {
+      removeSlot(s, s->slots[type]);
+   }
+
+   s->cycles[type] = cycle;
+   place(s, s->size++, type);
+   siftUp(s, s->size - 1);
+
+   // nextEvent only ever has to be early, runEvents() puts it right
+   if (cycle < nes->nextEvent) {
+      nes->nextEvent = cycle;
+   }
+}
+
+void cancelEvent(nes_t *nes, int type) {
+   scheduler_t *s = &nes->scheduler;
+
+   if (s->slots[type] != NUM_EVENTS) {
+      removeSlot(s, s->slots[type]);
+   }
+}
+
+uint64_t eventCycle(nes_t *nes, int type) {
+   const scheduler_t *s = &nes->scheduler;
+
+   return s->slots[type] != NUM_EVENTS ? s->cycles[type] : UINT64_MAX;
+}
+
+void pollEvents(nes_t *nes) {
+   nes->nextEvent = 0;
+}
+
+int runEvents(nes_t *nes) {
+   scheduler_t *s = &nes->scheduler;
+   int stopped = 0;
+
+#ifdef LOCKSTEP
+   while (s->lockstepCycle < nes->masterCycles) {
+      s->lockstepCycle++;
+      ppuCatchUp(nes, s->lockstepCycle);
+      apuCatchUp(nes, s->lockstepCycle);
+   }
+#endif
+
+   // A handler can schedule another event that is already due, it fires in
+   // this same pass
+   while (s->size && s->cycles[s->heap[0]] <= nes->masterCycles) {
+      int type = s->heap[0];
+
+      removeSlot(s, 0);
+      if (type == EVENT_STOP) {
+         stopped = 1;
+      } else {
+         EventHandlers[type](nes);
+      }
+   }
+
+   nes->nextEvent = s->size ? s->cycles[s->heap[0]] : UINT64_MAX;
+#ifdef LOCKSTEP
+   nes->nextEvent = 0;
+#endif
+   return stopped;
+}
+
+// However long nothing looks at them, the PPU and APU never fall more than
+// a frame behind
+void frameEvent(nes_t *nes) {
+   scheduler_t *s = &nes->scheduler;
+
+   ppuCatchUp(nes, nes->masterCycles);
+   apuEndFrame(nes);
+   schedule(nes, EVENT_FRAME, frameCycle(++s->frame + 1));
+}
@@ -0,0 +1,62 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <inttypes.h>
+
+// Console state, see nes.h
+typedef struct nes_s nes_t;
+
+// Everything that happens at a set CPU cycle rather than because of an
+// instruction. Each type is scheduled at most once, rescheduling replaces
+// it. Events due on the same cycle fire in this order.
+enum {
+   EVENT_FRAME,      // a new frame starts, every device catches up
+   EVENT_VBLANK,     // scanline 241 dot 1, NMI if $2000 asks for it
+   EVENT_APU_FRAME,  // 4-step frame counter IRQ
+   EVENT_MAPPER_IRQ, // cycle counting mapper IRQ
+   EVENT_DMC,        // DMC sample fetch, steals CPU cycles
+   EVENT_STOP,       // runLoop()'s cycle limit, fires no handler
+   NUM_EVENTS
+};
+
+// Plain data in nes_t, no pointers, so copying a console copies its
+// schedule and two consoles given the same input fire the same events on
+// the same cycles
+typedef struct {
+   uint64_t cycles[NUM_EVENTS]; // when each scheduled type fires
+   uint8_t  heap[NUM_EVENTS];   // scheduled types, a min-heap on (cycle, type)
+   uint8_t  slots[NUM_EVENTS];  // where each type is in heap, NUM_EVENTS if not scheduled
+   uint8_t  size;
+   uint64_t frame;              // frames started, the next EVENT_FRAME starts frame + 1
+#ifdef LOCKSTEP
+   uint64_t lockstepCycle;      // devices have been stepped up to here
+#endif
+} scheduler_t;
+
+typedef void (*eventHandler_t)(nes_t *nes);
+
+// Drops every event and schedules the end of the first frame. initPPU()
+// and initAPU() add theirs.
+void initScheduler(nes_t *nes);
+
+// Fires type once the CPU reaches cycle, replacing any earlier schedule
+void schedule(nes_t *nes, int type, uint64_t cycle);
+
+void cancelEvent(nes_t *nes, int type);
+
+// Cycle type is scheduled for, UINT64_MAX when it isn't
+uint64_t eventCycle(nes_t *nes, int type);
+
+// Makes the run loop call runEvents() at the next instruction boundary,
+// for interrupts raised in the middle of an instruction
+void pollEvents(nes_t *nes);
+
+// Fires every event due by nes->masterCycles, soonest first, and sets
+// nes->nextEvent to the one after. Returns nonzero if EVENT_STOP fired.
+//
+// Build with -DLOCKSTEP to step the PPU and APU one CPU cycle at a time
+// after every instruction here instead of catching them up, which only
+// the benchmark wants.
+int runEvents(nes_t *nes);
+
+#endif
@@ -0,0 +1,295 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <thread>
+
+#include <SDL.h>
+
+#include "audio.h"
+#include "cpu.h"
+#include "file.h"
+#include "nes.h"
+#include "pacing.h"
+#include "triple.h"
+#include "video.h"
+
+// Audio queued between the emulator and the speaker without -latency, ms
+#define DEFAULT_LATENCY 40
+
+// Window size in NES pixels
+#define SCALE 2
+
+// Longest the emulation thread waits for a vsync before going on without
+// it, so a stalled compositor slows it down but never stops it
+#define VSYNC_TIMEOUT 34
+
+// What the audio callback needs. It posts pulled every time it takes
+// samples, so the emulation thread can block until there's room instead
+// of sleeping or spinning.
+typedef struct {
+   audioRing_t *ring;
+   SDL_sem     *pulled;
+} audioOut_t;
+
+// The present thread's. It owns the renderer, the emulation thread only
+// hands it frames through the triple buffer.
+typedef struct {
+   SDL_Window     *window;
+   int             vsync;
+   tripleBuffer_t *frames;
+   SDL_sem        *published; // posted with each frame
+   SDL_sem        *presented; // posted after each present
+   std::atomic<bool> running;
+
+   uint64_t     presents;
+   uint64_t     duplicates; // presents of a frame already shown
+   frameTimes_t latency;    // frame published to present returning
+} display_t;
+
+// Runs on SDL's audio thread, only ever takes what's already queued
+static void audioCallback(void *userdata, Uint8 *stream, int len) {
+   audioOut_t *out = (audioOut_t *)userdata;
+
+   pullAudio(out->ring, (int16_t *)stream, len / (int)sizeof(int16_t));
+   SDL_SemPost(out->pulled);
+}
+
+// The device's own buffer is half the latency, SDL wants a power of two
+static Uint16 deviceSamples(int rate, int latency) {
+   int samples = rate * latency / 2000;
+   Uint16 size = 16;
+
+   while (size * 2 <= samples && size < 4096) {
+      size *= 2;
+   }
+   return size;
+}
+
+// Blocks until the device has taken the ring down to queued samples
+static void waitForAudio(audioOut_t *out, int queued) {
+   while (audioQueued(out->ring) > queued) {
+      SDL_SemWaitTimeout(out->pulled, 100);
+   }
+}
+
+// Queues the frame's audio, waiting for the device to take some whenever
+// the ring is full. A ring shorter than a frame fills in pieces.
+static void queueFrame(audioOut_t *out, const int16_t *samples, int count) {
+   while (count) {
+      int space = audioCapacity(out->ring) - audioQueued(out->ring);
+
+      if (!space) {
+         waitForAudio(out, audioCapacity(out->ring) - 1);
+         continue;
+      }
+      int pushed = pushAudio(out->ring, samples, count < space ? count : space);
+
+      samples += pushed;
+      count   -= pushed;
+   }
+}
+
+// With vsync it presents every refresh, showing the last frame again when
+// there's no new one. Without, it presents each new frame as it comes.
+static void presentFrames(display_t *display) {
+   SDL_Renderer *renderer = SDL_CreateRenderer(display->window, -1,
+      SDL_RENDERER_ACCELERATED | (display->vsync ? SDL_RENDERER_PRESENTVSYNC : 0));
+   SDL_Texture *texture = renderer ? SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+      SDL_TEXTUREACCESS_STREAMING, PPU_WIDTH, PPU_HEIGHT) : NULL;
+
+   if (!texture) {
+      fprintf(stderr, "Could not create a renderer: %s\n", SDL_GetError());
+      exit(1);
+   }
+
+   videoPalette_t palette;
+   int converter = bestConverter();
+
+   buildPalette(&palette, PIXEL_ARGB8888);
+
+   while (display->running.load(std::memory_order_acquire)) {
+      if (!display->vsync) {
+         SDL_SemWaitTimeout(display->published, 100);
+      }
+
+      const frame_t *frame = takeFrame(display->frames);
+      void *pixels;
+      int pitch;
+
+      if (frame) {
+         if (!SDL_LockTexture(texture, NULL, &pixels, &pitch)) {
+            convertPixels(frame->framebuffer, frame->lineMask, &palette, pixels, pitch, converter);
+            SDL_UnlockTexture(texture);
+         }
+      } else if (!display->vsync || !display->presents) {
+         continue;
+      } else {
+         display->duplicates++;
+      }
+
+      SDL_RenderCopy(renderer, texture, NULL, NULL);
+      SDL_RenderPresent(renderer);
+      display->presents++;
+
+      if (frame) {
+         addFrameTime(&display->latency, (frameClock() - frame->finished) / 1e9);
+      }
+      SDL_SemPost(display->presented);
+   }
+
+   SDL_DestroyTexture(texture);
+   SDL_DestroyRenderer(renderer);
+}
+
+int main(int argc, char *argv[]) {
+   int latency = DEFAULT_LATENCY;
+   int pace = PACE_AUDIO;
+
+   if (argc < 2) {
+      fprintf(stderr, "Usage: %s rom.nes [-latency ms] [-pace audio|vsync|uncapped]\n", argv[0]);
+      return 1;
+   }
+   for (int i = 2; i < argc; i++) {
+      if (!strcmp(argv[i], "-latency") && i + 1 < argc) {
+         latency = atoi(argv[++i]);
+      } else if (!strcmp(argv[i], "-pace") && i + 1 < argc) {
+         if ((pace = findPace(argv[++i])) < 0) {
+            fprintf(stderr, "Unknown pace %s\n", argv[i]);
+            return 1;
+         }
+      } else {
+         fprintf(stderr, "Unknown option %s\n", argv[i]);
+         return 1;
+      }
+   }
+
+   void *rom = NULL;
+   int fileSize = 0;
+
+   loadFile(argv[1], &rom, &fileSize);
+
+   nes_t *nes = createNES(rom, fileSize);
+
+   free(rom);
+
+   if (SDL_Init(SDL_INIT_AUDIO | SDL_INIT_VIDEO)) {
+      fprintf(stderr, "Could not start SDL: %s\n", SDL_GetError());
+      return 1;
+   }
+
+   display_t display;
+
+   display.window = SDL_CreateWindow("DonoNES", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+      PPU_WIDTH * SCALE, PPU_HEIGHT * SCALE, 0);
+   if (!display.window) {
+      fprintf(stderr, "Could not open a window: %s\n", SDL_GetError());
+      return 1;
+   }
+   display.vsync      = pace == PACE_VSYNC;
+   display.frames     = createTripleBuffer();
+   display.published  = SDL_CreateSemaphore(0);
+   display.presented  = SDL_CreateSemaphore(0);
+   display.presents   = 0;
+   display.duplicates = 0;
+   display.running.store(true);
+   initFrameTimes(&display.latency);
+
+   audioOut_t out;
+   SDL_AudioSpec want, have;
+
+   out.ring   = createAudioRing(APU_SAMPLE_RATE, latency);
+   out.pulled = SDL_CreateSemaphore(0);
+
+   // No changes allowed, SDL converts if the hardware runs at another rate
+   memset(&want, 0, sizeof(want));
+   want.freq     = APU_SAMPLE_RATE;
+   want.format   = AUDIO_S16SYS;
+   want.channels = 1;
+   want.samples  = deviceSamples(APU_SAMPLE_RATE, latency);
+   want.callback = audioCallback;
+   want.userdata = &out;
+
+   SDL_AudioDeviceID device = SDL_OpenAudioDevice(NULL, 0, &want, &have, 0);
+
+   if (!device) {
+      fprintf(stderr, "Could not open audio: %s\n", SDL_GetError());
+      return 1;
+   }
+
+   // Started once nothing else can fail, returning past a joinable thread
+   // would terminate instead of printing the error
+   std::thread presenter(presentFrames, &display);
+
+   SDL_PauseAudioDevice(device, 0);
+
+   frameTimes_t times;
+   Uint64 ticks = SDL_GetPerformanceCounter(), frequency = SDL_GetPerformanceFrequency();
+   int running = 1;
+
+   initFrameTimes(&times);
+
+   while (running && !cpuHalted(nes)) {
+      SDL_Event event;
+
+      while (SDL_PollEvent(&event)) {
+         if (event.type == SDL_QUIT) {
+            running = 0;
+         }
+      }
+
+      // Paced by audio, a frame starts once the device has taken the ring
+      // down to half. Either real-time pace keeps it there with the rate.
+      if (pace == PACE_AUDIO) {
+         waitForAudio(&out, audioCapacity(out.ring) / 2);
+      } else if (pace == PACE_VSYNC) {
+         SDL_SemWaitTimeout(display.presented, VSYNC_TIMEOUT);
+      }
+      if (pace != PACE_UNCAPPED) {
+         setSampleRate(nes, controlledRate(APU_SAMPLE_RATE, audioQueued(out.ring), audioCapacity(out.ring)));
+      }
+
+      runFrame(nes);
+
+      // Uncapped runs far ahead of the device, its audio would only overrun
+      if (pace != PACE_UNCAPPED) {
+         queueFrame(&out, nes->apu.samples, nes->apu.sampleCount);
+      }
+
+      frame_t *frame = backFrame(display.frames);
+
+      memcpy(frame->framebuffer, nes->ppu.framebuffer, sizeof(frame->framebuffer));
+      memcpy(frame->lineMask, nes->ppu.lineMask, sizeof(frame->lineMask));
+      publishFrame(display.frames);
+      SDL_SemPost(display.published);
+
+      Uint64 now = SDL_GetPerformanceCounter();
+
+      addFrameTime(&times, (double)(now - ticks) / frequency);
+      ticks = now;
+   }
+
+   display.running.store(false, std::memory_order_release);
+   SDL_SemPost(display.published);
+   presenter.join();
+   SDL_CloseAudioDevice(device);
+
+   fprintf(stderr, "%d Hz, %d sample ring, %" PRIu64 " underruns, %" PRIu64 " overruns\n",
+      have.freq, audioCapacity(out.ring), audioUnderruns(out.ring), audioOverruns(out.ring));
+   fprintf(stderr, "Paced by %s: %" PRIu64 " frames, %.3f ms mean, %.3f ms jitter, %.3f-%.3f ms\n",
+      paceName(pace), times.frames, times.mean * 1000, frameJitter(&times) * 1000, times.min * 1000, times.max * 1000);
+   fprintf(stderr, "%" PRIu64 " presents, %" PRIu64 " dropped, %" PRIu64 " duplicated, %.3f ms mean latency, %.3f ms max\n",
+      display.presents, droppedFrames(display.frames), display.duplicates, display.latency.mean * 1000, display.latency.max * 1000);
+
+   destroyAudioRing(out.ring);
+   SDL_DestroySemaphore(out.pulled);
+   destroyTripleBuffer(display.frames);
+   SDL_DestroySemaphore(display.published);
+   SDL_DestroySemaphore(display.presented);
+   SDL_DestroyWindow(display.window);
+   destroyNES(nes);
+   SDL_Quit();
+
+   return 0;
+}
@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <thread>
+
+#include "drain.h"
+#include "nes.h"
+#include "trace.h"
+
+// Records in the ring, must be a power of two
+#define TRACE_RING_SIZE (1 << 16)
+#define TRACE_RING_MASK (TRACE_RING_SIZE - 1)
+
+struct trace_s {
+   traceRecord_t *ring;
+   std::atomic<uint64_t> head;
+   std::atomic<uint64_t> tail;
+   std::atomic<bool> running;
+   drain_t drain;
+   std::thread flusher;
+
+   FILE *file;
+   uint64_t lastCycle;
+   uint64_t stalls;
+};
+
+// Writes up to the end of the ring, the wrapped part goes next pass
+static uint64_t flushRecords(void *arg, uint64_t start, uint64_t end) {
+   trace_t *trace = (trace_t *)arg;
+   uint64_t first = start & TRACE_RING_MASK;
+   uint64_t count = end - start;
+
+   if (first + count > TRACE_RING_SIZE) {
+      count = TRACE_RING_SIZE - first;
+   }
+
+   if (fwrite(trace->ring + first, sizeof(traceRecord_t), count, trace->file) != count) {
+      fprintf(stderr, "Trace write error\n");
+   }
+   return start + count;
+}
+
+int traceOpen(nes_t *nes, const char *fileName, int flags) {
+   trace_t *trace = new trace_t();
+
+   if (!(trace->file = fopen(fileName, "wb"))) {
+      fprintf(stderr, "Could not open trace file %s\n", fileName);
+      delete trace;
+      return 0;
+   }
+
+   if (!(trace->ring = (traceRecord_t *)malloc(TRACE_RING_SIZE * sizeof(traceRecord_t)))) {
+      fprintf(stderr, "Could not allocate memory\n");
+      fclose(trace->file);
+      delete trace;
+      return 0;
+   }
+
+   traceClose(nes);
+
+   trace->head.store(0);
+   trace->tail.store(0);
+   trace->running.store(true);
+   trace->drain   = {&trace->head, &trace->tail, &trace->running, flushRecords, trace};
+   trace->flusher = std::thread(drainRing, &trace->drain);
+
+   nes->trace      = trace;
+   nes->traceFlags = flags;
+   return 1;
+}
+
+void traceClose(nes_t *nes) {
+   trace_t *trace = nes->trace;
+
+   if (!trace) {
+      return;
+   }
+
+   nes->traceFlags = 0;
+   trace->running.store(false, std::memory_order_release);
+   trace->flusher.join();
+
+   fclose(trace->file);
+   free(trace->ring);
+   delete trace;
+   nes->trace = NULL;
+}
+
+void traceSetFlags(nes_t *nes, int flags) {
+   nes->traceFlags = nes->trace ? flags : 0;
+}
+
+uint64_t traceStalls(nes_t *nes) {
+   return nes->trace ? nes->trace->stalls : 0;
+}
+
+void pushRecord(trace_t *trace, const traceRecord_t *record) {
+   uint64_t pos = trace->head.load(std::memory_order_relaxed);
+
+   // Never drop records, wait for the flusher to make room instead
+   while (pos - trace->tail.load(std::memory_order_acquire) >= TRACE_RING_SIZE) {
+      trace->stalls++;
+      std::this_thread::yield();
+   }
+
+   trace->ring[pos & TRACE_RING_MASK] = *record;
+   trace->head.store(pos + 1, std::memory_order_release);
+}
+
+void traceInstruction(trace_t *trace, uint64_t cycle, uint16_t pc, uint8_t opcode, uint8_t A, uint8_t X, uint8_t Y, uint8_t P, uint8_t SP) {
+   traceRecord_t record;
+
+   record.cycle = cycle;
+   record.type  = RECORD_INSTRUCTION;
+   record.addr  = pc;
+   record.value = opcode;
+   record.A     = A;
+   record.X     = X;
+   record.Y     = Y;
+   record.P     = P;
+   record.SP    = SP;
+
+   trace->lastCycle = cycle;
+   pushRecord(trace, &record);
+}
+
+void traceBus(trace_t *trace, uint8_t type, uint16_t addr, uint8_t value) {
+   traceRecord_t record = {};
+
+   record.cycle = trace->lastCycle;
+   record.type  = type;
+   record.addr  = addr;
+   record.value = value;
+
+   pushRecord(trace, &record);
+}
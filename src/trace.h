@@ -0,0 +1,83 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <inttypes.h>
+
+// Console state, see nes.h
+typedef struct nes_s nes_t;
+
+// One console's ring and flusher thread, private to trace.c
+typedef struct trace_s trace_t;
+
+// traceFlags bits, set at runtime through traceOpen()/traceSetFlags()
+#define TRACE_INSTRUCTIONS 0x1
+#define TRACE_BUS_ACCESSES 0x2
+
+enum {
+   RECORD_INSTRUCTION,
+   RECORD_FETCH,
+   RECORD_STORE
+};
+
+// 16 bytes per record. Instruction records hold the registers before the
+// opcode runs, bus records the address and byte moved, stamped with the
+// cycle of the last instruction record.
+typedef struct {
+   uint64_t cycle : 56;
+   uint64_t type  : 8;
+   uint16_t addr;
+   uint8_t  value;
+   uint8_t  A;
+   uint8_t  X;
+   uint8_t  Y;
+   uint8_t  P;
+   uint8_t  SP;
+} traceRecord_t;
+
+// Build with -DNO_TRACE to compile every trace point out of the core
+#ifdef NO_TRACE
+
+// Only pc and opcode are touched, so callers don't warn about unused locals
+#define TRACE_INSTRUCTION(nes, cycle, pc, opcode, A, X, Y, P, SP) do { (void)(pc); (void)(opcode); } while (0)
+#define TRACE_BUS(nes, type, addr, value) do { } while (0)
+#define TRACE_BUS_ENABLED(nes) 0
+
+#else
+
+// The macros read nes->traceFlags, so they need nes.h where they're used
+#define TRACE_INSTRUCTION(nes, cycle, pc, opcode, A, X, Y, P, SP) \
+   do { \
+      if ((nes)->traceFlags & TRACE_INSTRUCTIONS) { \
+         traceInstruction((nes)->trace, cycle, pc, opcode, A, X, Y, P, SP); \
+      } \
+   } while (0)
+
+#define TRACE_BUS(nes, type, addr, value) \
+   do { \
+      if ((nes)->traceFlags & TRACE_BUS_ACCESSES) { \
+         traceBus((nes)->trace, type, addr, value); \
+      } \
+   } while (0)
+
+// For fast paths that skip bus accesses the trace would record
+#define TRACE_BUS_ENABLED(nes) ((nes)->traceFlags & TRACE_BUS_ACCESSES)
+
+#endif
+
+// Starts a background flusher writing nes's records to fileName, returns 0
+// on failure
+int traceOpen(nes_t *nes, const char *fileName, int flags);
+
+// Stops the flusher after it has written everything still in the ring
+void traceClose(nes_t *nes);
+
+void traceSetFlags(nes_t *nes, int flags);
+
+// Times the producer found the ring full and had to wait for the flusher
+uint64_t traceStalls(nes_t *nes);
+
+void traceInstruction(trace_t *trace, uint64_t cycle, uint16_t pc, uint8_t opcode, uint8_t A, uint8_t X, uint8_t Y, uint8_t P, uint8_t SP);
+
+void traceBus(trace_t *trace, uint8_t type, uint16_t addr, uint8_t value);
+
+#endif
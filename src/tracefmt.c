@@ -0,0 +1,44 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "cpu.h"
+#include "trace.h"
+
+// nestest.log starts its CYC/SL columns at dot 0 of scanline 241
+#define DOTS_PER_SCANLINE 341
+#define SCANLINES 262
+#define START_SCANLINE 241
+
+int main(int argc, char *argv[]) {
+   if (argc < 2) {
+      fprintf(stderr, "Usage: %s trace.bin [-b]\n", argv[0]);
+      return 1;
+   }
+
+   FILE *fp = NULL;
+   int showBus = argc > 2 && !strcmp(argv[2], "-b");
+
+   if (!(fp = fopen(argv[1], "rb"))) {
+      fprintf(stderr, "Could not load file %s\n", argv[1]);
+      return 1;
+   }
+
+   traceRecord_t record;
+
+   while (fread(&record, sizeof(record), 1, fp) == 1) {
+      if (record.type == RECORD_INSTRUCTION) {
+         uint64_t dots = record.cycle * 3;
+         int scanline = (START_SCANLINE + 1 + dots / DOTS_PER_SCANLINE) % SCANLINES - 1;
+
+         printf("%04X  %02X        %-32sA:%02X X:%02X Y:%02X P:%02X SP:%02X CYC:%3d SL:%d\n",
+            record.addr, record.value, opcodeName(record.value),
+            record.A, record.X, record.Y, record.P, record.SP,
+            (int)(dots % DOTS_PER_SCANLINE), scanline);
+      } else if (showBus) {
+         printf("      %s $%04X = %02X\n", record.type == RECORD_FETCH ? "fetch" : "store", record.addr, record.value);
+      }
+   }
+
+   fclose(fp);
+   return 0;
+}
@@ -0,0 +1,78 @@
+#include <stdlib.h>
+
+#include <atomic>
+#include <chrono>
+#include <new>
+
+#include "nes.h"
+#include "triple.h"
+
+// Set in middle when the slot there was published and not taken yet
+#define FRESH 0x4
+#define SLOT  0x3
+
+// Each side's slot and counter on its own cache line
+struct tripleBuffer_s {
+   frame_t frames[3];
+
+   alignas(CACHE_LINE) std::atomic<int> middle; // newest finished slot, FRESH until it is taken
+
+   alignas(CACHE_LINE) int back;  // the writer's
+   uint64_t published;
+   std::atomic<uint64_t> dropped;
+
+   alignas(CACHE_LINE) int front; // the reader's
+};
+
+tripleBuffer_t *createTripleBuffer(void) {
+   tripleBuffer_t *buffer = new (alignedAlloc(sizeof(tripleBuffer_t))) tripleBuffer_t();
+
+   buffer->back  = 0;
+   buffer->middle.store(1);
+   buffer->front = 2;
+   buffer->published = 0;
+   buffer->dropped.store(0);
+   return buffer;
+}
+
+void destroyTripleBuffer(tripleBuffer_t *buffer) {
+   if (!buffer) {
+      return;
+   }
+   buffer->~tripleBuffer_t();
+   free(buffer);
+}
+
+frame_t *backFrame(tripleBuffer_t *buffer) {
+   return &buffer->frames[buffer->back];
+}
+
+void publishFrame(tripleBuffer_t *buffer) {
+   frame_t *frame = &buffer->frames[buffer->back];
+
+   frame->number   = ++buffer->published;
+   frame->finished = frameClock();
+
+   int last = buffer->middle.exchange(buffer->back | FRESH, std::memory_order_acq_rel);
+
+   if (last & FRESH) {
+      buffer->dropped.store(buffer->dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+   }
+   buffer->back = last & SLOT;
+}
+
+const frame_t *takeFrame(tripleBuffer_t *buffer) {
+   if (!(buffer->middle.load(std::memory_order_relaxed) & FRESH)) {
+      return NULL;
+   }
+   buffer->front = buffer->middle.exchange(buffer->front, std::memory_order_acq_rel) & SLOT;
+   return &buffer->frames[buffer->front];
+}
+
+uint64_t droppedFrames(tripleBuffer_t *buffer) {
+   return buffer->dropped.load(std::memory_order_relaxed);
+}
+
+uint64_t frameClock(void) {
+   return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
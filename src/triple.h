@@ -0,0 +1,44 @@
+#ifndef TRIPLE_H
+#define TRIPLE_H
+
+#include <inttypes.h>
+
+#include "ppu.h"
+
+// A finished frame as the PPU left it, see video.h to turn it into pixels
+typedef struct {
+   uint8_t  framebuffer[PPU_HEIGHT][PPU_WIDTH];
+   uint8_t  lineMask[PPU_HEIGHT];
+   uint64_t number;   // frames published before this one, plus one
+   uint64_t finished; // frameClock() when it was published
+} frame_t;
+
+// Frames from the emulation thread to whatever shows them, private to
+// triple.c. Three slots: one being filled, one being shown and the newest
+// finished one between them. Publishing and taking are one atomic swap
+// each, neither side ever waits, and the reader always gets the newest.
+typedef struct tripleBuffer_s tripleBuffer_t;
+
+// Exits if it can't be allocated
+tripleBuffer_t *createTripleBuffer(void);
+
+void destroyTripleBuffer(tripleBuffer_t *buffer);
+
+// Writer side: the slot to fill next, the same one until it's published
+frame_t *backFrame(tripleBuffer_t *buffer);
+
+// Stamps the back frame and swaps it in as the newest. A newest frame
+// nobody took is dropped and counted.
+void publishFrame(tripleBuffer_t *buffer);
+
+// Reader side: the newest frame, NULL when nothing was published since the
+// last one taken. It stays the reader's until the next frame is taken.
+const frame_t *takeFrame(tripleBuffer_t *buffer);
+
+// Frames published over one nobody took, from any thread
+uint64_t droppedFrames(tripleBuffer_t *buffer);
+
+// Nanoseconds on a steady clock, what frames are stamped with
+uint64_t frameClock(void);
+
+#endif
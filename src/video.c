@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "nes.h"
+#include "video.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define VIDEO_X86
+#include <immintrin.h>
+#endif
+
+// The 2C02's colours as 0xRRGGBB, $xE and $xF are black
+static const uint32_t NESColors[64] = {
+   0x666666, 0x002A88, 0x1412A7, 0x3B00A4, 0x5C007E, 0x6E0040, 0x6C0600, 0x561D00,
+   0x333500, 0x0B4800, 0x005200, 0x004F08, 0x00404D, 0x000000, 0x000000, 0x000000,
+   0xADADAD, 0x155FD9, 0x4240FF, 0x7527FE, 0xA01ACC, 0xB71E7B, 0xB53120, 0x994E00,
+   0x6B6D00, 0x388700, 0x0C9300, 0x008F32, 0x007C8D, 0x000000, 0x000000, 0x000000,
+   0xFFFEFF, 0x64B0FF, 0x9290FF, 0xC676FF, 0xF36AFF, 0xFE6ECC, 0xFE8170, 0xEA9E22,
+   0xBCBE00, 0x88D800, 0x5CE430, 0x45E082, 0x48CDDE, 0x4F4F4F, 0x000000, 0x000000,
+   0xFFFEFF, 0xC0DFFF, 0xD3D2FF, 0xE8C8FF, 0xFBC2FF, 0xFEC4EA, 0xFECCC5, 0xF7D8A5,
+   0xE4E594, 0xCFEF96, 0xBDF4AB, 0xB3F3CC, 0xB5EBF2, 0xB8B8B8, 0x000000, 0x000000
+};
+
+// An emphasis bit darkens the two channels it doesn't name
+#define EMPHASIS_ATTENUATION 0.816
+
+static const char *ConverterNames[NUM_CONVERTERS] = {"scalar", "sse2", "avx2"};
+
+void buildPalette(videoPalette_t *palette, int format) {
+   for (int emphasis = 0; emphasis < 8; emphasis++) {
+      for (int color = 0; color < 64; color++) {
+         uint32_t rgb = NESColors[color];
+         double channels[3] = {(double)(rgb >> 16), (double)((rgb >> 8) & 0xFF), (double)(rgb & 0xFF)};
+
+         // Bits 5, 6 and 7 of $2001 are red, green and blue
+         for (int c = 0; c < 3; c++) {
+            if (emphasis && !(emphasis & (1 << c))) {
+               channels[c] *= EMPHASIS_ATTENUATION;
+            }
+         }
+
+         uint32_t r = (uint32_t)(channels[0] + 0.5), g = (uint32_t)(channels[1] + 0.5), b = (uint32_t)(channels[2] + 0.5);
+
+         palette->colors[emphasis << 6 | color] = format == PIXEL_RGBA8888 ?
+            r << 24 | g << 16 | b << 8 | 0xFF :
+            0xFF000000 | r << 16 | g << 8 | b;
+      }
+   }
+}
+
+int converterSupported(int converter) {
+   switch (converter) {
+      case CONVERT_SCALAR:
+         return 1;
+#ifdef VIDEO_X86
+      case CONVERT_SSE2:
+         return __builtin_cpu_supports("sse2");
+      case CONVERT_AVX2:
+         return __builtin_cpu_supports("avx2");
+#endif
+      default:
+         return 0;
+   }
+}
+
+int bestConverter(void) {
+   for (int converter = NUM_CONVERTERS - 1; converter > CONVERT_SCALAR; converter--) {
+      if (converterSupported(converter)) {
+         return converter;
+      }
+   }
+   return CONVERT_SCALAR;
+}
+
+const char *converterName(int converter) {
+   return converter >= 0 && converter < NUM_CONVERTERS ? ConverterNames[converter] : "?";
+}
+
+// Each kernel converts one line. greyscale is ANDed into every colour
+// before the lookup in table, the line's 64 entry slice of the palette.
+typedef void (*convertLine_t)(const uint8_t *in, uint32_t *out, const uint32_t *table, uint8_t greyscale);
+
+static void convertLineScalar(const uint8_t *in, uint32_t *out, const uint32_t *table, uint8_t greyscale) {
+   for (int x = 0; x < PPU_WIDTH; x++) {
+      out[x] = table[in[x] & greyscale];
+   }
+}
+
+#ifdef VIDEO_X86
+
+// SSE2 has no gather, so it masks 16 colours at once and puts the looked up
+// pixels together four to a store
+__attribute__((target("sse2")))
+static void convertLineSSE2(const uint8_t *in, uint32_t *out, const uint32_t *table, uint8_t greyscale) {
+   const __m128i mask = _mm_set1_epi8((char)greyscale);
+   alignas(16) uint8_t colors[16];
+
+   for (int x = 0; x < PPU_WIDTH; x += 16) {
+      _mm_store_si128((__m128i *)colors, _mm_and_si128(_mm_loadu_si128((const __m128i *)(in + x)), mask));
+
+      for (int i = 0; i < 16; i += 4) {
+         __m128i pixels = _mm_setr_epi32(table[colors[i]], table[colors[i + 1]], table[colors[i + 2]], table[colors[i + 3]]);
+
+         _mm_storeu_si128((__m128i *)(out + x + i), pixels);
+      }
+   }
+}
+
+// Widens 8 colours to 32 bits and gathers their pixels in one instruction
+__attribute__((target("avx2")))
+static void convertLineAVX2(const uint8_t *in, uint32_t *out, const uint32_t *table, uint8_t greyscale) {
+   const __m256i mask = _mm256_set1_epi32(greyscale);
+
+   for (int x = 0; x < PPU_WIDTH; x += 8) {
+      __m256i colors = _mm256_and_si256(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(in + x))), mask);
+
+      _mm256_storeu_si256((__m256i *)(out + x), _mm256_i32gather_epi32((const int *)table, colors, 4));
+   }
+}
+
+#endif
+
+void convertPixels(const uint8_t (*framebuffer)[PPU_WIDTH], const uint8_t *lineMask, const videoPalette_t *palette,
+   void *pixels, int pitch, int converter) {
+   convertLine_t convertLine = convertLineScalar;
+
+#ifdef VIDEO_X86
+   if (converter == CONVERT_SSE2) {
+      convertLine = convertLineSSE2;
+   } else if (converter == CONVERT_AVX2) {
+      convertLine = convertLineAVX2;
+   }
+#endif
+
+   for (int line = 0; line < PPU_HEIGHT; line++) {
+      uint8_t mask = lineMask[line];
+
+      convertLine(framebuffer[line], (uint32_t *)((uint8_t *)pixels + line * pitch),
+         palette->colors + ((mask >> 5) << 6), (mask & 0x01) ? 0x30 : 0x3F);
+   }
+}
+
+void convertFrame(const nes_t *nes, const videoPalette_t *palette, void *pixels, int pitch, int converter) {
+   convertPixels(nes->ppu.framebuffer, nes->ppu.lineMask, palette, pixels, pitch, converter);
+}
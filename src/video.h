@@ -0,0 +1,51 @@
+#ifndef VIDEO_H
+#define VIDEO_H
+
+#include <inttypes.h>
+
+#include "ppu.h"
+
+// Console state, see nes.h
+typedef struct nes_s nes_t;
+
+// Host pixel layouts, named like SDL's from the 32-bit value's most
+// significant byte down
+enum {
+   PIXEL_ARGB8888,
+   PIXEL_RGBA8888
+};
+
+// Ways to convert a frame, all giving the same pixels
+enum {
+   CONVERT_SCALAR,
+   CONVERT_SSE2,
+   CONVERT_AVX2,
+   NUM_CONVERTERS
+};
+
+// Every NES colour under every combination of $2001's three emphasis bits,
+// indexed by emphasis << 6 | colour, already in the host layout
+typedef struct {
+   alignas(64) uint32_t colors[8 * 64];
+} videoPalette_t;
+
+void buildPalette(videoPalette_t *palette, int format);
+
+// Nonzero when the host CPU can run converter
+int converterSupported(int converter);
+
+// The fastest converter the host CPU supports
+int bestConverter(void);
+
+const char *converterName(int converter);
+
+// Writes the PPU's last frame as 256x240 host pixels to pixels, pitch bytes
+// from one row to the next, so it can go straight into a locked texture.
+// Each line is greyscaled and emphasised by the $2001 it finished with.
+void convertFrame(const nes_t *nes, const videoPalette_t *palette, void *pixels, int pitch, int converter);
+
+// The same from a copy of the PPU's framebuffer and lineMask
+void convertPixels(const uint8_t (*framebuffer)[PPU_WIDTH], const uint8_t *lineMask, const videoPalette_t *palette,
+   void *pixels, int pitch, int converter);
+
+#endif